@@ -0,0 +1,243 @@
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <termios.h>
+
+#include "ansi.h"
+
+/* Longest escape sequence we emit for one cell is under 24 bytes, so  *
+ * this holds even a full 80x24 repaint with attributes on every cell. */
+#define ANSI_BUFFER_SIZE 65536
+/* How long to wait after an escape for the rest of a key sequence. */
+#define ANSI_ESCAPE_MS   25
+
+static char ansi_buffer[ANSI_BUFFER_SIZE];
+static uint32_t ansi_len;
+static struct termios ansi_saved;
+/* A key read while looking for an escape sequence that wasn't part of *
+ * one, to be handed out next; -1 if none.                              */
+static int ansi_pushback = -1;
+/* What the terminal is currently set to, so we only send changes. */
+static attr_t ansi_attr;
+static int16_t ansi_y, ansi_x;
+
+static void ansi_write(const char *s, uint32_t n)
+{
+  ssize_t w;
+
+  while (n) {
+    if ((w = write(STDOUT_FILENO, s, n)) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return;
+    }
+    s += w;
+    n -= w;
+  }
+}
+
+static inline void ansi_append(const char *s, uint32_t n)
+{
+  if (ansi_len + n > sizeof (ansi_buffer)) {
+    ansi_write(ansi_buffer, ansi_len);
+    ansi_len = 0;
+  }
+  memcpy(ansi_buffer + ansi_len, s, n);
+  ansi_len += n;
+}
+
+#define ansi_puts(s) ansi_append(s, sizeof (s) - 1)
+
+void ansi_init(void)
+{
+  struct termios t;
+
+  tcgetattr(STDIN_FILENO, &ansi_saved);
+  t = ansi_saved;
+  cfmakeraw(&t);
+  t.c_cc[VMIN] = 1;
+  t.c_cc[VTIME] = 0;
+  tcsetattr(STDIN_FILENO, TCSAFLUSH, &t);
+
+  /* Alternate screen, hide the cursor, reset attributes, clear. */
+  ansi_len = 0;
+  ansi_puts("\033[?1049h\033[?25l\033(B\033[0m\033[2J");
+  ansi_attr = 0;
+  ansi_y = ansi_x = -1;
+  ansi_flush();
+}
+
+void ansi_reset(void)
+{
+  ansi_puts("\033(B\033[0m\033[?25h\033[?1049l");
+  ansi_flush();
+  tcsetattr(STDIN_FILENO, TCSAFLUSH, &ansi_saved);
+}
+
+static void ansi_set_attr(attr_t a)
+{
+  char s[24];
+  uint32_t n;
+
+  if ((a ^ ansi_attr) & A_ALTCHARSET) {
+    if (a & A_ALTCHARSET) {
+      ansi_puts("\033(0");
+    } else {
+      ansi_puts("\033(B");
+    }
+  }
+  if ((a ^ ansi_attr) & (A_BOLD | A_COLOR)) {
+    n = snprintf(s, sizeof (s), "\033[0%s", a & A_BOLD ? ";1" : "");
+    if (PAIR_NUMBER(a)) {
+      n += snprintf(s + n, sizeof (s) - n, ";3%d;40", (int) PAIR_NUMBER(a));
+    }
+    s[n++] = 'm';
+    ansi_append(s, n);
+  }
+
+  ansi_attr = a;
+}
+
+void ansi_put_run(int16_t y, int16_t x, const chtype *run, uint32_t n)
+{
+  char s[16];
+  uint32_t i;
+
+  if (y == ansi_y && x > ansi_x) {
+    /* Skipping over unchanged cells on the same row is shorter */
+    ansi_append(s, snprintf(s, sizeof (s), "\033[%dC", x - ansi_x));
+  } else if (y != ansi_y || x != ansi_x) {
+    ansi_append(s, snprintf(s, sizeof (s), "\033[%d;%dH", y + 1, x + 1));
+  }
+
+  for (i = 0; i < n; i++) {
+    if ((run[i] & A_ATTRIBUTES) != ansi_attr) {
+      ansi_set_attr(run[i] & A_ATTRIBUTES);
+    }
+    s[0] = run[i] & A_CHARTEXT;
+    ansi_append(s, 1);
+  }
+
+  ansi_y = y;
+  ansi_x = x + n;
+}
+
+void ansi_flush(void)
+{
+  ansi_write(ansi_buffer, ansi_len);
+  ansi_len = 0;
+}
+
+/* Reads one byte, waiting at most ms milliseconds (forever if ms < 0). *
+ * Returns -1 if nothing came.                                          */
+static int ansi_read(int ms)
+{
+  struct pollfd p;
+  unsigned char c;
+
+  if (ansi_pushback >= 0) {
+    c = ansi_pushback;
+    ansi_pushback = -1;
+    return c;
+  }
+
+  p.fd = STDIN_FILENO;
+  p.events = POLLIN;
+  while (poll(&p, 1, ms) < 0) {
+    if (errno != EINTR) {
+      return -1;
+    }
+  }
+  if (!(p.revents & POLLIN) || read(STDIN_FILENO, &c, 1) != 1) {
+    return -1;
+  }
+
+  return c;
+}
+
+int ansi_key_pending(void)
+{
+  struct pollfd p;
+
+  if (ansi_pushback >= 0) {
+    return 1;
+  }
+
+  p.fd = STDIN_FILENO;
+  p.events = POLLIN;
+
+  return poll(&p, 1, 0) > 0;
+}
+
+int ansi_getch(int ms)
+{
+  int c, n, final;
+
+  while ((c = ansi_read(ms)) >= 0) {
+    if (c == '\r') {
+      /* curses translates this for us by default */
+      return '\n';
+    }
+    if (c != 27) {
+      return c;
+    }
+
+    /* Either a lone escape or the start of a key sequence, which will *
+     * already be on its way: ESC [ params final, or ESC O final.      */
+    if ((c = ansi_read(ANSI_ESCAPE_MS)) < 0) {
+      return 27;
+    }
+    if (c != '[' && c != 'O') {
+      ansi_pushback = c;
+      return 27;
+    }
+    for (n = 0; (final = ansi_read(ANSI_ESCAPE_MS)) >= '0' && final <= '9';) {
+      n = n * 10 + final - '0';
+    }
+    while (final == ';' || (final >= '0' && final <= '9')) {
+      /* Modifiers; we don't distinguish shifted keys */
+      final = ansi_read(ANSI_ESCAPE_MS);
+    }
+
+    switch (final) {
+    case 'A':
+      return KEY_UP;
+    case 'B':
+      return KEY_DOWN;
+    case 'C':
+      return KEY_RIGHT;
+    case 'D':
+      return KEY_LEFT;
+    case 'H':
+      return KEY_HOME;
+    case 'F':
+      return KEY_END;
+    case 'E':
+    case 'G':
+      return KEY_B2;
+    case 'P':
+      return KEY_F(1);
+    case '~':
+      switch (n) {
+      case 1:
+      case 7:
+        return KEY_HOME;
+      case 4:
+      case 8:
+        return KEY_END;
+      case 5:
+        return KEY_PPAGE;
+      case 6:
+        return KEY_NPAGE;
+      case 11:
+        return KEY_F(1);
+      }
+    }
+    /* Anything else is a key we don't use; drop it and wait for more. */
+  }
+
+  return ERR;
+}
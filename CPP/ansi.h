@@ -0,0 +1,23 @@
+#ifndef ANSI_H
+# define ANSI_H
+
+# include <ncurses.h>
+
+/* A terminal backend that needs nothing but a VT100-ish terminal.  It  *
+ * builds each frame as a buffer of escape sequences and sends it with  *
+ * a single write(), so the cost of a frame is one system call and the  *
+ * bytes that changed.  Cells are curses chtypes, since that's what the *
+ * framebuffer in io.cpp holds; only A_BOLD, A_ALTCHARSET and color     *
+ * pairs (foreground color n on black, as io_init_terminal() sets them  *
+ * up) are understood.  Input comes back as curses key codes.           */
+
+void ansi_init(void);
+void ansi_reset(void);
+void ansi_put_run(int16_t y, int16_t x, const chtype *run, uint32_t n);
+void ansi_flush(void);
+/* Waits up to ms milliseconds for a key, or forever if ms is negative; *
+ * returns ERR if none came.                                            */
+int ansi_getch(int ms);
+int ansi_key_pending(void);
+
+#endif
@@ -0,0 +1,1002 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <string>
+
+#include "dungeon.h"
+#include "pc.h"
+#include "path.h"
+#include "character.h"
+#include "descriptions.h"
+#include "dice.h"
+#include "heap.h"
+#include "utils.h"
+#include "npc.h"
+#include "object.h"
+#include "move.h"
+#include "zobrist.h"
+#include "intent.h"
+#include "region.h"
+#include "bitboard.h"
+
+/* Microbenchmarks for the parts of the game we keep trying to make     *
+ * faster.  Each benchmark seeds rand() with the same value, builds its *
+ * own state, then times its body a fixed number of times in a row to   *
+ * make one sample.  After a warm-up sample, we take as many samples as *
+ * asked for and summarize them, per call of the body, as JSON on       *
+ * stdout.  The median and the MAD (median absolute deviation) are what *
+ * to compare between builds; they barely notice the odd sample that    *
+ * got preempted, which the mean and p99 will happily report.           *
+ *                                                                      *
+ * Anything driven by rand() is reseeded before every sample, so each  *
+ * sample does the same work.                                           *
+ *                                                                      *
+ * The do_moves benchmarks play whole games headless, with the PC on   *
+ * autopilot.  Each sample starts a new game from the same seed, so the *
+ * games come out identical, and a checksum of where each one ends up   *
+ * goes in the results: if an optimization changes it, it changed the   *
+ * game, not just its speed.                                            *
+ *                                                                      *
+ * --compare <file> holds the results up against a baseline from an    *
+ * earlier run (bench_data/baseline.json is the checked-in one) and     *
+ * exits nonzero if anything got slower than noise can explain, any     *
+ * checksum changed, or anything isn't in the baseline at all, since    *
+ * that's nothing checked.  'make bench-check' does that against the    *
+ * checked-in baseline, so a change that adds or changes a benchmark    *
+ * regenerates it too.  Timings only compare on the machine they were   *
+ * taken on, so regenerate the baseline with './bench > ...' when you   *
+ * move.                                                                *
+ *                                                                      *
+ * The map and description files come from bench_data/, so results     *
+ * don't depend on what's in ~/.rlg327.  Run it from CPP/ or point      *
+ * --data at that directory.                                            */
+
+#define BENCH_DEFAULT_SEED    327
+#define BENCH_DEFAULT_SAMPLES 101
+#define BENCH_HEAP_KEYS       1024
+#define BENCH_SIGHTLINES      1024
+#define BENCH_ROLLS           1024
+#define BENCH_CROWD           50
+/* Trips from one end of a horde-sized dungeon to the other and back, *
+ * and across the biggest maps we play on, each of which had better   *
+ * take less than a millisecond.                                      */
+#define BENCH_TRIPS           64
+#define BENCH_LARGE_X         1024
+#define BENCH_LARGE_Y         1024
+/* A big dungeon full of monsters, most of them nowhere near the PC,   *
+ * played as is, with --lod, with --dormant, and with --threads, which *
+ * must end up exactly where it does as is.  Also with every smart     *
+ * monster having just seen the PC, with and without --flow.           */
+#define BENCH_HORDE           200
+#define BENCH_HORDE_X         320
+#define BENCH_HORDE_Y         84
+#define BENCH_THREADS         4
+/* A change only counts if it's more than this many percent, and more  *
+ * than this many MADs (baseline's and ours, added) off the baseline.  */
+#define BENCH_NOISE_PERCENT   15
+#define BENCH_NOISE_MADS      3
+#define BENCH_MAX_RESULTS     64
+/* Times to measure a benchmark again before calling it slower */
+#define BENCH_RETRIES         2
+
+typedef struct bench {
+  const char *name;
+  uint32_t iterations; /* Calls of run() per sample */
+  void (*setup)(dungeon *d);
+  void (*run)(dungeon *d);
+  void (*teardown)(dungeon *d);
+  /* Untimed, around every sample.  finish() returns a checksum of the *
+   * state the sample left behind, which had better be the same every *
+   * time.                                                              */
+  void (*prepare)(dungeon *d);
+  uint32_t (*finish)(dungeon *d);
+  /* An earlier benchmark that plays the same game another way, which *
+   * has to end up in exactly the same state.                         */
+  const char *same_as;
+  /* An earlier benchmark that plays the same game with some mode off. *
+   * If both run and the checks come out the same, the mode changed    *
+   * nothing, so it probably never ran, and that counts as a failure.  */
+  const char *differs_from;
+} bench_t;
+
+typedef struct bench_stats {
+  double median, p99, mad, min, mean;
+} bench_stats_t;
+
+typedef struct bench_result {
+  char name[64];
+  uint32_t iterations;
+  bench_stats_t stats;
+  uint32_t has_check;
+  uint32_t check;
+} bench_result_t;
+
+static std::string bench_dir = "bench_data";
+static std::string bench_save;
+
+static int32_t bench_key_init[BENCH_HEAP_KEYS];
+static int32_t bench_key[BENCH_HEAP_KEYS];
+static int32_t bench_delta[BENCH_HEAP_KEYS];
+static heap_node_t *bench_node[BENCH_HEAP_KEYS];
+static pair_t bench_from[BENCH_SIGHTLINES], bench_to[BENCH_SIGHTLINES];
+static dice bench_dice(5, 4, 6);
+static room_t *bench_sealed;
+/* Somewhere for results to go, so the compiler can't throw away the work */
+static volatile int64_t bench_sink;
+
+static std::string bench_file(const char *file)
+{
+  return bench_dir + "/" + file;
+}
+
+static uint64_t bench_now(void)
+{
+  struct timespec t;
+
+  clock_gettime(CLOCK_MONOTONIC, &t);
+
+  return t.tv_sec * 1000000000ULL + t.tv_nsec;
+}
+
+static int32_t compare_keys(const void *key, const void *with)
+{
+  return *(const int32_t *) key - *(const int32_t *) with;
+}
+
+static void setup_heap(dungeon *d)
+{
+  uint32_t i;
+
+  for (i = 0; i < BENCH_HEAP_KEYS; i++) {
+    bench_key_init[i] = rand() & 0xffff;
+    bench_delta[i] = rand() & 0xff;
+  }
+}
+
+static void run_heap_insert(dungeon *d)
+{
+  heap_t h;
+  uint32_t i;
+
+  memcpy(bench_key, bench_key_init, sizeof (bench_key));
+  heap_init(&h, compare_keys, NULL);
+  for (i = 0; i < BENCH_HEAP_KEYS; i++) {
+    heap_insert(&h, bench_key + i);
+  }
+  heap_delete(&h);
+}
+
+static void run_heap_remove_min(dungeon *d)
+{
+  heap_t h;
+  uint32_t i;
+
+  memcpy(bench_key, bench_key_init, sizeof (bench_key));
+  heap_init(&h, compare_keys, NULL);
+  for (i = 0; i < BENCH_HEAP_KEYS; i++) {
+    heap_insert(&h, bench_key + i);
+  }
+  while (heap_remove_min(&h))
+    ;
+  heap_delete(&h);
+}
+
+/* The way dijkstra_search() uses the heap: everything goes in, then keys *
+ * get lowered in place as shorter paths turn up.  Pulls the minimum      *
+ * first, so there's a consolidated tree for the decreases to cut from.   */
+static void run_heap_decrease_key(dungeon *d)
+{
+  heap_t h;
+  uint32_t i;
+
+  memcpy(bench_key, bench_key_init, sizeof (bench_key));
+  heap_init(&h, compare_keys, NULL);
+  for (i = 0; i < BENCH_HEAP_KEYS; i++) {
+    bench_node[i] = heap_insert(&h, bench_key + i);
+  }
+  bench_node[(int32_t *) heap_remove_min(&h) - bench_key] = NULL;
+  for (i = 0; i < BENCH_HEAP_KEYS; i++) {
+    if (bench_node[i]) {
+      bench_key[i] -= bench_delta[i];
+      heap_decrease_key_no_replace(&h, bench_node[i]);
+    }
+  }
+  while (heap_remove_min(&h))
+    ;
+  heap_delete(&h);
+}
+
+static void setup_generated(dungeon *d)
+{
+  init_dungeon(d);
+  gen_dungeon(d);
+  config_pc(d);
+}
+
+static void setup_pgm(dungeon *d)
+{
+  init_dungeon(d);
+  read_pgm(d, (char *) bench_file("cave.pgm").c_str());
+  config_pc(d);
+}
+
+static void teardown_dungeon(dungeon *d)
+{
+  delete d->PC;
+  d->PC = NULL;
+  delete_dungeon(d);
+}
+
+static void run_dijkstra(dungeon *d)
+{
+  dijkstra(d);
+}
+
+static void run_dijkstra_tunnel(dungeon *d)
+{
+  dijkstra_tunnel(d);
+}
+
+/* A room the PC isn't in, walled off with immutable rock */
+static void setup_sealed(dungeon *d)
+{
+  int32_t x, y;
+  room_t *r;
+
+  setup_generated(d);
+
+  for (r = d->rooms; pc_in_room(d, r - d->rooms); r++)
+    ;
+  for (y = r->position[dim_y] - 1;
+       y <= r->position[dim_y] + r->size[dim_y]; y++) {
+    for (x = r->position[dim_x] - 1;
+         x <= r->position[dim_x] + r->size[dim_x]; x++) {
+      if (y < r->position[dim_y] || y >= r->position[dim_y] + r->size[dim_y] ||
+          x < r->position[dim_x] || x >= r->position[dim_x] + r->size[dim_x]) {
+        mapxy(x, y) = ter_wall_immutable;
+        hardnessxy(x, y) = 255;
+      }
+    }
+  }
+  bitboard_rebuild(d);
+  bench_sealed = r;
+}
+
+/* How many cells of the sealed room got a tunneling distance anyway; *
+ * anything but 0 is a bug.                                           */
+static uint32_t finish_sealed(dungeon *d)
+{
+  int32_t x, y;
+  uint32_t reached;
+
+  for (reached = 0, y = bench_sealed->position[dim_y];
+       y < bench_sealed->position[dim_y] + bench_sealed->size[dim_y]; y++) {
+    for (x = bench_sealed->position[dim_x];
+         x < bench_sealed->position[dim_x] + bench_sealed->size[dim_x]; x++) {
+      reached += d->pc_tunnel[y][x] != DISTANCE_UNREACHABLE;
+    }
+  }
+
+  return reached;
+}
+
+/* Pairs of open cells in sight range of each other, as the PC would test */
+static void setup_sightlines(dungeon *d)
+{
+  uint32_t i;
+
+  setup_generated(d);
+
+  for (i = 0; i < BENCH_SIGHTLINES; i++) {
+    do {
+      bench_from[i][dim_x] = rand_range(1, DUNGEON_X - 2);
+      bench_from[i][dim_y] = rand_range(1, DUNGEON_Y - 2);
+    } while (mappair(bench_from[i]) < ter_floor);
+    bench_to[i][dim_x] = (bench_from[i][dim_x] +
+                          rand_range(-PC_VISUAL_RANGE, PC_VISUAL_RANGE));
+    bench_to[i][dim_y] = (bench_from[i][dim_y] +
+                          rand_range(-PC_VISUAL_RANGE, PC_VISUAL_RANGE));
+  }
+}
+
+static void run_can_see(dungeon *d)
+{
+  uint32_t i, seen;
+
+  for (seen = i = 0; i < BENCH_SIGHTLINES; i++) {
+    seen += can_see(d, bench_from[i], bench_to[i], 1, 0);
+  }
+  bench_sink = seen;
+}
+
+static void run_pc_observe_terrain(dungeon *d)
+{
+  pc_observe_terrain(d->PC, d);
+}
+
+/* Pairs of open cells anywhere on a big map, most of them far apart, *
+ * with the region graph built already.                               */
+static void setup_trips_sized(dungeon *d, int32_t x, int32_t y)
+{
+  uint32_t i;
+  pair_t next;
+
+  set_dungeon_size(x, y);
+  setup_generated(d);
+
+  for (i = 0; i < BENCH_TRIPS; i++) {
+    do {
+      bench_from[i][dim_x] = rand_range(1, DUNGEON_X - 2);
+      bench_from[i][dim_y] = rand_range(1, DUNGEON_Y - 2);
+    } while (mappair(bench_from[i]) < ter_floor);
+    do {
+      bench_to[i][dim_x] = rand_range(1, DUNGEON_X - 2);
+      bench_to[i][dim_y] = rand_range(1, DUNGEON_Y - 2);
+    } while (mappair(bench_to[i]) < ter_floor);
+  }
+  region_next_step(d, bench_from[0], bench_to[0], next);
+}
+
+static void setup_trips(dungeon *d)
+{
+  setup_trips_sized(d, BENCH_HORDE_X, BENCH_HORDE_Y);
+}
+
+static void setup_trips_large(dungeon *d)
+{
+  setup_trips_sized(d, BENCH_LARGE_X, BENCH_LARGE_Y);
+}
+
+static void run_region_next_step(dungeon *d)
+{
+  uint32_t i, stepped;
+  pair_t next;
+
+  for (stepped = i = 0; i < BENCH_TRIPS; i++) {
+    stepped += region_next_step(d, bench_from[i], bench_to[i], next);
+  }
+  bench_sink = stepped;
+}
+
+static void teardown_trips(dungeon *d)
+{
+  teardown_dungeon(d);
+  set_dungeon_size(DEFAULT_DUNGEON_X, DEFAULT_DUNGEON_Y);
+}
+
+static void setup_gen_dungeon(dungeon *d)
+{
+  init_dungeon(d);
+  gen_dungeon(d);
+}
+
+/* Each call replaces the last call's rooms */
+static void run_gen_dungeon(dungeon *d)
+{
+  free(d->rooms);
+  gen_dungeon(d);
+}
+
+static void teardown_gen_dungeon(dungeon *d)
+{
+  delete_dungeon(d);
+}
+
+/* Parses into a dungeon of its own, so the games keep their monsters */
+static void run_parse_descriptions(dungeon *d)
+{
+  static dungeon scratch;
+
+  parse_description_files(&scratch, bench_file(MONSTER_DESC_FILE).c_str(),
+                          bench_file(OBJECT_DESC_FILE).c_str());
+  destroy_descriptions(&scratch);
+}
+
+static void run_dice_roll(dungeon *d)
+{
+  uint32_t i;
+  int64_t total;
+
+  for (total = i = 0; i < BENCH_ROLLS; i++) {
+    total += bench_dice.roll();
+  }
+  bench_sink = total;
+}
+
+static void run_write_dungeon(dungeon *d)
+{
+  write_dungeon(d, (char *) bench_save.c_str());
+}
+
+static void setup_read_dungeon(dungeon *d)
+{
+  setup_generated(d);
+  write_dungeon(d, (char *) bench_save.c_str());
+}
+
+static void run_read_dungeon(dungeon *d)
+{
+  free(d->rooms);
+  read_dungeon(d, (char *) bench_save.c_str());
+}
+
+static void teardown_save(dungeon *d)
+{
+  teardown_dungeon(d);
+  unlink(bench_save.c_str());
+}
+
+static void prepare_game(dungeon *d)
+{
+  d->time = 0;
+  d->character_sequence_number = 0;
+  d->is_new = 0;
+  init_dungeon(d);
+  gen_dungeon(d);
+  config_pc(d);
+  gen_monsters(d);
+  gen_objects(d);
+  zobrist_rebuild(d);
+  pc_observe_terrain(d->PC, d);
+  d->autopilot = 1;
+}
+
+static void prepare_autopilot(dungeon *d)
+{
+  d->max_monsters = MAX_MONSTERS;
+  prepare_game(d);
+}
+
+static void prepare_crowd(dungeon *d)
+{
+  d->max_monsters = BENCH_CROWD;
+  prepare_game(d);
+}
+
+static void prepare_horde(dungeon *d)
+{
+  set_dungeon_size(BENCH_HORDE_X, BENCH_HORDE_Y);
+  d->max_monsters = BENCH_HORDE;
+  prepare_game(d);
+}
+
+static void prepare_horde_lod(dungeon *d)
+{
+  prepare_horde(d);
+  d->lod = 1;
+}
+
+static void prepare_horde_dormant(dungeon *d)
+{
+  prepare_horde(d);
+  d->dormant = 1;
+}
+
+/* Every smart monster without telepathy has just caught sight of the *
+ * PC where it's standing, so the ones that can't see it now have     *
+ * somewhere to chase.                                                */
+static void prepare_horde_chase(dungeon *d)
+{
+  int32_t x, y;
+  npc *n;
+
+  prepare_horde(d);
+  for (y = 0; y < DUNGEON_Y; y++) {
+    for (x = 0; x < DUNGEON_X; x++) {
+      if (d->character_map[y][x] && d->character_map[y][x] != d->PC) {
+        n = (npc *) d->character_map[y][x];
+        if ((n->characteristics & (NPC_SMART | NPC_TELEPATH)) == NPC_SMART) {
+          n->have_seen_pc = 1;
+          n->pc_last_known_position[dim_x] = d->PC->position[dim_x];
+          n->pc_last_known_position[dim_y] = d->PC->position[dim_y];
+        }
+      }
+    }
+  }
+}
+
+static void prepare_horde_flow(dungeon *d)
+{
+  prepare_horde_chase(d);
+  d->flow = 1;
+}
+
+static void prepare_horde_threads(dungeon *d)
+{
+  prepare_horde(d);
+  intent_start(BENCH_THREADS);
+}
+
+/* One PC turn, and all the monster turns before it */
+static void run_do_moves(dungeon *d)
+{
+  if (pc_is_alive(d) && d->boss_alive) {
+    do_moves(d);
+  }
+}
+
+static uint32_t fnv(uint32_t h, uint32_t v)
+{
+  uint32_t i;
+
+  for (i = 0; i < 4; i++, v >>= 8) {
+    h = (h ^ (v & 0xff)) * 16777619;
+  }
+
+  return h;
+}
+
+static uint32_t finish_game(dungeon *d)
+{
+  uint32_t h;
+  int32_t y, x;
+  character *c;
+
+  h = fnv(2166136261U, d->time);
+  h = fnv(h, d->num_monsters);
+  h = fnv(h, pc_is_alive(d));
+  h = fnv(h, d->PC->kills[kill_direct]);
+  for (y = 0; y < DUNGEON_Y; y++) {
+    for (x = 0; x < DUNGEON_X; x++) {
+      h = fnv(h, d->map[y][x]);
+      if ((c = d->character_map[y][x])) {
+        h = fnv(h, (y << 24) | (x << 16) | (c->symbol << 8));
+        h = fnv(h, c->hp);
+      }
+    }
+  }
+
+  delete_pc_inventory(d);
+  delete_pc_equipment(d);
+  if (pc_is_alive(d)) {
+    /* Otherwise it's in the event queue, and goes with it */
+    character_delete(d->PC);
+  }
+  d->PC = NULL;
+  delete_dungeon(d);
+  /* Back to how every other benchmark expects it */
+  set_dungeon_size(DEFAULT_DUNGEON_X, DEFAULT_DUNGEON_Y);
+  d->lod = 0;
+  d->dormant = 0;
+  d->flow = 0;
+  intent_stop();
+
+  return h;
+}
+
+static const bench_t benchmarks[] = {
+  { "heap/insert", 50, setup_heap, run_heap_insert, NULL },
+  { "heap/remove_min", 10, setup_heap, run_heap_remove_min, NULL },
+  { "heap/decrease_key", 10, setup_heap, run_heap_decrease_key, NULL },
+  { "dijkstra/generated", 20,
+    setup_generated, run_dijkstra, teardown_dungeon },
+  { "dijkstra/pgm", 20, setup_pgm, run_dijkstra, teardown_dungeon },
+  { "dijkstra_tunnel/generated", 5,
+    setup_generated, run_dijkstra_tunnel, teardown_dungeon },
+  { "dijkstra_tunnel/pgm", 5,
+    setup_pgm, run_dijkstra_tunnel, teardown_dungeon },
+  { "dijkstra_tunnel/sealed", 5, setup_sealed, run_dijkstra_tunnel,
+    teardown_dungeon, NULL, finish_sealed },
+  { "can_see", 100, setup_sightlines, run_can_see, teardown_dungeon },
+  { "pc_observe_terrain", 1000,
+    setup_generated, run_pc_observe_terrain, teardown_dungeon },
+  { "region_next_step", 1, setup_trips, run_region_next_step, teardown_trips },
+  { "region_next_step/large", 1,
+    setup_trips_large, run_region_next_step, teardown_trips },
+  { "gen_dungeon", 1,
+    setup_gen_dungeon, run_gen_dungeon, teardown_gen_dungeon },
+  { "parse_descriptions", 10, NULL, run_parse_descriptions, NULL },
+  { "dice::roll", 100, NULL, run_dice_roll, NULL },
+  { "write_dungeon", 100, setup_generated, run_write_dungeon, teardown_save },
+  { "read_dungeon", 100, setup_read_dungeon, run_read_dungeon, teardown_save },
+  { "do_moves/autopilot", 50, NULL, run_do_moves, NULL,
+    prepare_autopilot, finish_game },
+  { "do_moves/crowd", 20, NULL, run_do_moves, NULL,
+    prepare_crowd, finish_game },
+  { "do_moves/horde", 3, NULL, run_do_moves, NULL,
+    prepare_horde, finish_game },
+  { "do_moves/horde_lod", 3, NULL, run_do_moves, NULL,
+    prepare_horde_lod, finish_game },
+  { "do_moves/horde_dormant", 3, NULL, run_do_moves, NULL,
+    prepare_horde_dormant, finish_game },
+  { "do_moves/horde_chase", 3, NULL, run_do_moves, NULL,
+    prepare_horde_chase, finish_game },
+  { "do_moves/horde_flow", 3, NULL, run_do_moves, NULL,
+    prepare_horde_flow, finish_game, NULL, "do_moves/horde_chase" },
+  { "do_moves/horde_threads", 3, NULL, run_do_moves, NULL,
+    prepare_horde_threads, finish_game, "do_moves/horde" },
+};
+
+#define NUM_BENCHMARKS (sizeof (benchmarks) / sizeof (benchmarks[0]))
+
+static int compare_samples(const void *v1, const void *v2)
+{
+  double s1 = *(const double *) v1;
+  double s2 = *(const double *) v2;
+
+  return (s1 > s2) - (s1 < s2);
+}
+
+/* Sorts s in place */
+static double median(double *s, uint32_t n)
+{
+  qsort(s, n, sizeof (*s), compare_samples);
+
+  return (n & 1) ? s[n / 2] : (s[n / 2 - 1] + s[n / 2]) / 2;
+}
+
+static void summarize(double *s, uint32_t n, bench_stats_t *stats)
+{
+  double *deviation;
+  uint32_t i;
+
+  deviation = (double *) malloc(n * sizeof (*deviation));
+
+  stats->median = median(s, n);
+  stats->min = s[0];
+  /* Nearest rank */
+  stats->p99 = s[(99 * n + 99) / 100 - 1];
+  for (stats->mean = 0, i = 0; i < n; i++) {
+    stats->mean += s[i] / n;
+    deviation[i] = s[i] > stats->median ? s[i] - stats->median :
+                                          stats->median - s[i];
+  }
+  stats->mad = median(deviation, n);
+
+  free(deviation);
+}
+
+/* Returns one sample: nanoseconds per call of the body. */
+static double sample(const bench_t *b, dungeon *d)
+{
+  uint64_t start;
+  uint32_t i;
+
+  start = bench_now();
+  for (i = 0; i < b->iterations; i++) {
+    b->run(d);
+  }
+
+  return (double) (bench_now() - start) / b->iterations;
+}
+
+static uint32_t selected(const char *name, char **only, uint32_t num_only)
+{
+  uint32_t i;
+
+  if (!num_only) {
+    return 1;
+  }
+  for (i = 0; i < num_only; i++) {
+    if (!strncmp(name, only[i], strlen(only[i]))) {
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+/* Runs one benchmark into r.  Returns nonzero if its samples didn't *
+ * all end up in the same state.                                     */
+static uint32_t run_benchmark(const bench_t *b, dungeon *d, uint32_t seed,
+                              double *s, uint32_t samples, bench_result_t *r)
+{
+  uint32_t j, check, failed;
+
+  strcpy(r->name, b->name);
+  r->iterations = b->iterations;
+  r->has_check = b->finish != NULL;
+  r->check = 0;
+  failed = 0;
+
+  srand(seed);
+  if (b->setup) {
+    b->setup(d);
+  }
+  for (j = 0; j <= samples; j++) {
+    /* Bodies that use rand() do the same work in every sample */
+    srand(seed);
+    if (b->prepare) {
+      b->prepare(d);
+    }
+    /* The first one is to warm up */
+    s[j ? j - 1 : 0] = sample(b, d);
+    if (b->finish) {
+      check = b->finish(d);
+      if (j && check != r->check) {
+        fprintf(stderr, "%s isn't deterministic: sample %u ended in "
+                "state %08x, not %08x.\n", r->name, j, check, r->check);
+        failed = 1;
+      }
+      r->check = check;
+    }
+  }
+  if (b->teardown) {
+    b->teardown(d);
+  }
+
+  summarize(s, samples, &r->stats);
+
+  return failed;
+}
+
+/* Reads back the results from an earlier run's output.  Returns the *
+ * number read, or -1 if the file couldn't be opened.                */
+static int32_t read_results(const char *file, bench_result_t *r)
+{
+  FILE *f;
+  char line[512];
+  char check[16];
+  const char *p;
+  int32_t n;
+
+  if (!(f = fopen(file, "r"))) {
+    perror(file);
+    return -1;
+  }
+
+  for (n = 0; n < BENCH_MAX_RESULTS && fgets(line, sizeof (line), f);) {
+    if (sscanf(line, " { \"name\": \"%63[^\"]\", \"iterations\": %u, "
+               "\"median\": %lf, \"p99\": %lf, \"mad\": %lf, "
+               "\"min\": %lf, \"mean\": %lf",
+               r[n].name, &r[n].iterations, &r[n].stats.median,
+               &r[n].stats.p99, &r[n].stats.mad, &r[n].stats.min,
+               &r[n].stats.mean) != 7) {
+      continue;
+    }
+    r[n].has_check = ((p = strstr(line, "\"check\": \"")) &&
+                      sscanf(p, "\"check\": \"%15[^\"]", check) == 1);
+    r[n].check = r[n].has_check ? strtoul(check, NULL, 16) : 0;
+    n++;
+  }
+
+  fclose(f);
+
+  return n;
+}
+
+typedef enum bench_verdict {
+  bench_same,
+  bench_faster,
+  bench_slower,
+  bench_changed
+} bench_verdict_t;
+
+static const char *verdict_name[] = {
+  "same",
+  "faster",
+  "SLOWER",
+  "CHANGED BEHAVIOR"
+};
+
+static const bench_result_t *find_result(const char *name,
+                                         const bench_result_t *r, uint32_t n)
+{
+  uint32_t i;
+
+  for (i = 0; i < n; i++) {
+    if (!strcmp(r[i].name, name)) {
+      return r + i;
+    }
+  }
+
+  return NULL;
+}
+
+static bench_verdict_t verdict(const bench_result_t *base,
+                               const bench_result_t *cur)
+{
+  double change, noise;
+
+  if (cur->has_check != base->has_check || cur->check != base->check) {
+    return bench_changed;
+  }
+
+  change = cur->stats.median - base->stats.median;
+  noise = BENCH_NOISE_MADS * (base->stats.mad + cur->stats.mad);
+  if (noise < base->stats.median * BENCH_NOISE_PERCENT / 100) {
+    noise = base->stats.median * BENCH_NOISE_PERCENT / 100;
+  }
+
+  if (change > noise) {
+    return bench_slower;
+  } else if (change < -noise) {
+    return bench_faster;
+  }
+
+  return bench_same;
+}
+
+/* Prints a table of differences to stderr.  Returns nonzero if    *
+ * anything regressed, changed behavior or has nothing to compare  *
+ * against.                                                        */
+static uint32_t compare_results(const bench_result_t *base, uint32_t num_base,
+                                const bench_result_t *cur, uint32_t num_cur)
+{
+  uint32_t i, failed;
+  const bench_result_t *b;
+  bench_verdict_t v;
+
+  fprintf(stderr, "%-28s %12s %12s %8s  %s\n",
+          "benchmark", "baseline ns", "current ns", "change", "verdict");
+
+  for (failed = i = 0; i < num_cur; i++) {
+    if (!(b = find_result(cur[i].name, base, num_base))) {
+      fprintf(stderr, "%-28s %12s %12.1f %8s  NOT IN BASELINE\n",
+              cur[i].name, "-", cur[i].stats.median, "");
+      failed = 1;
+      continue;
+    }
+
+    if ((v = verdict(b, cur + i)) == bench_slower || v == bench_changed) {
+      failed = 1;
+    }
+    fprintf(stderr, "%-28s %12.1f %12.1f %+7.1f%%  %s\n",
+            cur[i].name, b->stats.median, cur[i].stats.median,
+            100 * (cur[i].stats.median - b->stats.median) / b->stats.median,
+            verdict_name[v]);
+  }
+
+  return failed;
+}
+
+void usage(char *name)
+{
+  fprintf(stderr,
+          "Usage: %s [-r|--rand <seed>] [-s|--samples <count>]\n"
+          "          [-d|--data <directory>] [-c|--compare <baseline>]\n"
+          "          [<benchmark prefix>...]\n",
+          name);
+
+  exit(-1);
+}
+
+int main(int argc, char *argv[])
+{
+  dungeon d;
+  uint32_t seed, samples, num_only, b, retry, failed;
+  int32_t i, num_base;
+  uint32_t num_results;
+  uint32_t long_arg;
+  char **only;
+  char *compare;
+  double *s;
+  bench_result_t results[BENCH_MAX_RESULTS], base[BENCH_MAX_RESULTS];
+  bench_result_t again;
+  const bench_result_t *r;
+  char save[32];
+
+  seed = BENCH_DEFAULT_SEED;
+  samples = BENCH_DEFAULT_SAMPLES;
+  only = (char **) malloc(argc * sizeof (*only));
+  num_only = 0;
+  compare = NULL;
+  num_base = 0;
+  failed = 0;
+
+  for (i = 1, long_arg = 0; i < argc; i++, long_arg = 0) {
+    if (argv[i][0] == '-') {
+      if (argv[i][1] == '-') {
+        argv[i]++;
+        long_arg = 1;
+      }
+      switch (argv[i][1]) {
+      case 'r':
+        if ((!long_arg && argv[i][2]) ||
+            (long_arg && strcmp(argv[i], "-rand")) ||
+            argc < ++i + 1 /* No more arguments */ ||
+            !sscanf(argv[i], "%u", &seed)) {
+          usage(argv[0]);
+        }
+        break;
+      case 's':
+        if ((!long_arg && argv[i][2]) ||
+            (long_arg && strcmp(argv[i], "-samples")) ||
+            argc < ++i + 1 /* No more arguments */ ||
+            !sscanf(argv[i], "%u", &samples) || !samples) {
+          usage(argv[0]);
+        }
+        break;
+      case 'd':
+        if ((!long_arg && argv[i][2]) ||
+            (long_arg && strcmp(argv[i], "-data")) ||
+            argc < ++i + 1 /* No more arguments */) {
+          usage(argv[0]);
+        }
+        bench_dir = argv[i];
+        break;
+      case 'c':
+        if ((!long_arg && argv[i][2]) ||
+            (long_arg && strcmp(argv[i], "-compare")) ||
+            argc < ++i + 1 /* No more arguments */) {
+          usage(argv[0]);
+        }
+        compare = argv[i];
+        break;
+      default:
+        usage(argv[0]);
+      }
+    } else {
+      only[num_only++] = argv[i];
+    }
+  }
+
+  if (compare && (num_base = read_results(compare, base)) < 0) {
+    return 1;
+  }
+
+  snprintf(save, sizeof (save), "/tmp/rlg327-bench.%d", (int) getpid());
+  bench_save = save;
+  s = (double *) malloc(samples * sizeof (*s));
+  parse_description_files(&d, bench_file(MONSTER_DESC_FILE).c_str(),
+                          bench_file(OBJECT_DESC_FILE).c_str());
+  d.max_objects = MAX_OBJECTS;
+
+  for (num_results = b = 0; b < NUM_BENCHMARKS; b++) {
+    if (!selected(benchmarks[b].name, only, num_only)) {
+      continue;
+    }
+    failed |= run_benchmark(benchmarks + b, &d, seed, s, samples,
+                            results + num_results);
+
+    /* A busy machine can slow down a whole run of samples, which the *
+     * MAD won't show.  Before calling it a regression, measure again, *
+     * and keep the best of the runs.                                  */
+    for (retry = 0;
+         (compare && retry < BENCH_RETRIES &&
+          (r = find_result(benchmarks[b].name, base, num_base)) &&
+          verdict(r, results + num_results) == bench_slower);
+         retry++) {
+      failed |= run_benchmark(benchmarks + b, &d, seed, s, samples, &again);
+      if (again.stats.median < results[num_results].stats.median) {
+        results[num_results] = again;
+      }
+    }
+    if (benchmarks[b].same_as &&
+        (r = find_result(benchmarks[b].same_as, results, num_results)) &&
+        r->check != results[num_results].check) {
+      fprintf(stderr, "%s ended in state %08x, not %08x like %s.\n",
+              benchmarks[b].name, results[num_results].check, r->check,
+              r->name);
+      failed = 1;
+    }
+    if (benchmarks[b].differs_from &&
+        (r = find_result(benchmarks[b].differs_from,
+                         results, num_results)) &&
+        r->check == results[num_results].check) {
+      fprintf(stderr, "%s ended in the same state as %s, %08x.\n",
+              benchmarks[b].name, r->name, r->check);
+      failed = 1;
+    }
+    num_results++;
+  }
+
+  printf("{\n  \"seed\": %u,\n  \"samples\": %u,\n  \"unit\": \"ns\",\n"
+         "  \"results\": [", seed, samples);
+  for (b = 0; b < num_results; b++) {
+    printf("%s\n    { \"name\": \"%s\", \"iterations\": %u, "
+           "\"median\": %.1f, \"p99\": %.1f, \"mad\": %.1f, "
+           "\"min\": %.1f, \"mean\": %.1f",
+           b ? "," : "", results[b].name, results[b].iterations,
+           results[b].stats.median, results[b].stats.p99,
+           results[b].stats.mad, results[b].stats.min,
+           results[b].stats.mean);
+    if (results[b].has_check) {
+      printf(", \"check\": \"%08x\"", results[b].check);
+    }
+    printf(" }");
+  }
+  printf("\n  ]\n}\n");
+
+  if (compare) {
+    failed |= compare_results(base, num_base, results, num_results);
+  }
+
+  free(s);
+  free(only);
+  destroy_descriptions(&d);
+
+  return failed;
+}
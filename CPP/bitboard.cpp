@@ -0,0 +1,304 @@
+#include <string.h>
+#include <vector>
+#include <algorithm>
+
+#include "bitboard.h"
+#include "dungeon.h"
+
+static uint32_t bitboard_change_count;
+static uint32_t bitboard_rebuild_count;
+
+void bitboard_rebuild(dungeon *d)
+{
+  int32_t x, y;
+
+  bitboard_change_count++;
+  bitboard_rebuild_count++;
+  d->passable.fill(0);
+
+  for (y = 0; y < DUNGEON_Y; y++) {
+    for (x = 0; x < DUNGEON_X; x++) {
+      if (mapxy(x, y) >= ter_floor) {
+        d->passable[y][x >> 6] |= 1ULL << (x & 63);
+      }
+    }
+  }
+}
+
+void bitboard_update(dungeon *d, pair_t p)
+{
+  bitboard_change_count++;
+  if (mappair(p) >= ter_floor) {
+    d->passable[p[dim_y]][p[dim_x] >> 6] |= 1ULL << (p[dim_x] & 63);
+  } else {
+    d->passable[p[dim_y]][p[dim_x] >> 6] &= ~(1ULL << (p[dim_x] & 63));
+  }
+}
+
+uint32_t bitboard_changes(void)
+{
+  return bitboard_change_count;
+}
+
+uint32_t bitboard_rebuilds(void)
+{
+  return bitboard_rebuild_count;
+}
+
+/* Three bits of a row starting at column x, which may straddle a word. */
+static inline uint32_t row_bits3(const uint64_t *row, int16_t x)
+{
+  uint64_t v;
+  uint32_t off;
+
+  off = x & 63;
+  v = row[x >> 6] >> off;
+  if (off > 61 && (x >> 6) + 1 < BITBOARD_WORDS) {
+    v |= row[(x >> 6) + 1] << (64 - off);
+  }
+
+  return v & 7;
+}
+
+/* Returns the 3x3 block around (x, y) as a nine bit mask; see          *
+ * window_bit().  The cell must not be on the edge of the map, which is *
+ * never a problem for characters, since the edges are immutable rock.  */
+uint32_t bitboard_window(const bitboard_t &b, int16_t x, int16_t y)
+{
+  return (row_bits3(b[y - 1], x - 1)        |
+          (row_bits3(b[y    ], x - 1) << 3) |
+          (row_bits3(b[y + 1], x - 1) << 6));
+}
+
+/* True if every cell in row y from x0 to x1, inclusive, is set. */
+uint32_t bitboard_run_clear(const bitboard_t &b, int16_t y,
+                            int16_t x0, int16_t x1)
+{
+  int16_t w;
+  uint64_t mask;
+
+  for (w = x0 >> 6; w <= x1 >> 6; w++) {
+    mask = ~0ULL;
+    if (w == x0 >> 6) {
+      mask &= ~0ULL << (x0 & 63);
+    }
+    if (w == x1 >> 6 && (x1 & 63) != 63) {
+      mask &= (1ULL << ((x1 & 63) + 1)) - 1;
+    }
+    if ((b[y][w] & mask) != mask) {
+      return 0;
+    }
+  }
+
+  return 1;
+}
+
+/* Kogge-Stone occluded fills: spread the seed bits g along the runs of *
+ * set bits in p, toward the most (up) or least (down) significant bit. */
+static inline uint64_t fill_up(uint64_t g, uint64_t p)
+{
+  g |= p & (g << 1);
+  p &= p << 1;
+  g |= p & (g << 2);
+  p &= p << 2;
+  g |= p & (g << 4);
+  p &= p << 4;
+  g |= p & (g << 8);
+  p &= p << 8;
+  g |= p & (g << 16);
+  p &= p << 16;
+  return g | (p & (g << 32));
+}
+
+static inline uint64_t fill_down(uint64_t g, uint64_t p)
+{
+  g |= p & (g >> 1);
+  p &= p >> 1;
+  g |= p & (g >> 2);
+  p &= p >> 2;
+  g |= p & (g >> 4);
+  p &= p >> 4;
+  g |= p & (g >> 8);
+  p &= p >> 8;
+  g |= p & (g >> 16);
+  p &= p >> 16;
+  return g | (p & (g >> 32));
+}
+
+/* Fills seed along its runs in mask, across word boundaries. */
+static void fill_row(uint64_t *seed, const uint64_t *mask)
+{
+  int32_t w;
+
+  for (w = 0; w < BITBOARD_WORDS; w++) {
+    if (w && (seed[w - 1] >> 63)) {
+      seed[w] |= mask[w] & 1;
+    }
+    seed[w] = fill_up(seed[w] & mask[w], mask[w]);
+  }
+  for (w = BITBOARD_WORDS - 1; w >= 0; w--) {
+    if (w < BITBOARD_WORDS - 1 && (seed[w + 1] & 1)) {
+      seed[w] |= mask[w] & (1ULL << 63);
+    }
+    seed[w] = fill_down(seed[w], mask[w]);
+  }
+}
+
+/* The row grown by one cell to the left and right. */
+static inline void spread_row(const uint64_t *row, uint64_t *out)
+{
+  int32_t w;
+
+  for (w = 0; w < BITBOARD_WORDS; w++) {
+    out[w] |= row[w] | (row[w] << 1) | (row[w] >> 1);
+    if (w) {
+      out[w] |= row[w - 1] >> 63;
+    }
+    if (w < BITBOARD_WORDS - 1) {
+      out[w] |= row[w + 1] << 63;
+    }
+  }
+}
+
+/* Recomputes row y of reached from its vertical (and diagonal) neighbours. *
+ * Returns nonzero if anything new was reached.  seed is BITBOARD_WORDS of *
+ * scratch space.                                                          */
+static uint32_t flood_row(const bitboard_t &b, bitboard_t &reached, int16_t y,
+                          uint64_t *seed)
+{
+  uint32_t changed;
+  int32_t w;
+
+  memcpy(seed, reached[y], BITBOARD_WORDS * sizeof (*seed));
+  if (y) {
+    spread_row(reached[y - 1], seed);
+  }
+  if (y < DUNGEON_Y - 1) {
+    spread_row(reached[y + 1], seed);
+  }
+  for (w = 0; w < BITBOARD_WORDS; w++) {
+    seed[w] &= b[y][w];
+  }
+  fill_row(seed, b[y]);
+
+  for (changed = 0, w = 0; w < BITBOARD_WORDS; w++) {
+    changed |= seed[w] != reached[y][w];
+    reached[y][w] = seed[w];
+  }
+
+  return changed;
+}
+
+/* Eight-way flood fill of b starting from from.  Each row is filled    *
+ * horizontally in a few word operations, then we sweep down and back   *
+ * up the map until nothing changes, which takes one pass per reversal  *
+ * of vertical direction along the longest path, not one per cell.      */
+void bitboard_flood(const bitboard_t &b, pair_t from, bitboard_t &reached)
+{
+  std::vector<uint64_t> seed(BITBOARD_WORDS);
+  uint32_t changed;
+  int16_t y;
+
+  reached.resize(BITBOARD_WORDS, DUNGEON_Y);
+  reached.fill(0);
+  reached[from[dim_y]][from[dim_x] >> 6] = 1ULL << (from[dim_x] & 63);
+
+  do {
+    changed = 0;
+    for (y = from[dim_y]; y < DUNGEON_Y; y++) {
+      changed |= flood_row(b, reached, y, seed.data());
+    }
+    for (y = DUNGEON_Y - 1; y >= 0; y--) {
+      changed |= flood_row(b, reached, y, seed.data());
+    }
+  } while (changed);
+}
+
+/* Eight-way distances over b from from, exactly what a Dijkstra search *
+ * at one a step would give.  Breadth first, a whole ring at a time:    *
+ * the cells one step further out are the last ring grown by a cell     *
+ * every way, less anything already reached or not in b, which is a     *
+ * few word operations a row, and only the rows the ring is on.         */
+void bitboard_distance(const bitboard_t &b, pair_t from,
+                       grid<uint16_t> &distance)
+{
+  /* Scratch, one per thread, since --threads builds walking flow *
+   * fields with this on several at once.                          */
+  static thread_local bitboard_t reached, rings[2];
+  /* Whether each row of each ring has anything on it */
+  static thread_local std::vector<uint8_t> live[2];
+  static thread_local std::vector<uint64_t> grown;
+  uint32_t ring;
+  int32_t y, w, lo, hi, next_lo, next_hi, step;
+  uint64_t bits, any, *out, *seen;
+  const uint8_t *on;
+  uint16_t steps;
+
+  distance.resize(DUNGEON_X, DUNGEON_Y);
+  distance.fill(DISTANCE_UNREACHABLE);
+  distance[from[dim_y]][from[dim_x]] = 0;
+  /* Nothing gets anywhere from inside the rock, not even next door */
+  if (!((b[from[dim_y]][from[dim_x] >> 6] >> (from[dim_x] & 63)) & 1)) {
+    return;
+  }
+
+  reached.resize(BITBOARD_WORDS, DUNGEON_Y);
+  reached.fill(0);
+  rings[0].resize(BITBOARD_WORDS, DUNGEON_Y);
+  rings[1].resize(BITBOARD_WORDS, DUNGEON_Y);
+  live[0].assign(DUNGEON_Y, 0);
+  live[1].assign(DUNGEON_Y, 0);
+  grown.resize(BITBOARD_WORDS);
+
+  /* Rows of a ring are only read where live says there's something   *
+   * there, so that's all that needs setting.  Flags are only ever    *
+   * set between the ring's lo and hi.                                */
+  ring = 0;
+  memset(rings[ring][from[dim_y]], 0, BITBOARD_WORDS * sizeof (uint64_t));
+  rings[ring][from[dim_y]][from[dim_x] >> 6] = 1ULL << (from[dim_x] & 63);
+  reached[from[dim_y]][from[dim_x] >> 6] = 1ULL << (from[dim_x] & 63);
+  live[ring][from[dim_y]] = 1;
+  lo = hi = from[dim_y];
+
+  for (step = 1; lo <= hi; step++, ring ^= 1) {
+    /* Too far to count sticks at DISTANCE_MAX, as it does in dijkstra() */
+    steps = std::min(step, DISTANCE_MAX);
+    on = live[ring].data();
+    next_lo = DUNGEON_Y;
+    next_hi = -1;
+    for (y = std::max(lo - 1, 0); y <= std::min(hi + 1, DUNGEON_Y - 1); y++) {
+      if (!((y && on[y - 1]) || on[y] || (y < DUNGEON_Y - 1 && on[y + 1]))) {
+        continue;
+      }
+      std::fill(grown.begin(), grown.end(), 0);
+      if (y && on[y - 1]) {
+        spread_row(rings[ring][y - 1], grown.data());
+      }
+      if (on[y]) {
+        spread_row(rings[ring][y], grown.data());
+      }
+      if (y < DUNGEON_Y - 1 && on[y + 1]) {
+        spread_row(rings[ring][y + 1], grown.data());
+      }
+      out = rings[ring ^ 1][y];
+      seen = reached[y];
+      for (any = 0, w = 0; w < BITBOARD_WORDS; w++) {
+        out[w] = grown[w] & b[y][w] & ~seen[w];
+        seen[w] |= out[w];
+        any |= out[w];
+        for (bits = out[w]; bits; bits &= bits - 1) {
+          distance[y][(w << 6) + __builtin_ctzll(bits)] = steps;
+        }
+      }
+      if (any) {
+        live[ring ^ 1][y] = 1;
+        next_lo = std::min(next_lo, y);
+        next_hi = y;
+      }
+    }
+    /* Leaves every flag clear for the ring after next */
+    std::fill(live[ring].begin() + lo, live[ring].begin() + hi + 1, 0);
+    lo = next_lo;
+    hi = next_hi;
+  }
+}
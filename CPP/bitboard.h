@@ -0,0 +1,41 @@
+#ifndef BITBOARD_H
+# define BITBOARD_H
+
+# include <stdint.h>
+
+# include "dims.h"
+# include "dungeon.h"
+
+/* A bitboard is one bit per map cell, stored a row at a time in 64-bit  *
+ * words, least significant bit first.  The dungeon keeps one of these,  *
+ * d->passable, with a bit set for every cell where mapxy() >= ter_floor *
+ * so that the hot paths can test whole runs of cells with a handful of  *
+ * word operations instead of branching on the map one cell at a time.  */
+
+typedef grid<uint64_t> bitboard_t;
+
+/* Bit positions in the mask returned by bitboard_window().  The window *
+ * is the 3x3 block around a cell, numbered in row-major order, so the  *
+ * bit for offset (dx, dy) is ((dy + 1) * 3 + (dx + 1)).                */
+# define window_bit(dx, dy) (1U << (((dy) + 1) * 3 + ((dx) + 1)))
+
+void bitboard_rebuild(dungeon *d);
+void bitboard_update(dungeon *d, pair_t p);
+/* Goes up every time either of the above is called, so anything worked *
+ * out from a bitboard can tell whether it might be out of date.        */
+uint32_t bitboard_changes(void);
+/* Only goes up with bitboard_rebuild(), so whenever the whole map may *
+ * have been replaced.                                                 */
+uint32_t bitboard_rebuilds(void);
+uint32_t bitboard_window(const bitboard_t &b, int16_t x, int16_t y);
+uint32_t bitboard_run_clear(const bitboard_t &b, int16_t y,
+                            int16_t x0, int16_t x1);
+/* Sizes reached to match the dungeon. */
+void bitboard_flood(const bitboard_t &b, pair_t from, bitboard_t &reached);
+/* Steps from from to every cell of b it can get to, eight ways, the   *
+ * same as dijkstra() but with no queue.  Sizes distance to match the  *
+ * dungeon.                                                            */
+void bitboard_distance(const bitboard_t &b, pair_t from,
+                       grid<uint16_t> &distance);
+
+#endif
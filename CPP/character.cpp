@@ -5,6 +5,8 @@
 #include "npc.h"
 #include "pc.h"
 #include "dungeon.h"
+#include "bitboard.h"
+#include "profile.h"
 
 void character_delete(character *c)
 {
@@ -81,9 +83,22 @@ const char *character_get_name(const character *c)
   return c->name;
 }
 
+/* True if the run of len cells in row start[dim_y], beginning at *
+ * start[dim_x] and stepping dir (+/-1), is all passable.          */
+static inline uint32_t run_is_clear(dungeon *d, pair_t start,
+                                    int16_t len, int16_t dir)
+{
+  return (dir > 0                                                          ?
+          bitboard_run_clear(d->passable, start[dim_y],
+                             start[dim_x], start[dim_x] + len - 1)         :
+          bitboard_run_clear(d->passable, start[dim_y],
+                             start[dim_x] - len + 1, start[dim_x]));
+}
+
 uint32_t can_see(dungeon *d, pair_t voyeur, pair_t exhibitionist,
                  int is_pc, int learn)
 {
+  PROFILE_HOT_SCOPE("can_see");
   /* Application of Bresenham's Line Drawing Algorithm.  If we can draw *
    * a line from v to e without intersecting any walls, then v can see  *
    * e.  Unfortunately, Bresenham isn't symmetric, so line-of-sight     *
@@ -93,8 +108,8 @@ uint32_t can_see(dungeon *d, pair_t voyeur, pair_t exhibitionist,
    * more expensive.                                                    */
 
   pair_t first, second;
-  pair_t del, f;
-  int16_t a, b, c, i;
+  pair_t del, f, run_start;
+  int16_t a, b, c, i, run;
   int16_t visual_range;
 
   visual_range = is_pc ? PC_VISUAL_RANGE : NPC_VISUAL_RANGE;
@@ -136,13 +151,27 @@ uint32_t can_see(dungeon *d, pair_t voyeur, pair_t exhibitionist,
     a = del[dim_y] + del[dim_y];
     c = a - del[dim_x];
     b = c - del[dim_x];
-    for (i = 0; i <= del[dim_x]; i++) {
+    for (run = 0, i = 0; i <= del[dim_x]; i++) {
       if (learn) {
         pc_learn_terrain(d->PC, first, mappair(first));
         pc_see_object(d->PC, objpair(first));
-      }
-      if ((mappair(first) < ter_floor) && i && (i != del[dim_x])) {
-        return 0;
+        if (!passablepair(first) && i && (i != del[dim_x])) {
+          return 0;
+        }
+      } else if (i && (i != del[dim_x])) {
+        /* Without learning, all we need to know is whether the interior *
+         * of the line is clear, and an x-major line crosses each row in *
+         * a horizontal run, so test a whole run at once.                */
+        if (run && first[dim_y] != run_start[dim_y]) {
+          if (!run_is_clear(d, run_start, run, f[dim_x])) {
+            return 0;
+          }
+          run = 0;
+        }
+        if (!run++) {
+          run_start[dim_x] = first[dim_x];
+          run_start[dim_y] = first[dim_y];
+        }
       }
       /*      mappair(first) = ter_debug;*/
       first[dim_x] += f[dim_x];
@@ -153,7 +182,7 @@ uint32_t can_see(dungeon *d, pair_t voyeur, pair_t exhibitionist,
         first[dim_y] += f[dim_y];
       }
     }
-    return 1;
+    return !run || run_is_clear(d, run_start, run, f[dim_x]);
   } else {
     a = del[dim_x] + del[dim_x];
     c = a - del[dim_y];
@@ -163,7 +192,7 @@ uint32_t can_see(dungeon *d, pair_t voyeur, pair_t exhibitionist,
         pc_learn_terrain(d->PC, first, mappair(first));
         pc_see_object(d->PC, objpair(first));
       }
-      if ((mappair(first) < ter_floor) && i && (i != del[dim_y])) {
+      if (!passablepair(first) && i && (i != del[dim_y])) {
         return 0;
       }
       /*      mappair(first) = ter_debug;*/
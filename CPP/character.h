@@ -36,7 +36,12 @@ class character {
    * characters have been created by the game.                              */
   uint32_t sequence_number;
   uint32_t kills[num_kill_types];
-  inline uint32_t get_color() { return color[rand_range(0, color.size() - 1)]; }
+  /* Characters with more than one color cycle through them as the screen *
+   * is redrawn; frame is the display's redraw count.                      */
+  inline uint32_t get_color(uint32_t frame)
+  {
+    return color[frame % color.size()];
+  }
   inline char get_symbol() { return symbol; }
 };
 
@@ -16,6 +16,7 @@
 #include "character.h"
 #include "utils.h"
 #include "event.h"
+#include "profile.h"
 
 #define MONSTER_FILE_SEMANTIC          "RLG327 MONSTER DESCRIPTION"
 #define MONSTER_FILE_VERSION           1U
@@ -850,21 +851,16 @@ static uint32_t parse_object_descriptions(std::ifstream &f,
   return 0;
 }
 
-uint32_t parse_descriptions(dungeon_t *d)
+uint32_t parse_description_files(dungeon_t *d, const char *monster_file,
+                                 const char *object_file)
 {
-  std::string file;
+  PROFILE_SCOPE("parse_descriptions");
   std::ifstream f;
   uint32_t retval;
 
   retval = 0;
 
-  file = getenv("HOME");
-  if (file.length() == 0) {
-    file = ".";
-  }
-  file += std::string("/") + SAVE_DIR + "/" + MONSTER_DESC_FILE;
-
-  f.open(file.c_str());
+  f.open(monster_file);
 
   if (parse_monster_descriptions(f, d, &d->monster_descriptions)) {
     retval = 1;
@@ -872,13 +868,7 @@ uint32_t parse_descriptions(dungeon_t *d)
 
   f.close();
 
-  file = getenv("HOME");
-  if (file.length() == 0) {
-    file = ".";
-  }
-  file += std::string("/") + SAVE_DIR + "/" + OBJECT_DESC_FILE;
-
-  f.open(file.c_str());
+  f.open(object_file);
 
   if (parse_object_descriptions(f, d, &d->object_descriptions)) {
     retval = 1;
@@ -889,6 +879,20 @@ uint32_t parse_descriptions(dungeon_t *d)
   return retval;
 }
 
+uint32_t parse_descriptions(dungeon_t *d)
+{
+  std::string dir;
+
+  dir = getenv("HOME");
+  if (dir.length() == 0) {
+    dir = ".";
+  }
+  dir += std::string("/") + SAVE_DIR + "/";
+
+  return parse_description_files(d, (dir + MONSTER_DESC_FILE).c_str(),
+                                 (dir + OBJECT_DESC_FILE).c_str());
+}
+
 uint32_t print_descriptions(dungeon_t *d)
 {
   std::vector<monster_description> &m = d->monster_descriptions;
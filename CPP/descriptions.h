@@ -11,6 +11,9 @@
 typedef struct dungeon dungeon_t;
 
 uint32_t parse_descriptions(dungeon_t *d);
+/* The same, but from the given files rather than ~/.rlg327 */
+uint32_t parse_description_files(dungeon_t *d, const char *monster_file,
+                                 const char *object_file);
 uint32_t print_descriptions(dungeon_t *d);
 uint32_t destroy_descriptions(dungeon_t *d);
 
@@ -0,0 +1,264 @@
+#ifndef DIJKSTRA_H
+# define DIJKSTRA_H
+
+# include <stddef.h>
+# include <stdint.h>
+
+# include "dims.h"
+# include "grid.h"
+# include "heap.h"
+# include "dungeon.h"
+
+/* The one Dijkstra that every weighted distance map and corridor is     *
+ * made with (pc_distance, where every step costs one, doesn't need one; *
+ * see bitboard_distance()).  dijkstra_search() is put together at       *
+ * compile time from policies:                                           *
+ *                                                                       *
+ *   Neighbours  dijkstra_4way or dijkstra_8way: which cells are next to *
+ *               which, and the order they're looked at in.              *
+ *   Queue       the priority queue; dijkstra_heap is the Fibonacci heap *
+ *               from heap.c.                                            *
+ *   Open        open.each(lo, hi, v): calls v(x, y) for every cell in   *
+ *               the box that goes in the queue at all, row by row.      *
+ *   Cost        cost(x, y, distance): the distance to anything next to  *
+ *               (x, y), given its own, and unreached(), the distance of *
+ *               cells it never gets to.  Every cost we have is paid on  *
+ *               the way out of a cell, so it's worked out once a pop.   *
+ *   Output      dijkstra_distance, or dijkstra_predecessor to also      *
+ *               remember where each cell was reached from.              *
+ *                                                                       *
+ * Every policy is inlined, even in an unoptimized build, so each search *
+ * compiles down to the loop that used to be written out by hand for it. *
+ * Cells go in the queue in row order and neighbours are looked at in a  *
+ * fixed order, just as they were, so wherever two ways are as short as  *
+ * each other, the same one wins; seeds still make the same corridors.   *
+ * Anything that makes every search faster belongs in here.              */
+
+# define DIJKSTRA_INLINE inline __attribute__ ((always_inline))
+
+typedef struct dijkstra_cell {
+  heap_node_t *hn;
+  int16_t pos[2];
+} dijkstra_cell_t;
+
+/* Sizes cells for the current dungeon and fills in the positions, if *
+ * that hasn't been done already.                                     */
+static inline void dijkstra_cells_init(grid<dijkstra_cell_t> &cells)
+{
+  int32_t x, y;
+
+  if (cells.width() == DUNGEON_X && cells.height() == DUNGEON_Y) {
+    return;
+  }
+
+  cells.resize(DUNGEON_X, DUNGEON_Y);
+  for (y = 0; y < DUNGEON_Y; y++) {
+    for (x = 0; x < DUNGEON_X; x++) {
+      cells[y][x].pos[dim_y] = y;
+      cells[y][x].pos[dim_x] = x;
+    }
+  }
+}
+
+/* Neighbour sets hand each() every offset in turn, written out so *
+ * nothing needs working out at run time.                          */
+
+/* Up, left, right, down */
+struct dijkstra_4way {
+  template <typename Visit>
+  static DIJKSTRA_INLINE void each(Visit &v)
+  {
+    v( 0, -1);
+    v(-1,  0);
+    v( 1,  0);
+    v( 0,  1);
+  }
+};
+
+/* Row by row, top left to bottom right */
+struct dijkstra_8way {
+  template <typename Visit>
+  static DIJKSTRA_INLINE void each(Visit &v)
+  {
+    v(-1, -1);
+    v( 0, -1);
+    v( 1, -1);
+    v(-1,  0);
+    v( 1,  0);
+    v(-1,  1);
+    v( 0,  1);
+    v( 1,  1);
+  }
+};
+
+/* heap.c's comparitor can't be told which distances it's comparing, so *
+ * the queue keeps them in a static for it, set as each search starts.  *
+ * Searches never run inside each other, so one per thread is enough;   *
+ * --threads builds flow fields on several at once.                     */
+template <typename Key>
+class dijkstra_heap {
+ private:
+  heap_t h;
+  static thread_local const grid<Key> *keys;
+  static int32_t compare(const void *key, const void *with)
+  {
+    return ((int32_t) (*keys)[((dijkstra_cell_t *) key)->pos[dim_y]]
+                             [((dijkstra_cell_t *) key)->pos[dim_x]] -
+            (int32_t) (*keys)[((dijkstra_cell_t *) with)->pos[dim_y]]
+                             [((dijkstra_cell_t *) with)->pos[dim_x]]);
+  }
+  dijkstra_heap(const dijkstra_heap &);
+  dijkstra_heap &operator=(const dijkstra_heap &);
+ public:
+  dijkstra_heap(const grid<Key> &distance)
+  {
+    keys = &distance;
+    heap_init(&h, compare, NULL);
+  }
+  ~dijkstra_heap()
+  {
+    heap_delete(&h);
+  }
+  DIJKSTRA_INLINE void push(dijkstra_cell_t *c)
+  {
+    c->hn = heap_insert(&h, c);
+  }
+  DIJKSTRA_INLINE dijkstra_cell_t *pop()
+  {
+    return (dijkstra_cell_t *) heap_remove_min(&h);
+  }
+  DIJKSTRA_INLINE void decrease(dijkstra_cell_t *c)
+  {
+    heap_decrease_key_no_replace(&h, c->hn);
+  }
+};
+
+template <typename Key>
+thread_local const grid<Key> *dijkstra_heap<Key>::keys;
+
+/* Distances only */
+struct dijkstra_distance {
+  DIJKSTRA_INLINE void reached(dijkstra_cell_t *c, dijkstra_cell_t *from)
+  {
+  }
+};
+
+/* And the cell each one was last reached from, to follow back from the *
+ * target to the source.                                                */
+struct dijkstra_predecessor {
+  grid<dijkstra_cell_t *> &from;
+  dijkstra_predecessor(grid<dijkstra_cell_t *> &f) : from(f) {}
+  DIJKSTRA_INLINE void reached(dijkstra_cell_t *c, dijkstra_cell_t *f)
+  {
+    from[c->pos[dim_y]][c->pos[dim_x]] = f;
+  }
+};
+
+/* What dijkstra_search() hands the open cells: puts each in the queue */
+template <typename Queue>
+struct dijkstra_push {
+  grid<dijkstra_cell_t> &cells;
+  Queue &q;
+  dijkstra_push(grid<dijkstra_cell_t> &cl, Queue &queue) :
+    cells(cl), q(queue) {}
+  DIJKSTRA_INLINE void operator()(int32_t x, int32_t y)
+  {
+    q.push(&cells[y][x]);
+  }
+};
+
+/* What dijkstra_search() hands the neighbour set: offers each *
+ * neighbour of c a distance of next.                          */
+template <typename Key, typename Queue, typename Output>
+struct dijkstra_relax {
+  grid<dijkstra_cell_t> &cells;
+  grid<Key> &distance;
+  Queue &q;
+  Output &output;
+  dijkstra_cell_t *c;
+  Key next;
+  dijkstra_relax(grid<dijkstra_cell_t> &cl, grid<Key> &dist, Queue &queue,
+                 Output &out) :
+    cells(cl), distance(dist), q(queue), output(out) {}
+  DIJKSTRA_INLINE void operator()(int32_t dx, int32_t dy)
+  {
+    dijkstra_cell_t *n = &cells[c->pos[dim_y] + dy][c->pos[dim_x] + dx];
+
+    if (n->hn && distance[n->pos[dim_y]][n->pos[dim_x]] > next) {
+      distance[n->pos[dim_y]][n->pos[dim_x]] = next;
+      output.reached(n, c);
+      q.decrease(n);
+    }
+  }
+};
+
+/* Whatever a search leaves in the queue goes with it, so takes it back *
+ * out of the cells.                                                    */
+static inline void dijkstra_unqueue(grid<dijkstra_cell_t> &cells,
+                                    const pair_t lo, const pair_t hi)
+{
+  int32_t x, y;
+
+  for (y = lo[dim_y]; y <= hi[dim_y]; y++) {
+    for (x = lo[dim_x]; x <= hi[dim_x]; x++) {
+      cells[y][x].hn = NULL;
+    }
+  }
+}
+
+/* Searches out from source over the cells from lo to hi, both included, *
+ * that are open, until nothing left in the queue can be reached, or     *
+ * until target, if it isn't NULL, comes out of it.  Returns nonzero if  *
+ * target did.  Cells in the box that never get a distance are left at   *
+ * cost.unreached(); nothing outside it is touched.  cells has to have   *
+ * been through dijkstra_cells_init(), and is left as it was found, with *
+ * nothing in the queue, ready for the next search.                      */
+template <typename Neighbours,
+          template <typename> class Queue = dijkstra_heap,
+          typename Key, typename Open, typename Cost, typename Output>
+DIJKSTRA_INLINE uint32_t dijkstra_search(grid<dijkstra_cell_t> &cells,
+                                         grid<Key> &distance,
+                                         const pair_t lo, const pair_t hi,
+                                         const pair_t source,
+                                         const int16_t *target,
+                                         const Open &open, const Cost &cost,
+                                         Output &output)
+{
+  Queue<Key> q(distance);
+  dijkstra_push<Queue<Key> > push(cells, q);
+  dijkstra_relax<Key, Queue<Key>, Output> relax(cells, distance, q, output);
+  dijkstra_cell_t *c;
+  int32_t x, y;
+
+  for (y = lo[dim_y]; y <= hi[dim_y]; y++) {
+    for (x = lo[dim_x]; x <= hi[dim_x]; x++) {
+      distance[y][x] = cost.unreached();
+    }
+  }
+  distance[source[dim_y]][source[dim_x]] = 0;
+
+  open.each(lo, hi, push);
+
+  while ((c = q.pop())) {
+    c->hn = NULL;
+    if (target &&
+        c->pos[dim_x] == target[dim_x] && c->pos[dim_y] == target[dim_y]) {
+      dijkstra_unqueue(cells, lo, hi);
+      return 1;
+    }
+    /* Everything after this is out of reach too, and adding a step to *
+     * unreached() would make it look like it isn't, or overflow.      */
+    if (distance[c->pos[dim_y]][c->pos[dim_x]] == cost.unreached()) {
+      dijkstra_unqueue(cells, lo, hi);
+      return 0;
+    }
+    relax.c = c;
+    relax.next = cost(c->pos[dim_x], c->pos[dim_y],
+                      distance[c->pos[dim_y]][c->pos[dim_x]]);
+    Neighbours::each(relax);
+  }
+
+  return 0;
+}
+
+#endif
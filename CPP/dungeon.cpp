@@ -5,6 +5,7 @@
 #include <sys/time.h>
 #include <limits.h>
 #include <errno.h>
+#include <algorithm>
 
 #include "dungeon.h"
 #include "utils.h"
@@ -14,228 +15,138 @@
 #include "npc.h"
 #include "io.h"
 #include "object.h"
+#include "bitboard.h"
+#include "spatial.h"
+#include "zobrist.h"
+#include "profile.h"
+#include "path.h"
 
 #define DUMP_HARDNESS_IMAGES 0
 
-typedef struct corridor_path {
-  heap_node_t *hn;
-  uint8_t pos[2];
-  uint8_t from[2];
-  int32_t cost;
-} corridor_path_t;
+int16_t dungeon_x = DEFAULT_DUNGEON_X;
+int16_t dungeon_y = DEFAULT_DUNGEON_Y;
 
-static uint32_t adjacent_to_room(dungeon *d, int16_t y, int16_t x)
+int set_dungeon_size(int32_t x, int32_t y)
 {
-  return (mapxy(x - 1, y) == ter_floor_room ||
-          mapxy(x + 1, y) == ter_floor_room ||
-          mapxy(x, y - 1) == ter_floor_room ||
-          mapxy(x, y + 1) == ter_floor_room);
-}
+  if (x < DEFAULT_DUNGEON_X || x > MAX_DUNGEON_X ||
+      y < DEFAULT_DUNGEON_Y || y > MAX_DUNGEON_Y) {
+    return 1;
+  }
 
-static uint32_t is_open_space(dungeon *d, int16_t y, int16_t x)
-{
-  return !hardnessxy(x, y);
-}
+  dungeon_x = x;
+  dungeon_y = y;
 
-static int32_t corridor_path_cmp(const void *key, const void *with) {
-  return ((corridor_path_t *) key)->cost - ((corridor_path_t *) with)->cost;
+  return 0;
 }
 
-static void dijkstra_corridor(dungeon *d, pair_t from, pair_t to)
+/* How many default-sized dungeons would fit in this one.  Room counts *
+ * scale with it, so that bigger dungeons aren't just emptier.         */
+static uint32_t dungeon_scale(void)
 {
-  static corridor_path_t path[DUNGEON_Y][DUNGEON_X], *p;
-  static uint32_t initialized = 0;
-  heap_t h;
-  int32_t x, y;
-
-  if (!initialized) {
-    for (y = 0; y < DUNGEON_Y; y++) {
-      for (x = 0; x < DUNGEON_X; x++) {
-        path[y][x].pos[dim_y] = y;
-        path[y][x].pos[dim_x] = x;
-      }
-    }
-    initialized = 1;
-  }
-  
-  for (y = 0; y < DUNGEON_Y; y++) {
-    for (x = 0; x < DUNGEON_X; x++) {
-      path[y][x].cost = INT_MAX;
-    }
-  }
+  return ((DUNGEON_X * DUNGEON_Y) / (DEFAULT_DUNGEON_X * DEFAULT_DUNGEON_Y));
+}
 
-  path[from[dim_y]][from[dim_x]].cost = 0;
+/* A corridor only searches the box around its two ends, grown by this *
+ * much in each direction, so that in a big dungeon each one costs      *
+ * about the same as it would in a small one.  In a default-sized       *
+ * dungeon the search still covers the whole map, as it always did, so *
+ * seeds still make the dungeons they always have.                      */
+#define CORRIDOR_MARGIN 10
 
-  heap_init(&h, corridor_path_cmp, NULL);
+static void corridor_box(pair_t from, pair_t to, pair_t lo, pair_t hi)
+{
+  int32_t margin_x, margin_y;
 
-  for (y = 0; y < DUNGEON_Y; y++) {
-    for (x = 0; x < DUNGEON_X; x++) {
-      if (mapxy(x, y) != ter_wall_immutable) {
-        path[y][x].hn = heap_insert(&h, &path[y][x]);
-      } else {
-        path[y][x].hn = NULL;
-      }
-    }
+  if (dungeon_scale() > 1) {
+    margin_x = margin_y = CORRIDOR_MARGIN;
+  } else {
+    margin_x = DUNGEON_X;
+    margin_y = DUNGEON_Y;
   }
 
-  while ((p = (corridor_path_t *) heap_remove_min(&h))) {
-    p->hn = NULL;
-
-    if ((p->pos[dim_y] == to[dim_y]) && p->pos[dim_x] == to[dim_x]) {
-      for (x = to[dim_x], y = to[dim_y];
-           (x != from[dim_x]) || (y != from[dim_y]);
-           p = &path[y][x], x = p->from[dim_x], y = p->from[dim_y]) {
-        if (mapxy(x, y) != ter_floor_room) {
-          mapxy(x, y) = ter_floor_hall;
-          hardnessxy(x, y) = 0;
-        }
-      }
-      heap_delete(&h);
-      return;
-    }
+  lo[dim_x] = std::max(0, std::min(from[dim_x], to[dim_x]) - margin_x);
+  lo[dim_y] = std::max(0, std::min(from[dim_y], to[dim_y]) - margin_y);
+  hi[dim_x] = std::min(DUNGEON_X - 1,
+                       std::max(from[dim_x], to[dim_x]) + margin_x);
+  hi[dim_y] = std::min(DUNGEON_Y - 1,
+                       std::max(from[dim_y], to[dim_y]) + margin_y);
+}
 
-    if ((path[p->pos[dim_y] - 1][p->pos[dim_x]    ].hn) &&
-        (path[p->pos[dim_y] - 1][p->pos[dim_x]    ].cost >
-         p->cost + hardnesspair(p->pos))) {
-      path[p->pos[dim_y] - 1][p->pos[dim_x]    ].cost =
-        p->cost + hardnesspair(p->pos);
-      path[p->pos[dim_y] - 1][p->pos[dim_x]    ].from[dim_y] = p->pos[dim_y];
-      path[p->pos[dim_y] - 1][p->pos[dim_x]    ].from[dim_x] = p->pos[dim_x];
-      heap_decrease_key_no_replace(&h, path[p->pos[dim_y] - 1]
-                                           [p->pos[dim_x]    ].hn);
-    }
-    if ((path[p->pos[dim_y]    ][p->pos[dim_x] - 1].hn) &&
-        (path[p->pos[dim_y]    ][p->pos[dim_x] - 1].cost >
-         p->cost + hardnesspair(p->pos))) {
-      path[p->pos[dim_y]    ][p->pos[dim_x] - 1].cost =
-        p->cost + hardnesspair(p->pos);
-      path[p->pos[dim_y]    ][p->pos[dim_x] - 1].from[dim_y] = p->pos[dim_y];
-      path[p->pos[dim_y]    ][p->pos[dim_x] - 1].from[dim_x] = p->pos[dim_x];
-      heap_decrease_key_no_replace(&h, path[p->pos[dim_y]    ]
-                                           [p->pos[dim_x] - 1].hn);
-    }
-    if ((path[p->pos[dim_y]    ][p->pos[dim_x] + 1].hn) &&
-        (path[p->pos[dim_y]    ][p->pos[dim_x] + 1].cost >
-         p->cost + hardnesspair(p->pos))) {
-      path[p->pos[dim_y]    ][p->pos[dim_x] + 1].cost =
-        p->cost + hardnesspair(p->pos);
-      path[p->pos[dim_y]    ][p->pos[dim_x] + 1].from[dim_y] = p->pos[dim_y];
-      path[p->pos[dim_y]    ][p->pos[dim_x] + 1].from[dim_x] = p->pos[dim_x];
-      heap_decrease_key_no_replace(&h, path[p->pos[dim_y]    ]
-                                           [p->pos[dim_x] + 1].hn);
-    }
-    if ((path[p->pos[dim_y] + 1][p->pos[dim_x]    ].hn) &&
-        (path[p->pos[dim_y] + 1][p->pos[dim_x]    ].cost >
-         p->cost + hardnesspair(p->pos))) {
-      path[p->pos[dim_y] + 1][p->pos[dim_x]    ].cost =
-        p->cost + hardnesspair(p->pos);
-      path[p->pos[dim_y] + 1][p->pos[dim_x]    ].from[dim_y] = p->pos[dim_y];
-      path[p->pos[dim_y] + 1][p->pos[dim_x]    ].from[dim_x] = p->pos[dim_x];
-      heap_decrease_key_no_replace(&h, path[p->pos[dim_y] + 1]
-                                           [p->pos[dim_x]    ].hn);
-    }
-  }
+static uint32_t adjacent_to_room(dungeon *d, int16_t y, int16_t x)
+{
+  return (mapxy(x - 1, y) == ter_floor_room ||
+          mapxy(x + 1, y) == ter_floor_room ||
+          mapxy(x, y - 1) == ter_floor_room ||
+          mapxy(x, y + 1) == ter_floor_room);
 }
 
-/* This is a cut-and-paste of the above.  The code is modified to  *
- * calculate paths based on inverse hardnesses so that we get a    *
- * high probability of creating at least one cycle in the dungeon. */
-static void dijkstra_corridor_inv(dungeon *d, pair_t from, pair_t to)
+static uint32_t is_open_space(dungeon *d, int16_t y, int16_t x)
 {
-  static corridor_path_t path[DUNGEON_Y][DUNGEON_X], *p;
-  static uint32_t initialized = 0;
-  heap_t h;
-  int32_t x, y;
+  return !hardnessxy(x, y);
+}
 
-  if (!initialized) {
-    for (y = 0; y < DUNGEON_Y; y++) {
-      for (x = 0; x < DUNGEON_X; x++) {
-        path[y][x].pos[dim_y] = y;
-        path[y][x].pos[dim_x] = x;
-      }
-    }
-    initialized = 1;
+/* Corridors dig through whatever's softest */
+struct corridor_cost {
+  dungeon *d;
+  corridor_cost(dungeon *dungeon) : d(dungeon) {}
+  DIJKSTRA_INLINE int32_t operator()(int32_t x, int32_t y,
+                                     int32_t cost) const
+  {
+    return cost + hardnessxy(x, y);
   }
-  
-  for (y = 0; y < DUNGEON_Y; y++) {
-    for (x = 0; x < DUNGEON_X; x++) {
-      path[y][x].cost = INT_MAX;
-    }
+  DIJKSTRA_INLINE int32_t unreached() const
+  {
+    return INT_MAX;
   }
+};
 
-  path[from[dim_y]][from[dim_x]].cost = 0;
-
-  heap_init(&h, corridor_path_cmp, NULL);
-
-  for (y = 0; y < DUNGEON_Y; y++) {
-    for (x = 0; x < DUNGEON_X; x++) {
-      if (mapxy(x, y) != ter_wall_immutable) {
-        path[y][x].hn = heap_insert(&h, &path[y][x]);
-      } else {
-        path[y][x].hn = NULL;
-      }
-    }
+/* The same, but on inverse hardnesses, so that we get a high *
+ * probability of creating at least one cycle in the dungeon. */
+struct corridor_cost_inv {
+  dungeon *d;
+  corridor_cost_inv(dungeon *dungeon) : d(dungeon) {}
+  DIJKSTRA_INLINE int32_t operator()(int32_t x, int32_t y,
+                                     int32_t cost) const
+  {
+    return cost + (is_open_space(d, y, x) ? 127 :
+                   (adjacent_to_room(d, y, x) ? 191 :
+                    (255 - hardnessxy(x, y))));
   }
+  DIJKSTRA_INLINE int32_t unreached() const
+  {
+    return INT_MAX;
+  }
+};
 
-  while ((p = (corridor_path_t *) heap_remove_min(&h))) {
-    p->hn = NULL;
-
-    if ((p->pos[dim_y] == to[dim_y]) && p->pos[dim_x] == to[dim_x]) {
-      for (x = to[dim_x], y = to[dim_y];
-           (x != from[dim_x]) || (y != from[dim_y]);
-           p = &path[y][x], x = p->from[dim_x], y = p->from[dim_y]) {
-        if (mapxy(x, y) != ter_floor_room) {
-          mapxy(x, y) = ter_floor_hall;
-          hardnessxy(x, y) = 0;
-        }
-      }
-      heap_delete(&h);
-      return;
-    }
+/* Digs the cheapest way from from to to, for cost, out of everything *
+ * but rooms.                                                         */
+template <typename Cost>
+static void dijkstra_corridor(dungeon *d, pair_t from, pair_t to,
+                              const Cost &cost)
+{
+  static grid<dijkstra_cell_t> cells;
+  static grid<int32_t> distance;
+  static grid<dijkstra_cell_t *> predecessor;
+  dijkstra_predecessor out(predecessor);
+  dijkstra_cell_t *c;
+  pair_t lo, hi;
+
+  dijkstra_cells_init(cells);
+  distance.resize(DUNGEON_X, DUNGEON_Y);
+  predecessor.resize(DUNGEON_X, DUNGEON_Y);
+  corridor_box(from, to, lo, hi);
+
+  if (!dijkstra_search<dijkstra_4way>(cells, distance, lo, hi, from, to,
+                                      path_diggable(d), cost, out)) {
+    return;
+  }
 
-#define hardnesspair_inv(p) (is_open_space(d, p[dim_y], p[dim_x]) ? 127 :     \
-                             (adjacent_to_room(d, p[dim_y], p[dim_x]) ? 191 : \
-                              (255 - hardnesspair(p))))
-
-    if ((path[p->pos[dim_y] - 1][p->pos[dim_x]    ].hn) &&
-        (path[p->pos[dim_y] - 1][p->pos[dim_x]    ].cost >
-         p->cost + hardnesspair_inv(p->pos))) {
-      path[p->pos[dim_y] - 1][p->pos[dim_x]    ].cost =
-        p->cost + hardnesspair_inv(p->pos);
-      path[p->pos[dim_y] - 1][p->pos[dim_x]    ].from[dim_y] = p->pos[dim_y];
-      path[p->pos[dim_y] - 1][p->pos[dim_x]    ].from[dim_x] = p->pos[dim_x];
-      heap_decrease_key_no_replace(&h, path[p->pos[dim_y] - 1]
-                                           [p->pos[dim_x]    ].hn);
-    }
-    if ((path[p->pos[dim_y]    ][p->pos[dim_x] - 1].hn) &&
-        (path[p->pos[dim_y]    ][p->pos[dim_x] - 1].cost >
-         p->cost + hardnesspair_inv(p->pos))) {
-      path[p->pos[dim_y]    ][p->pos[dim_x] - 1].cost =
-        p->cost + hardnesspair_inv(p->pos);
-      path[p->pos[dim_y]    ][p->pos[dim_x] - 1].from[dim_y] = p->pos[dim_y];
-      path[p->pos[dim_y]    ][p->pos[dim_x] - 1].from[dim_x] = p->pos[dim_x];
-      heap_decrease_key_no_replace(&h, path[p->pos[dim_y]    ]
-                                           [p->pos[dim_x] - 1].hn);
-    }
-    if ((path[p->pos[dim_y]    ][p->pos[dim_x] + 1].hn) &&
-        (path[p->pos[dim_y]    ][p->pos[dim_x] + 1].cost >
-         p->cost + hardnesspair_inv(p->pos))) {
-      path[p->pos[dim_y]    ][p->pos[dim_x] + 1].cost =
-        p->cost + hardnesspair_inv(p->pos);
-      path[p->pos[dim_y]    ][p->pos[dim_x] + 1].from[dim_y] = p->pos[dim_y];
-      path[p->pos[dim_y]    ][p->pos[dim_x] + 1].from[dim_x] = p->pos[dim_x];
-      heap_decrease_key_no_replace(&h, path[p->pos[dim_y]    ]
-                                           [p->pos[dim_x] + 1].hn);
-    }
-    if ((path[p->pos[dim_y] + 1][p->pos[dim_x]    ].hn) &&
-        (path[p->pos[dim_y] + 1][p->pos[dim_x]    ].cost >
-         p->cost + hardnesspair_inv(p->pos))) {
-      path[p->pos[dim_y] + 1][p->pos[dim_x]    ].cost =
-        p->cost + hardnesspair_inv(p->pos);
-      path[p->pos[dim_y] + 1][p->pos[dim_x]    ].from[dim_y] = p->pos[dim_y];
-      path[p->pos[dim_y] + 1][p->pos[dim_x]    ].from[dim_x] = p->pos[dim_x];
-      heap_decrease_key_no_replace(&h, path[p->pos[dim_y] + 1]
-                                           [p->pos[dim_x]    ].hn);
+  for (c = &cells[to[dim_y]][to[dim_x]];
+       c != &cells[from[dim_y]][from[dim_x]];
+       c = predecessor[c->pos[dim_y]][c->pos[dim_x]]) {
+    if (mappair(c->pos) != ter_floor_room) {
+      mappair(c->pos) = ter_floor_hall;
+      hardnesspair(c->pos) = 0;
     }
   }
 }
@@ -257,7 +168,7 @@ static int connect_two_rooms(dungeon *d, room_t *r1, room_t *r2)
                          r2->position[dim_x] + r2->size[dim_x] - 1);
 
   /*  return connect_two_points_recursive(d, e1, e2);*/
-  dijkstra_corridor(d, e1, e2);
+  dijkstra_corridor(d, e1, e2, corridor_cost(d));
 
   return 0;
 }
@@ -299,15 +210,44 @@ static int create_cycle(dungeon *d)
                          (d->rooms[q].position[dim_x] +
                           d->rooms[q].size[dim_x] - 1));
 
-  dijkstra_corridor_inv(d, e1, e2);
+  dijkstra_corridor(d, e1, e2, corridor_cost_inv(d));
 
   return 0;
 }
 
+/* Rooms in bands DEFAULT_DUNGEON_Y tall, left to right along even bands *
+ * and back along odd ones, so that consecutive rooms are near each      *
+ * other.                                                                */
+static int32_t room_band_cmp(const void *key, const void *with)
+{
+  const room_t *r1 = (const room_t *) key;
+  const room_t *r2 = (const room_t *) with;
+  int32_t b1, b2;
+
+  b1 = r1->position[dim_y] / DEFAULT_DUNGEON_Y;
+  b2 = r2->position[dim_y] / DEFAULT_DUNGEON_Y;
+
+  if (b1 != b2) {
+    return b1 - b2;
+  }
+
+  return ((b1 & 1) ? r2->position[dim_x] - r1->position[dim_x] :
+                     r1->position[dim_x] - r2->position[dim_x]);
+}
+
 static int connect_rooms(dungeon *d)
 {
+  PROFILE_SCOPE("connect_rooms");
   uint32_t i;
 
+  /* Each room is joined to the one before it.  Rooms are placed at *
+   * random, so in a big dungeon those corridors would criss-cross  *
+   * the whole map; sorted, they only run to a neighbor.            */
+  if (dungeon_scale() > 1) {
+    qsort(d->rooms, d->num_rooms, sizeof (*d->rooms),
+          (int (*)(const void *, const void *)) room_band_cmp);
+  }
+
   for (i = 1; i < d->num_rooms; i++) {
     connect_two_rooms(d, d->rooms + i - 1, d->rooms + i);
   }
@@ -332,15 +272,16 @@ typedef struct queue_node {
 
 static int smooth_hardness(dungeon *d)
 {
+  PROFILE_SCOPE("smooth_hardness");
   int32_t i, x, y;
   int32_t s, t, p, q;
   queue_node_t *head, *tail, *tmp;
 #if DUMP_HARDNESS_IMAGES
   FILE *out;
 #endif
-  uint8_t hardness[DUNGEON_Y][DUNGEON_X];
+  grid<uint8_t> hardness;
 
-  memset(&hardness, 0, sizeof (hardness));
+  hardness.resize(DUNGEON_X, DUNGEON_Y);
 
   /* Seed with some values */
   for (i = 1; i < 255; i += 20) {
@@ -363,7 +304,7 @@ static int smooth_hardness(dungeon *d)
 #if DUMP_HARDNESS_IMAGES
   out = fopen("seeded.pgm", "w");
   fprintf(out, "P5\n%u %u\n255\n", DUNGEON_X, DUNGEON_Y);
-  fwrite(&hardness, sizeof (hardness), 1, out);
+  fwrite(hardness.data(), hardness.size(), 1, out);
   fclose(out);
 #endif
 
@@ -477,12 +418,12 @@ static int smooth_hardness(dungeon *d)
 #if DUMP_HARDNESS_IMAGES
   out = fopen("diffused.pgm", "w");
   fprintf(out, "P5\n%u %u\n255\n", DUNGEON_X, DUNGEON_Y);
-  fwrite(&hardness, sizeof (hardness), 1, out);
+  fwrite(hardness.data(), hardness.size(), 1, out);
   fclose(out);
 
   out = fopen("smoothed.pgm", "w");
   fprintf(out, "P5\n%u %u\n255\n", DUNGEON_X, DUNGEON_Y);
-  fwrite(&d->hardness, sizeof (d->hardness), 1, out);
+  fwrite(d->hardness.data(), d->hardness.size(), 1, out);
   fclose(out);
 #endif
 
@@ -491,7 +432,7 @@ static int smooth_hardness(dungeon *d)
 
 static int empty_dungeon(dungeon *d)
 {
-  uint8_t x, y;
+  int16_t x, y;
 
   smooth_hardness(d);
   for (y = 0; y < DUNGEON_Y; y++) {
@@ -507,41 +448,81 @@ static int empty_dungeon(dungeon *d)
   }
 
   d->is_new = 1;
+  bitboard_rebuild(d);
 
   return 0;
 }
 
-static int place_rooms(dungeon *d)
+/* Whether r, with a wall all the way around it, lands only on rock. */
+static uint32_t room_fits(dungeon *d, room_t *r)
 {
   pair_t p;
-  uint32_t i;
+
+  for (p[dim_y] = r->position[dim_y] - 1;
+       p[dim_y] < r->position[dim_y] + r->size[dim_y] + 1;
+       p[dim_y]++) {
+    for (p[dim_x] = r->position[dim_x] - 1;
+         p[dim_x] < r->position[dim_x] + r->size[dim_x] + 1;
+         p[dim_x]++) {
+      if (mappair(p) >= ter_floor) {
+        return 0;
+      }
+    }
+  }
+
+  return 1;
+}
+
+static void carve_room(dungeon *d, room_t *r)
+{
+  pair_t p;
+
+  for (p[dim_y] = r->position[dim_y];
+       p[dim_y] < r->position[dim_y] + r->size[dim_y];
+       p[dim_y]++) {
+    for (p[dim_x] = r->position[dim_x];
+         p[dim_x] < r->position[dim_x] + r->size[dim_x];
+         p[dim_x]++) {
+      mappair(p) = ter_floor_room;
+      hardnesspair(p) = 0;
+    }
+  }
+}
+
+/* In a default-sized dungeon, the first room that lands on another one *
+ * throws the whole thing away and starts over, which is what it always *
+ * did, so seeds still make the dungeons they always have.  With a few  *
+ * thousand rooms that would never finish; in anything bigger, each     *
+ * room gets ROOM_PLACEMENT_TRIES, and one that doesn't fit is dropped. */
+static int place_rooms(dungeon *d)
+{
+  PROFILE_SCOPE("place_rooms");
+  uint32_t i, tries, max_tries;
   int success;
   room_t *r;
 
+  max_tries = dungeon_scale() > 1 ? ROOM_PLACEMENT_TRIES : 1;
+
   for (success = 0; !success; ) {
     success = 1;
-    for (i = 0; success && i < d->num_rooms; i++) {
+    for (i = 0; success && i < d->num_rooms; ) {
       r = d->rooms + i;
-      r->position[dim_x] = 1 + rand() % (DUNGEON_X - 2 - r->size[dim_x]);
-      r->position[dim_y] = 1 + rand() % (DUNGEON_Y - 2 - r->size[dim_y]);
-      for (p[dim_y] = r->position[dim_y] - 1;
-           success && p[dim_y] < r->position[dim_y] + r->size[dim_y] + 1;
-           p[dim_y]++) {
-        for (p[dim_x] = r->position[dim_x] - 1;
-             success && p[dim_x] < r->position[dim_x] + r->size[dim_x] + 1;
-             p[dim_x]++) {
-          if (mappair(p) >= ter_floor) {
-            success = 0;
-            empty_dungeon(d);
-          } else if ((p[dim_y] != r->position[dim_y] - 1)              &&
-                     (p[dim_y] != r->position[dim_y] + r->size[dim_y]) &&
-                     (p[dim_x] != r->position[dim_x] - 1)              &&
-                     (p[dim_x] != r->position[dim_x] + r->size[dim_x])) {
-            mappair(p) = ter_floor_room;
-            hardnesspair(p) = 0;
-          }
+      for (tries = 0; tries < max_tries; tries++) {
+        r->position[dim_x] = 1 + rand() % (DUNGEON_X - 2 - r->size[dim_x]);
+        r->position[dim_y] = 1 + rand() % (DUNGEON_Y - 2 - r->size[dim_y]);
+        if (room_fits(d, r)) {
+          break;
         }
       }
+      if (tries < max_tries) {
+        carve_room(d, r);
+        i++;
+      } else if (max_tries == 1) {
+        success = 0;
+        empty_dungeon(d);
+      } else {
+        d->rooms[i] = d->rooms[--d->num_rooms];
+      }
     }
   }
 
@@ -576,7 +557,7 @@ static int make_rooms(dungeon *d)
 
   for (i = MIN_ROOMS; i < MAX_ROOMS && rand_under(6, 8); i++)
     ;
-  d->num_rooms = i;
+  d->num_rooms = i * dungeon_scale();
   d->rooms = (room_t *) malloc(sizeof (*d->rooms) * d->num_rooms);
 
   for (i = 0; i < d->num_rooms; i++) {
@@ -595,6 +576,7 @@ static int make_rooms(dungeon *d)
 
 int gen_dungeon(dungeon *d)
 {
+  PROFILE_SCOPE("gen_dungeon");
   empty_dungeon(d);
 
   do {
@@ -602,6 +584,7 @@ int gen_dungeon(dungeon *d)
   } while (place_rooms(d));
   connect_rooms(d);
   place_stairs(d);
+  bitboard_rebuild(d);
 
   return 0;
 }
@@ -610,68 +593,163 @@ void delete_dungeon(dungeon *d)
 {
   free(d->rooms);
   heap_delete(&d->events);
-  memset(d->character_map, 0, sizeof (d->character_map));
+  npc_dormant_delete(d);
+  d->character_map.fill(NULL);
+  spatial_clear(d);
   destroy_objects(d);
 }
 
+/* Sizes everything for DUNGEON_X by DUNGEON_Y, which needn't be what it *
+ * was the last time through.                                            */
 void init_dungeon(dungeon *d)
 {
+  d->map.resize(DUNGEON_X, DUNGEON_Y);
+  d->hardness.resize(DUNGEON_X, DUNGEON_Y);
+  d->passable.resize(BITBOARD_WORDS, DUNGEON_Y);
+  d->pc_distance.resize(DUNGEON_X, DUNGEON_Y);
+  d->pc_tunnel.resize(DUNGEON_X, DUNGEON_Y);
+  d->character_map.resize(DUNGEON_X, DUNGEON_Y);
+  d->spatial.resize(SPATIAL_X, SPATIAL_Y);
+  d->objmap.resize(DUNGEON_X, DUNGEON_Y);
+
   empty_dungeon(d);
   memset(&d->events, 0, sizeof (d->events));
   heap_init(&d->events, compare_events, event_delete);
-  memset(d->character_map, 0, sizeof (d->character_map));
-  memset(d->objmap, 0, sizeof (d->objmap));
+  d->character_map.fill(NULL);
+  spatial_clear(d);
+  d->objmap.fill(NULL);
   d->boss_alive = 1;
 }
 
+/* A version 0 file is always the default size, and stores coordinates *
+ * in a byte; version 1 stores them big endian in two.                 */
+static void write_coordinate(uint16_t c, uint32_t version, FILE *f)
+{
+  uint16_t be16;
+  uint8_t p;
+
+  if (version) {
+    be16 = htobe16(c);
+    fwrite(&be16, sizeof (be16), 1, f);
+  } else {
+    p = c;
+    fwrite(&p, 1, 1, f);
+  }
+}
+
+static uint16_t read_coordinate(uint32_t version, FILE *f)
+{
+  uint16_t be16;
+  uint8_t p;
+
+  if (version) {
+    be16 = 0;
+    fread(&be16, sizeof (be16), 1, f);
+    return be16toh(be16);
+  }
+
+  p = 0;
+  fread(&p, 1, 1, f);
+
+  return p;
+}
+
+/* Bytes per coordinate */
+#define coordinate_size(version) ((version) ? 2 : 1)
+
 int write_dungeon_map(dungeon *d, FILE *f)
 {
-  uint32_t x, y;
+  int32_t y;
 
   for (y = 0; y < DUNGEON_Y; y++) {
-    for (x = 0; x < DUNGEON_X; x++) {
-      fwrite(&d->hardness[y][x], sizeof (unsigned char), 1, f);
-    }
+    fwrite(d->hardness[y], sizeof (unsigned char), DUNGEON_X, f);
   }
 
   return 0;
 }
 
-int write_rooms(dungeon *d, FILE *f)
+int write_rooms(dungeon *d, FILE *f, uint32_t version)
 {
   uint32_t i;
-  uint8_t p;
 
   for (i = 0; i < d->num_rooms; i++) {
     /* write order is xpos, ypos, width, height */
-    p = d->rooms[i].position[dim_x];
-    fwrite(&p, 1, 1, f);
-    p = d->rooms[i].position[dim_y];
-    fwrite(&p, 1, 1, f);
-    p = d->rooms[i].size[dim_x];
-    fwrite(&p, 1, 1, f);
-    p = d->rooms[i].size[dim_y];
-    fwrite(&p, 1, 1, f);
+    write_coordinate(d->rooms[i].position[dim_x], version, f);
+    write_coordinate(d->rooms[i].position[dim_y], version, f);
+    write_coordinate(d->rooms[i].size[dim_x], version, f);
+    write_coordinate(d->rooms[i].size[dim_y], version, f);
   }
 
   return 0;
 }
 
-uint32_t calculate_dungeon_size(dungeon *d)
+/* The semantic, version, and size, and in version 1 the dimensions, *
+ * then the PC position.                                             */
+static uint32_t dungeon_header_size(uint32_t version)
+{
+  return (20 + (version ? 4 : 0) + 2 * coordinate_size(version));
+}
+
+uint32_t calculate_dungeon_size(dungeon *d, uint32_t version)
 {
-  return (22 /* The semantic, version, size, and PC position*/ +
-          (DUNGEON_X * DUNGEON_Y) /* The hardnesses         */ +
-          (d->num_rooms * 4) /* Four bytes per room         */ );
+  return (dungeon_header_size(version)                          +
+          (DUNGEON_X * DUNGEON_Y) /* The hardnesses */          +
+          (d->num_rooms * 4 * coordinate_size(version)) /* Rooms */);
+}
+
+/* Everything but opening and closing the file, so that a dungeon can *
+ * also be written into the middle of one; see world.cpp.             */
+int write_dungeon_to(dungeon *d, FILE *f)
+{
+  uint32_t be32;
+  uint16_t be16;
+  uint32_t version;
+
+  /* Default-sized dungeons are still written in the old format, so that *
+   * older builds can read them.                                         */
+  version = (DUNGEON_X == DEFAULT_DUNGEON_X &&
+             DUNGEON_Y == DEFAULT_DUNGEON_Y) ? 0 : DUNGEON_SAVE_VERSION;
+
+  /* The semantic, which is 6 bytes, 0-11 */
+  fwrite(DUNGEON_SAVE_SEMANTIC, 1, sizeof (DUNGEON_SAVE_SEMANTIC) - 1, f);
+
+  /* The version, 4 bytes, 12-15 */
+  be32 = htobe32(version);
+  fwrite(&be32, sizeof (be32), 1, f);
+
+  /* The size of the file, 4 bytes, 16-19 */
+  be32 = htobe32(calculate_dungeon_size(d, version));
+  fwrite(&be32, sizeof (be32), 1, f);
+
+  /* Version 1 only: the width and height, 2 bytes each, 20-23 */
+  if (version) {
+    be16 = htobe16(DUNGEON_X);
+    fwrite(&be16, sizeof (be16), 1, f);
+    be16 = htobe16(DUNGEON_Y);
+    fwrite(&be16, sizeof (be16), 1, f);
+  }
+
+  /* The PC position, 2 bytes, 20-21 (4 bytes, 24-27), or zeros if *
+   * there's no PC in it.                                          */
+  write_coordinate(d->PC ? d->PC->position[dim_x] : 0, version, f);
+  write_coordinate(d->PC ? d->PC->position[dim_y] : 0, version, f);
+
+  /* The dungeon map, DUNGEON_X * DUNGEON_Y bytes */
+  write_dungeon_map(d, f);
+
+  /* And the rooms, num_rooms * 4 coordinates, to the end */
+  write_rooms(d, f, version);
+
+  return 0;
 }
 
 int write_dungeon(dungeon *d, char *file)
 {
+  PROFILE_SCOPE("write_dungeon");
   char *home;
   char *filename;
   FILE *f;
   size_t len;
-  uint32_t be32;
-  uint8_t i;
 
   if (!file) {
     if (!(home = getenv("HOME"))) {
@@ -702,28 +780,7 @@ int write_dungeon(dungeon *d, char *file)
     }
   }
 
-  /* The semantic, which is 6 bytes, 0-11 */
-  fwrite(DUNGEON_SAVE_SEMANTIC, 1, sizeof (DUNGEON_SAVE_SEMANTIC) - 1, f);
-
-  /* The version, 4 bytes, 12-15 */
-  be32 = htobe32(DUNGEON_SAVE_VERSION);
-  fwrite(&be32, sizeof (be32), 1, f);
-
-  /* The size of the file, 4 bytes, 16-19 */
-  be32 = htobe32(calculate_dungeon_size(d));
-  fwrite(&be32, sizeof (be32), 1, f);
-
-  /* The PC position, 2 bytes, 20-21 */
-  i = d->PC->position[dim_x];
-  fwrite(&i, 1, 1, f);
-  i = d->PC->position[dim_y];
-  fwrite(&i, 1, 1, f);
-
-  /* The dungeon map, 1680 bytes, 22-1702 */
-  write_dungeon_map(d, f);
-
-  /* And the rooms, num_rooms * 4 bytes, 1703-end */
-  write_rooms(d, f);
+  write_dungeon_to(d, f);
 
   fclose(f);
 
@@ -732,11 +789,11 @@ int write_dungeon(dungeon *d, char *file)
 
 int read_dungeon_map(dungeon *d, FILE *f)
 {
-  uint32_t x, y;
+  int32_t x, y;
 
   for (y = 0; y < DUNGEON_Y; y++) {
+    fread(d->hardness[y], sizeof (unsigned char), DUNGEON_X, f);
     for (x = 0; x < DUNGEON_X; x++) {
-      fread(&d->hardness[y][x], sizeof (d->hardness[y][x]), 1, f);
       if (d->hardness[y][x] == 0) {
         /* Mark it as a corridor.  We can't recognize room cells until *
          * after we've read the room array, which we haven't done yet. */
@@ -753,26 +810,21 @@ int read_dungeon_map(dungeon *d, FILE *f)
   return 0;
 }
 
-int read_rooms(dungeon *d, FILE *f)
+int read_rooms(dungeon *d, FILE *f, uint32_t version)
 {
   uint32_t i;
   int32_t x, y;
-  uint8_t p;
 
   for (i = 0; i < d->num_rooms; i++) {
-    fread(&p, 1, 1, f);
-    d->rooms[i].position[dim_x] = p;
-    fread(&p, 1, 1, f);
-    d->rooms[i].position[dim_y] = p;
-    fread(&p, 1, 1, f);
-    d->rooms[i].size[dim_x] = p;
-    fread(&p, 1, 1, f);
-    d->rooms[i].size[dim_y] = p;
+    d->rooms[i].position[dim_x] = read_coordinate(version, f);
+    d->rooms[i].position[dim_y] = read_coordinate(version, f);
+    d->rooms[i].size[dim_x] = read_coordinate(version, f);
+    d->rooms[i].size[dim_y] = read_coordinate(version, f);
 
     if (d->rooms[i].size[dim_x] < 1             ||
         d->rooms[i].size[dim_y] < 1             ||
         d->rooms[i].size[dim_x] > DUNGEON_X - 1 ||
-        d->rooms[i].size[dim_y] > DUNGEON_X - 1) {
+        d->rooms[i].size[dim_y] > DUNGEON_Y - 1) {
       fprintf(stderr, "Invalid room size in restored dungeon.\n");
 
       exit(-1);
@@ -807,24 +859,99 @@ int read_rooms(dungeon *d, FILE *f)
   return 0;
 }
 
-int calculate_num_rooms(uint32_t dungeon_bytes)
+int calculate_num_rooms(uint32_t dungeon_bytes, uint32_t version)
 {
   return ((dungeon_bytes -
-          (20 /* The semantic, version, and size */       +
-           (DUNGEON_X * DUNGEON_Y) /* The hardnesses */)) /
-          4 /* Four bytes per room */);
+           (dungeon_header_size(version)               +
+            (DUNGEON_X * DUNGEON_Y) /* The hardnesses */)) /
+          (4 * coordinate_size(version)) /* Four coordinates per room */);
 }
 
-int read_dungeon(dungeon *d, char *file)
+/* Makes the dungeon x by y, if it isn't already.  Whatever was in it is *
+ * lost if it wasn't.                                                     */
+static void resize_dungeon(dungeon *d, int16_t x, int16_t y)
+{
+  if (x == DUNGEON_X && y == DUNGEON_Y) {
+    return;
+  }
+
+  if (set_dungeon_size(x, y)) {
+    fprintf(stderr, "Dungeon size %dx%d is out of range.\n", x, y);
+    exit(-1);
+  }
+  heap_delete(&d->events);
+  init_dungeon(d);
+}
+
+/* The other half of write_dungeon_to(): reads a dungeon from wherever *
+ * f is.  If size isn't zero, it's how many bytes the dungeon should    *
+ * take up, to be checked against what the file says.                  */
+int read_dungeon_from(dungeon *d, FILE *f, uint32_t size)
 {
   char semantic[sizeof (DUNGEON_SAVE_SEMANTIC)];
   uint32_t be32;
+  uint16_t be16;
+  uint32_t version;
+  int16_t x, y;
+
+  d->num_rooms = 0;
+
+  fread(semantic, sizeof (DUNGEON_SAVE_SEMANTIC) - 1, 1, f);
+  semantic[sizeof (DUNGEON_SAVE_SEMANTIC) - 1] = '\0';
+  if (strncmp(semantic, DUNGEON_SAVE_SEMANTIC,
+	      sizeof (DUNGEON_SAVE_SEMANTIC) - 1)) {
+    fprintf(stderr, "Not an RLG327 save file.\n");
+    exit(-1);
+  }
+  fread(&be32, sizeof (be32), 1, f);
+  version = be32toh(be32);
+  if (version > DUNGEON_SAVE_VERSION) {
+    fprintf(stderr, "File version mismatch.\n");
+    exit(-1);
+  }
+  fread(&be32, sizeof (be32), 1, f);
+  if (size && size != be32toh(be32)) {
+    fprintf(stderr, "File size mismatch.\n");
+    exit(-1);
+  }
+  size = be32toh(be32);
+
+  if (version) {
+    fread(&be16, sizeof (be16), 1, f);
+    x = be16toh(be16);
+    fread(&be16, sizeof (be16), 1, f);
+    y = be16toh(be16);
+    resize_dungeon(d, x, y);
+  } else {
+    resize_dungeon(d, DEFAULT_DUNGEON_X, DEFAULT_DUNGEON_Y);
+  }
+
+  x = read_coordinate(version, f);
+  y = read_coordinate(version, f);
+  /* The game places the PC itself; only keep this when there already *
+   * is one to put there.                                             */
+  if (d->PC) {
+    d->PC->position[dim_x] = x;
+    d->PC->position[dim_y] = y;
+  }
+  
+  read_dungeon_map(d, f);
+  d->num_rooms = calculate_num_rooms(size, version);
+  d->rooms = (room_t *) malloc(sizeof (*d->rooms) * d->num_rooms);
+  read_rooms(d, f, version);
+  bitboard_rebuild(d);
+
+  return 0;
+}
+
+int read_dungeon(dungeon *d, char *file)
+{
+  PROFILE_SCOPE("read_dungeon");
   FILE *f;
   char *home;
   size_t len;
   char *filename;
   struct stat buf;
-  uint8_t i;
 
   if (!file) {
     if (!(home = getenv("HOME"))) {
@@ -862,35 +989,7 @@ int read_dungeon(dungeon *d, char *file)
     }
   }
 
-  d->num_rooms = 0;
-
-  fread(semantic, sizeof (DUNGEON_SAVE_SEMANTIC) - 1, 1, f);
-  semantic[sizeof (DUNGEON_SAVE_SEMANTIC) - 1] = '\0';
-  if (strncmp(semantic, DUNGEON_SAVE_SEMANTIC,
-	      sizeof (DUNGEON_SAVE_SEMANTIC) - 1)) {
-    fprintf(stderr, "Not an RLG327 save file.\n");
-    exit(-1);
-  }
-  fread(&be32, sizeof (be32), 1, f);
-  if (be32toh(be32) != 0) { /* Since we expect zero, be32toh() is a no-op. */
-    fprintf(stderr, "File version mismatch.\n");
-    exit(-1);
-  }
-  fread(&be32, sizeof (be32), 1, f);
-  if (buf.st_size != be32toh(be32)) {
-    fprintf(stderr, "File size mismatch.\n");
-    exit(-1);
-  }
-
-  fread(&i, 1, 1, f);
-  d->PC->position[dim_x] = i;
-  fread(&i, 1, 1, f);
-  d->PC->position[dim_y] = i;
-  
-  read_dungeon_map(d, f);
-  d->num_rooms = calculate_num_rooms(buf.st_size);
-  d->rooms = (room_t *) malloc(sizeof (*d->rooms) * d->num_rooms);
-  read_rooms(d, f);
+  read_dungeon_from(d, f, buf.st_size);
 
   fclose(f);
 
@@ -901,10 +1000,9 @@ int read_pgm(dungeon *d, char *pgm)
 {
   FILE *f;
   char s[80];
-  uint8_t gm[DUNGEON_Y - 2][DUNGEON_X - 2];
-  uint32_t x, y;
+  grid<uint8_t> gm;
+  int32_t x, y, w, h;
   uint32_t i;
-  char size[8]; /* Big enough to hold two 3-digit values with a space between. */
 
   if (!(f = fopen(pgm, "r"))) {
     perror(pgm);
@@ -919,9 +1017,12 @@ int read_pgm(dungeon *d, char *pgm)
     fprintf(stderr, "Expected comment\n");
     exit(-1);
   }
-  snprintf(size, 8, "%d %d", DUNGEON_X - 2, DUNGEON_Y - 2);
-  if (!fgets(s, 80, f) || strncmp(s, size, 5)) {
-    fprintf(stderr, "Expected %s\n", size);
+  /* The image is the dungeon without its border, so it sets the size. */
+  if (!fgets(s, 80, f) || sscanf(s, "%d %d", &w, &h) != 2 ||
+      w < DEFAULT_DUNGEON_X - 2 || w > MAX_DUNGEON_X - 2 ||
+      h < DEFAULT_DUNGEON_Y - 2 || h > MAX_DUNGEON_Y - 2) {
+    fprintf(stderr, "Expected a size of at least %d %d\n",
+            DEFAULT_DUNGEON_X - 2, DEFAULT_DUNGEON_Y - 2);
     exit(-1);
   }
   if (!fgets(s, 80, f) || strncmp(s, "255", 2)) {
@@ -929,7 +1030,9 @@ int read_pgm(dungeon *d, char *pgm)
     exit(-1);
   }
 
-  fread(gm, 1, (DUNGEON_X - 2) * (DUNGEON_Y - 2), f);
+  resize_dungeon(d, w + 2, h + 2);
+  gm.resize(w, h);
+  fread(gm.data(), 1, gm.size(), f);
 
   fclose(f);
 
@@ -979,6 +1082,8 @@ int read_pgm(dungeon *d, char *pgm)
     d->hardness[y][DUNGEON_X - 1] = 255;
   }
 
+  bitboard_rebuild(d);
+
   return 0;
 }
 
@@ -1029,6 +1134,7 @@ void render_movement_cost_map(dungeon *d)
 
 void new_dungeon(dungeon *d)
 {
+  PROFILE_SCOPE("new_dungeon");
   uint32_t sequence_number;
 
   sequence_number = d->character_sequence_number;
@@ -1044,4 +1150,5 @@ void new_dungeon(dungeon *d)
 
   gen_monsters(d);
   gen_objects(d);
+  zobrist_rebuild(d);
 }
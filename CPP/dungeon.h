@@ -1,20 +1,38 @@
 #ifndef DUNGEON_H
 # define DUNGEON_H
 
+# include <stdio.h>
+
 # include "heap.h"
 # include "macros.h"
 # include "dims.h"
 # include "character.h"
 # include "descriptions.h"
+# include "grid.h"
 
-#define DUNGEON_X              80
-#define DUNGEON_Y              21
+/* The dungeon's size is chosen at startup (see --size), so DUNGEON_X and *
+ * DUNGEON_Y are variables, not constants.  Nothing may be smaller than  *
+ * the default, which is also all that fits on the screen without the    *
+ * view having to scroll.                                                */
+#define DEFAULT_DUNGEON_X      80
+#define DEFAULT_DUNGEON_Y      21
+#define MAX_DUNGEON_X          2048
+#define MAX_DUNGEON_Y          2048
+#define DUNGEON_X              dungeon_x
+#define DUNGEON_Y              dungeon_y
+#define BITBOARD_WORDS         ((DUNGEON_X + 63) / 64)
+#define SPATIAL_SHIFT          3
+#define SPATIAL_X              ((DUNGEON_X + 7) >> SPATIAL_SHIFT)
+#define SPATIAL_Y              ((DUNGEON_Y + 7) >> SPATIAL_SHIFT)
 #define MIN_ROOMS              5
 #define MAX_ROOMS              9
 #define ROOM_MIN_X             4
 #define ROOM_MIN_Y             2
 #define ROOM_MAX_X             14
 #define ROOM_MAX_Y             8
+#define ROOM_PLACEMENT_TRIES   100
+#define DISTANCE_UNREACHABLE   0xffff
+#define DISTANCE_MAX           (DISTANCE_UNREACHABLE - 1)
 #define PC_VISUAL_RANGE        3
 #define NPC_VISUAL_RANGE       15
 #define PC_SPEED               10
@@ -23,7 +41,10 @@
 #define SAVE_DIR               ".rlg327"
 #define DUNGEON_SAVE_FILE      "dungeon"
 #define DUNGEON_SAVE_SEMANTIC  "RLG327-F2018"
-#define DUNGEON_SAVE_VERSION   0U
+/* Version 0 is the original format and is still what's written for a *
+ * dungeon of the default size.  Version 1 adds the dimensions, and     *
+ * widens the coordinates to 16 bits.                                   */
+#define DUNGEON_SAVE_VERSION   1U
 #define MONSTER_DESC_FILE      "monster_desc.txt"
 #define OBJECT_DESC_FILE       "object_desc.txt"
 
@@ -35,6 +56,9 @@
 #define charxy(x, y) (d->character_map[y][x])
 #define objpair(pair) (d->objmap[pair[dim_y]][pair[dim_x]])
 #define objxy(x, y) (d->objmap[y][x])
+#define passablepair(pair) ((d->passable[pair[dim_y]][pair[dim_x] >> 6] >> \
+                             (pair[dim_x] & 63)) & 1)
+#define passablexy(x, y) ((d->passable[y][(x) >> 6] >> ((x) & 63)) & 1)
 
 enum __attribute__ ((__packed__)) terrain_type {
   ter_debug,
@@ -56,17 +80,19 @@ typedef struct room {
 
 class pc;
 class object;
+struct event;
 
 class dungeon {
  public:
- dungeon() : num_rooms(0), rooms(0), map{ter_wall}, hardness{0},
-             pc_distance{0}, pc_tunnel{0}, character_map{0}, PC(0),
-             num_monsters(0), max_monsters(0), character_sequence_number(0),
-             time(0), is_new(0), quit(0), monster_descriptions(),
-             object_descriptions() {}
+ dungeon() : num_rooms(0), rooms(0), PC(0), num_monsters(0), max_monsters(0),
+             character_sequence_number(0), time(0), hash(0), is_new(0),
+             quit(0), autopilot(0), lod(0), dormant(0), flow(0),
+             monster_descriptions(), object_descriptions() {}
   uint32_t num_rooms;
   room_t *rooms;
-  terrain_type map[DUNGEON_Y][DUNGEON_X];
+  /* All of the per-cell arrays are DUNGEON_Y rows of DUNGEON_X, except *
+   * as noted, and are sized by init_dungeon().                          */
+  grid<terrain_type> map;
   /* Since hardness is usually not used, it would be expensive to pull it *
    * into cache every time we need a map cell, so we store it in a        *
    * parallel array, rather than using a structure to represent the       *
@@ -75,13 +101,27 @@ class dungeon {
    * that structure.  Pathfinding will require efficient use of the map,  *
    * and pulling in unnecessary data with each map cell would add a lot   *
    * of overhead to the memory system.                                    */
-  uint8_t hardness[DUNGEON_Y][DUNGEON_X];
-  uint8_t pc_distance[DUNGEON_Y][DUNGEON_X];
-  uint8_t pc_tunnel[DUNGEON_Y][DUNGEON_X];
-  character *character_map[DUNGEON_Y][DUNGEON_X];
-  object *objmap[DUNGEON_Y][DUNGEON_X];
+  grid<uint8_t> hardness;
+  /* One bit per cell, set where mapxy() >= ter_floor.  Derived from map, *
+   * so anything that changes map must call bitboard_update() (for a      *
+   * single cell) or bitboard_rebuild() (for the whole thing).  Rows are  *
+   * BITBOARD_WORDS long.                                                 */
+  grid<uint64_t> passable;
+  /* Costs of the cheapest way from each cell to the PC, for monsters   *
+   * that walk and monsters that tunnel.  Cells that can't get there at *
+   * all are DISTANCE_UNREACHABLE.  See path.cpp.                       */
+  grid<uint16_t> pc_distance;
+  grid<uint16_t> pc_tunnel;
+  grid<character *> character_map;
+  /* Monsters bucketed by position; see spatial.h.  SPATIAL_Y rows of *
+   * SPATIAL_X.                                                       */
+  grid<std::vector<character *> > spatial;
+  grid<object *> objmap;
   pc *PC;
   heap_t events;
+  /* --dormant: the events of the monsters asleep, off the queue.  They *
+   * go with the dungeon, like the queue does.                          */
+  std::vector<event *> sleeping;
   uint32_t boss_alive;
   uint16_t num_monsters;
   uint16_t max_monsters;
@@ -94,12 +134,33 @@ class dungeon {
    * convenience, e.g., the ability to create a new event without explicit *
    * information from the current event.                                   */
   uint32_t time;
+  /* Zobrist hash of the map, the characters and the objects on it.  See *
+   * zobrist.h for who has to keep it up to date.                        */
+  uint64_t hash;
   uint32_t is_new;
   uint32_t quit;
+  /* Set for headless runs: pc_next_pos() plays the PC, and nothing is *
+   * drawn or read from the terminal.  See move_pc_autopilot().        */
+  uint32_t autopilot;
+  /* --lod: monsters far from the PC take cheap, infrequent turns.  See *
+   * npc_lod_turn().                                                    */
+  uint32_t lod;
+  /* --dormant: monsters that don't know about the PC and are out of   *
+   * earshot sleep outside of the event queue, in sleeping.  See         *
+   * npc_dormant_turn().                                                 */
+  uint32_t dormant;
+  /* --flow: smart monsters chase where they last saw the PC along a  *
+   * cached flow field, rather than in a straight line.  See flow.h.  */
+  uint32_t flow;
   std::vector<monster_description> monster_descriptions;
   std::vector<object_description> object_descriptions;
 };
 
+extern int16_t dungeon_x, dungeon_y;
+
+/* Returns nonzero if the size is out of range.  Takes effect at the next *
+ * init_dungeon().                                                        */
+int set_dungeon_size(int32_t x, int32_t y);
 void init_dungeon(dungeon *d);
 void new_dungeon(dungeon *d);
 void delete_dungeon(dungeon *d);
@@ -107,6 +168,8 @@ int gen_dungeon(dungeon *d);
 void render_dungeon(dungeon *d);
 int write_dungeon(dungeon *d, char *file);
 int read_dungeon(dungeon *d, char *file);
+int write_dungeon_to(dungeon *d, FILE *f);
+int read_dungeon_from(dungeon *d, FILE *f, uint32_t size);
 int read_pgm(dungeon *d, char *pgm);
 void render_distance_map(dungeon *d);
 void render_tunnel_distance_map(dungeon *d);
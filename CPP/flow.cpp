@@ -0,0 +1,178 @@
+#include <vector>
+
+#include "flow.h"
+#include "dungeon.h"
+#include "path.h"
+#include "bitboard.h"
+#include "profile.h"
+
+typedef struct flow_entry {
+  pair_t goal;
+  flow_movement_t movement;
+  /* bitboard_rebuilds() when distance was worked out */
+  uint32_t rebuilds;
+  /* flow_clock when last used, or 0 if there's nothing here */
+  uint32_t used;
+  grid<uint16_t> distance;
+} flow_entry_t;
+
+static flow_entry_t flow_cache[FLOW_CACHE_SIZE];
+static uint32_t flow_clock;
+
+/* Whether a monster moving by m can be in the cell at all */
+static inline uint32_t flow_open(dungeon *d, flow_movement_t m,
+                                 int32_t x, int32_t y)
+{
+  return m == flow_walk ? passablexy(x, y) : mapxy(x, y) != ter_wall_immutable;
+}
+
+/* What it costs to step out of (x, y), which was distance away */
+static inline uint16_t flow_step(dungeon *d, flow_movement_t m,
+                                 uint16_t distance, int32_t x, int32_t y)
+{
+  return (m == flow_tunnel ? path_tunnel_cost(d)(x, y, distance) :
+                             path_walk_cost()(x, y, distance));
+}
+
+/* The same searches as dijkstra() and dijkstra_tunnel(), from goal.  The *
+ * scratch space is per thread, so --threads can build maps side by side. */
+void flow_build(dungeon *d, pair_t goal, flow_movement_t m,
+                grid<uint16_t> &distance)
+{
+  PROFILE_SCOPE("flow_build");
+  static thread_local grid<dijkstra_cell_t> cells;
+  dijkstra_distance out;
+  pair_t lo, hi;
+
+  if (m == flow_walk) {
+    bitboard_distance(d->passable, goal, distance);
+    return;
+  }
+
+  dijkstra_cells_init(cells);
+  distance.resize(DUNGEON_X, DUNGEON_Y);
+  lo[dim_x] = lo[dim_y] = 0;
+  hi[dim_x] = DUNGEON_X - 1;
+  hi[dim_y] = DUNGEON_Y - 1;
+
+  switch (m) {
+  case flow_tunnel:
+    dijkstra_search<dijkstra_8way>(cells, distance, lo, hi, goal, NULL,
+                                   path_diggable(d), path_tunnel_cost(d),
+                                   out);
+    break;
+  case flow_pass:
+  default:
+    dijkstra_search<dijkstra_8way>(cells, distance, lo, hi, goal, NULL,
+                                   path_diggable(d), path_walk_cost(), out);
+    break;
+  }
+}
+
+const grid<uint16_t> *flow_find(pair_t goal, flow_movement_t m)
+{
+  flow_entry_t *f;
+  uint32_t i;
+
+  for (f = flow_cache, i = 0; i < FLOW_CACHE_SIZE; i++, f++) {
+    if (f->used && f->rebuilds == bitboard_rebuilds() && f->movement == m &&
+        f->goal[dim_x] == goal[dim_x] && f->goal[dim_y] == goal[dim_y]) {
+      return &f->distance;
+    }
+  }
+
+  return NULL;
+}
+
+void flow_use(dungeon *d, pair_t goal, flow_movement_t m,
+              grid<uint16_t> *built)
+{
+  flow_entry_t *f, *lru;
+  uint32_t i;
+
+  flow_clock++;
+  for (lru = f = flow_cache, i = 0; i < FLOW_CACHE_SIZE; i++, f++) {
+    if (f->rebuilds != bitboard_rebuilds()) {
+      /* From another map, so the first to go */
+      f->used = 0;
+    }
+    if (f->used && f->movement == m &&
+        f->goal[dim_x] == goal[dim_x] && f->goal[dim_y] == goal[dim_y]) {
+      f->used = flow_clock;
+      return;
+    }
+    if (f->used < lru->used) {
+      lru = f;
+    }
+  }
+
+  lru->goal[dim_x] = goal[dim_x];
+  lru->goal[dim_y] = goal[dim_y];
+  lru->movement = m;
+  lru->rebuilds = bitboard_rebuilds();
+  lru->used = flow_clock;
+  if (built) {
+    lru->distance.swap(*built);
+  } else {
+    flow_build(d, goal, m, lru->distance);
+  }
+}
+
+/* Digging only ever makes things shorter, so the old distances are all *
+ * still upper bounds, and relaxing outwards from the dig, cell by cell *
+ * until nothing gets any shorter, comes out where a new search would.  *
+ * Usually that's a handful of cells rather than the whole map.         */
+static void flow_repair(dungeon *d, flow_entry_t *f, pair_t p)
+{
+  static std::vector<uint32_t> queue;
+  uint32_t head;
+  int32_t x, y, dx, dy;
+  uint16_t next;
+
+  queue.clear();
+  /* Whatever's around p may now get into it more cheaply, or at all, *
+   * and p may now be cheaper to get out of.                          */
+  for (dy = -1; dy <= 1; dy++) {
+    for (dx = -1; dx <= 1; dx++) {
+      queue.push_back(((p[dim_y] + dy) << 16) | (p[dim_x] + dx));
+    }
+  }
+
+  for (head = 0; head < queue.size(); head++) {
+    y = queue[head] >> 16;
+    x = queue[head] & 0xffff;
+    if (f->distance[y][x] == DISTANCE_UNREACHABLE ||
+        !flow_open(d, f->movement, x, y)) {
+      continue;
+    }
+    next = flow_step(d, f->movement, f->distance[y][x], x, y);
+    for (dy = -1; dy <= 1; dy++) {
+      for (dx = -1; dx <= 1; dx++) {
+        if (f->distance[y + dy][x + dx] > next &&
+            flow_open(d, f->movement, x + dx, y + dy)) {
+          f->distance[y + dy][x + dx] = next;
+          queue.push_back(((y + dy) << 16) | (x + dx));
+        }
+      }
+    }
+  }
+}
+
+void flow_dig(dungeon *d, pair_t p, uint32_t through)
+{
+  PROFILE_SCOPE("flow_dig");
+  flow_entry_t *f;
+  uint32_t i;
+
+  for (f = flow_cache, i = 0; i < FLOW_CACHE_SIZE; i++, f++) {
+    if (!f->used || f->rebuilds != bitboard_rebuilds()) {
+      continue;
+    }
+    /* Walking only cares once the cell is open, and passing through *
+     * walls doesn't care about rock at all.                         */
+    if (f->movement == flow_tunnel ||
+        (f->movement == flow_walk && through)) {
+      flow_repair(d, f, p);
+    }
+  }
+}
@@ -0,0 +1,51 @@
+#ifndef FLOW_H
+# define FLOW_H
+
+# include <stdint.h>
+
+# include "dims.h"
+# include "grid.h"
+
+class dungeon;
+
+/* --flow: distance maps like pc_distance and pc_tunnel, but to any goal *
+ * cell, for monsters chasing somewhere the PC used to be.  Each one is  *
+ * worked out on demand and kept in a small cache, least recently used   *
+ * out first, so every monster heading for the same place shares one     *
+ * search.  Digging doesn't throw the maps away: flow_dig() repairs the  *
+ * ones it touches around the cell that was dug at, so they always come  *
+ * out just as a new search would.  They're only emptied when the map is *
+ * replaced, which bitboard_rebuilds() tells us.                         *
+ *                                                                       *
+ * Looking a map up and building one only read the game, so they can be  *
+ * done from any thread while --threads is deciding what monsters will   *
+ * do.  Only flow_use() and flow_dig() change the cache, and they're     *
+ * called as turns are taken, one at a time.                             */
+
+# define FLOW_CACHE_SIZE 8
+
+typedef enum flow_movement {
+  flow_walk,   /* Floor only, one a step, like pc_distance              */
+  flow_tunnel, /* Anything but immutable walls, digging, like pc_tunnel */
+  flow_pass,   /* Anything but immutable walls, one a step              */
+  num_flow_movements
+} flow_movement_t;
+
+/* The cached distances to goal for m, DISTANCE_UNREACHABLE where it *
+ * can't be reached, or NULL if there's no such map yet.  Good until *
+ * the next flow_use() or flow_dig().                                */
+const grid<uint16_t> *flow_find(pair_t goal, flow_movement_t m);
+/* Works out the map flow_find() didn't have into distance. */
+void flow_build(dungeon *d, pair_t goal, flow_movement_t m,
+                grid<uint16_t> &distance);
+/* Marks the map for goal and m as just used, putting it in the cache if *
+ * it isn't there.  built is what flow_build() made of it, if anything,  *
+ * and is traded for whatever the cache throws out; without it, the map  *
+ * is built here.                                                        */
+void flow_use(dungeon *d, pair_t goal, flow_movement_t m,
+              grid<uint16_t> *built);
+/* Repairs the cached maps after a monster has dug at p, through if it *
+ * dug the cell out altogether.                                        */
+void flow_dig(dungeon *d, pair_t p, uint32_t through);
+
+#endif
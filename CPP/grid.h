@@ -0,0 +1,86 @@
+#ifndef GRID_H
+# define GRID_H
+
+# include <stdint.h>
+# include <stddef.h>
+# include <algorithm>
+
+/* A two-dimensional array whose size isn't known until run time.  The  *
+ * cells are one contiguous block in row-major order, so the stride     *
+ * from a row to the next is the width, and g[y] points at the start of *
+ * row y; g[y][x] reads just as it did when these were fixed arrays.    *
+ * Nothing is bounds checked.                                           */
+template <typename T>
+class grid {
+ private:
+  T *cells;
+  int32_t w, h;
+  /* Far too big to copy by accident */
+  grid(const grid &);
+  grid &operator=(const grid &);
+ public:
+  grid() : cells(0), w(0), h(0) {}
+  /* Moving is cheap, though, and lets a grid live in a std::vector */
+  grid(grid &&g) noexcept : cells(g.cells), w(g.w), h(g.h)
+  {
+    g.cells = 0;
+    g.w = g.h = 0;
+  }
+  ~grid()
+  {
+    delete [] cells;
+  }
+  /* Does nothing if the size hasn't changed.  Otherwise the old contents *
+   * are gone, and every cell is value-initialized (zero, for numbers and *
+   * pointers).                                                           */
+  void resize(int32_t width, int32_t height)
+  {
+    if (width != w || height != h) {
+      delete [] cells;
+      w = width;
+      h = height;
+      cells = new T[(size_t) w * h]();
+    }
+  }
+  /* Trades contents with g, copying nothing */
+  void swap(grid &g)
+  {
+    std::swap(cells, g.cells);
+    std::swap(w, g.w);
+    std::swap(h, g.h);
+  }
+  void fill(const T &v)
+  {
+    size_t i, n;
+
+    for (i = 0, n = size(); i < n; i++) {
+      cells[i] = v;
+    }
+  }
+  inline T *operator[](int32_t y)
+  {
+    return cells + (size_t) y * w;
+  }
+  inline const T *operator[](int32_t y) const
+  {
+    return cells + (size_t) y * w;
+  }
+  inline T *data()
+  {
+    return cells;
+  }
+  inline int32_t width() const
+  {
+    return w;
+  }
+  inline int32_t height() const
+  {
+    return h;
+  }
+  inline size_t size() const
+  {
+    return (size_t) w * h;
+  }
+};
+
+#endif
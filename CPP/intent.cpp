@@ -0,0 +1,200 @@
+#include <pthread.h>
+#include <semaphore.h>
+#include <atomic>
+#include <vector>
+
+#include "intent.h"
+#include "dungeon.h"
+#include "event.h"
+#include "npc.h"
+#include "pc.h"
+#include "bitboard.h"
+#include "profile.h"
+
+#define INTENT_MAX_THREADS 64
+/* Fewer monsters than this at once aren't worth waking anyone up for. */
+#define INTENT_MIN_BATCH   16
+
+/* What a monster in the batch decided, if it did, and where it was */
+typedef struct intent_slot {
+  npc_intent_t intent;
+  uint32_t decided;
+  pair_t from;
+} intent_slot_t;
+
+static uint32_t intent_threads;
+static pthread_t intent_worker[INTENT_MAX_THREADS];
+static sem_t intent_wake, intent_done;
+static std::atomic<uint32_t> intent_quit(0);
+/* The next monster in the batch nobody has started on yet */
+static std::atomic<uint32_t> intent_claim(0);
+
+/* The monsters due now, in queue order, what they decided, and the   *
+ * next to hand out.  The decisions went by the cells dug out and dug *
+ * at before the batch: bitboard_changes() and npc_digs() then.       */
+static std::vector<event *> intent_batch;
+static std::vector<intent_slot_t> intent_slot;
+static uint32_t intent_batch_next;
+static uint32_t intent_batch_changes;
+static uint32_t intent_batch_digs;
+static dungeon *intent_dungeon;
+/* A decision made on the spot */
+static npc_intent_t intent_now;
+
+static void intent_think(dungeon *d, uint32_t k)
+{
+  npc *n = (npc *) intent_batch[k]->c;
+  intent_slot_t *s = &intent_slot[k];
+
+  /* The dead are only cleared away, and a monster simulated coarsely *
+   * takes its turn another way, unless it's close by now.            */
+  s->decided = n->alive && !n->lod_event;
+  if (s->decided) {
+    s->from[dim_x] = n->position[dim_x];
+    s->from[dim_y] = n->position[dim_y];
+    npc_next_pos(d, n, &s->intent);
+  }
+}
+
+static void intent_think_all(void)
+{
+  uint32_t k;
+
+  while ((k = intent_claim++) < intent_batch.size()) {
+    intent_think(intent_dungeon, k);
+  }
+}
+
+static void *intent_work(void *unused)
+{
+  PROFILE_HELPER_THREAD();
+  for (;;) {
+    sem_wait(&intent_wake);
+    if (intent_quit) {
+      break;
+    }
+    {
+      PROFILE_THREAD_SCOPE("intents", PROFILE_THREAD_INTENT);
+      intent_think_all();
+    }
+    sem_post(&intent_done);
+  }
+
+  return NULL;
+}
+
+void intent_start(uint32_t threads)
+{
+  uint32_t i;
+
+  if (threads > INTENT_MAX_THREADS) {
+    threads = INTENT_MAX_THREADS;
+  }
+
+  intent_threads = threads;
+  intent_quit = 0;
+  sem_init(&intent_wake, 0, 0);
+  sem_init(&intent_done, 0, 0);
+  for (i = 1; i < intent_threads; i++) {
+    pthread_create(&intent_worker[i], NULL, intent_work, NULL);
+  }
+}
+
+void intent_stop(void)
+{
+  uint32_t i;
+
+  if (!intent_threads) {
+    return;
+  }
+
+  intent_quit = 1;
+  for (i = 1; i < intent_threads; i++) {
+    sem_post(&intent_wake);
+  }
+  for (i = 1; i < intent_threads; i++) {
+    pthread_join(intent_worker[i], NULL);
+  }
+  sem_destroy(&intent_wake);
+  sem_destroy(&intent_done);
+  intent_threads = 0;
+}
+
+/* Takes everything due at the time of the first event in the queue, up *
+ * to the PC's turn, and decides what they'll do.                       */
+static void intent_take_batch(dungeon *d)
+{
+  PROFILE_SCOPE("intent batch");
+  event *e;
+  uint32_t i, helpers;
+
+  intent_batch.clear();
+  intent_batch_next = 0;
+  while ((e = (event *) heap_peek_min(&d->events)) && e->c != d->PC &&
+         (intent_batch.empty() || e->time == intent_batch[0]->time)) {
+    intent_batch.push_back((event *) heap_remove_min(&d->events));
+  }
+  if (intent_slot.size() < intent_batch.size()) {
+    intent_slot.resize(intent_batch.size());
+  }
+
+  intent_batch_changes = bitboard_changes();
+  intent_batch_digs = npc_digs();
+  intent_dungeon = d;
+  intent_claim = 0;
+  PROFILE_COUNTER("intent batch size", intent_batch.size());
+
+  helpers = intent_batch.size() < INTENT_MIN_BATCH ? 0 : intent_threads - 1;
+  for (i = 0; i < helpers; i++) {
+    sem_post(&intent_wake);
+  }
+  intent_think_all();
+  for (i = 0; i < helpers; i++) {
+    sem_wait(&intent_done);
+  }
+}
+
+event *intent_next(dungeon *d)
+{
+  if (!intent_threads) {
+    return (event *) heap_remove_min(&d->events);
+  }
+
+  if (intent_batch_next == intent_batch.size()) {
+    intent_take_batch(d);
+    if (intent_batch.empty()) {
+      /* The PC's turn, or nothing at all */
+      return (event *) heap_remove_min(&d->events);
+    }
+  }
+
+  return intent_batch[intent_batch_next++];
+}
+
+void intent_flush(dungeon *d)
+{
+  while (intent_batch_next < intent_batch.size()) {
+    heap_insert(&d->events, intent_batch[intent_batch_next++]);
+  }
+}
+
+npc_intent_t *intent_get(dungeon *d, npc *n)
+{
+  intent_slot_t *s;
+
+  if (intent_threads) {
+    s = &intent_slot[intent_batch_next - 1];
+    if (s->decided &&
+        s->from[dim_x] == n->position[dim_x] &&
+        s->from[dim_y] == n->position[dim_y] &&
+        ((n->characteristics & NPC_TUNNEL)         ?
+         intent_batch_digs == npc_digs()           :
+         intent_batch_changes == bitboard_changes())) {
+      return &s->intent;
+    }
+  }
+
+  npc_next_pos(d, n, &intent_now);
+
+  return &intent_now;
+}
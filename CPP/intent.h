@@ -0,0 +1,41 @@
+#ifndef INTENT_H
+# define INTENT_H
+
+# include <stdint.h>
+
+# include "npc.h"
+
+class dungeon;
+struct event;
+
+/* --threads: monster turns in two phases.  Every monster due at the     *
+ * same time is taken off the queue at once, and the threads decide,     *
+ * side by side, what each one will do with its turn: npc_next_pos(),    *
+ * which only reads the game and writes down where the monster is going, *
+ * what it dug at and what it now knows.  Then the turns are taken one   *
+ * at a time, in queue order, exactly as they always were: npc_commit()  *
+ * carries the decision out, and move_character() settles who ends up    *
+ * where, collisions and displacements included.  A turn taken earlier   *
+ * in the batch can change what a later monster would have decided, by   *
+ * digging out a cell, or digging at all for a tunneler, who goes by     *
+ * hardness, or by shoving it somewhere else.  Its decision is then      *
+ * thrown away and made again on the spot.  Monsters draw random numbers *
+ * from streams of their own, so a decision comes out the same whenever  *
+ * it's made, and games come out the same, turn for turn, however many   *
+ * threads there are.                                                    */
+
+/* threads counts the caller; 1 takes turns in batches with no helpers. */
+void intent_start(uint32_t threads);
+void intent_stop(void);
+/* In place of heap_remove_min(&d->events) in do_moves(); hands out *
+ * the same events in the same order.                               */
+event *intent_next(dungeon *d);
+/* Puts back anything taken off the queue but not handed out yet, for  *
+ * when do_moves() stops early because the PC died.                    */
+void intent_flush(dungeon *d);
+/* What n, whose turn intent_next() just handed out, is going to do: *
+ * what the batch decided, if that still holds, or else what it      *
+ * decides now.  Good until the next call.                           */
+npc_intent_t *intent_get(dungeon *d, npc *n);
+
+#endif
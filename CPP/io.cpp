@@ -5,6 +5,12 @@
 #include <stdio.h>
 #include <string>
 #include <sstream>
+#include <atomic>
+#include <pthread.h>
+#include <semaphore.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
 
 #include "io.h"
 #include "move.h"
@@ -14,20 +20,166 @@
 #include "dungeon.h"
 #include "object.h"
 #include "npc.h"
+#include "spatial.h"
+#include "ansi.h"
+#include "replay.h"
+#include "zobrist.h"
+#include "profile.h"
 
 /* Same ugly hack we did in path.c */
 static dungeon *thedungeon;
 
+typedef enum io_message_type {
+  io_message_text,
+  /* Makes the message before it wait for a key, even if it's the last. */
+  io_message_pause
+} io_message_type_t;
+
 typedef struct io_message {
+  io_message_type_t type;
   /* Will print " --more-- " at end of line when another message follows. *
    * Leave 10 extra spaces for that.                                      */
   char msg[71];
-  struct io_message *next;
 } io_message_t;
 
-static io_message_t *io_head, *io_tail;
+/* Messages are formatted straight into a ring, so queueing one doesn't *
+ * allocate anything.  io_message_head and io_message_tail count        *
+ * messages printed and queued; they only ever go up, and are taken     *
+ * modulo IO_MESSAGES to index the ring.  Slots behind the head are     *
+ * kept as scrollback until the tail comes around and reuses them.      */
+#define IO_MESSAGES 256
+
+static io_message_t io_message[IO_MESSAGES];
+static uint32_t io_message_head, io_message_tail;
+
+/* Everything that used to draw straight to stdscr now draws into        *
+ * io_back, a shadow of the whole terminal, through the io_ versions of  *
+ * the curses calls below.  io_refresh() compares it with io_front, the  *
+ * frame the terminal is actually showing, and hands curses only the     *
+ * runs of cells that changed.  We used to clear() and repaint all 1920  *
+ * cells every turn, which is a lot of bytes over a slow link for a      *
+ * screen where typically a handful of cells change.                     */
+#define IO_ROWS 24
+#define IO_COLS 80
+
+static chtype io_back[IO_ROWS][IO_COLS];
+static chtype io_front[IO_ROWS][IO_COLS];
+static attr_t io_pen;
+/* Counts redraws, so that multi-colored characters can cycle through   *
+ * their colors without pulling numbers from the game's rand() stream.  */
+static uint32_t io_frame;
+/* How often to redraw while something on screen is cycling colors. *
+ * When nothing is, we block on input and don't redraw at all.       */
+#define IO_ANIMATION_MS 125
+
+static inline void io_attron(attr_t a)
+{
+  io_pen |= a;
+}
+
+static inline void io_attroff(attr_t a)
+{
+  io_pen &= ~a;
+}
+
+static inline void io_mvaddch(int16_t y, int16_t x, char c)
+{
+  if (y >= 0 && y < IO_ROWS && x >= 0 && x < IO_COLS) {
+    io_back[y][x] = (unsigned char) c | io_pen;
+  }
+}
+
+/* The map is drawn from screen row 1 down through row IO_MAP_ROWS, and *
+ * when the dungeon is bigger than that, what's drawn is the part of it *
+ * starting at io_view, which io_view_follow() keeps around the PC (or  *
+ * the cursor).  The dungeon is never smaller than the view, so the     *
+ * view is always full; a default-sized one fits exactly and never      *
+ * scrolls.                                                              */
+#define IO_MAP_ROWS 21
+#define IO_MAP_COLS IO_COLS
+/* How close to the edge of the view something can get before it scrolls */
+#define IO_VIEW_MARGIN_X 16
+#define IO_VIEW_MARGIN_Y 5
+
+static pair_t io_view;
+
+/* Scrolls one axis so that c is at least margin in from the edges of a *
+ * window size wide, without showing anything off the end of the map.  */
+static int16_t io_view_axis(int16_t v, int16_t c, int16_t margin,
+                            int16_t size, int16_t extent)
+{
+  if (c < v + margin) {
+    v = c - margin;
+  } else if (c >= v + size - margin) {
+    v = c - size + margin + 1;
+  }
+  if (v > extent - size) {
+    v = extent - size;
+  }
+
+  return v < 0 ? 0 : v;
+}
+
+/* Returns nonzero if the view moved, in which case the whole map needs *
+ * to be drawn again.                                                   */
+static uint32_t io_view_follow(pair_t p)
+{
+  pair_t old;
+
+  old[dim_x] = io_view[dim_x];
+  old[dim_y] = io_view[dim_y];
+  io_view[dim_x] = io_view_axis(io_view[dim_x], p[dim_x], IO_VIEW_MARGIN_X,
+                                IO_MAP_COLS, DUNGEON_X);
+  io_view[dim_y] = io_view_axis(io_view[dim_y], p[dim_y], IO_VIEW_MARGIN_Y,
+                                IO_MAP_ROWS, DUNGEON_Y);
+
+  return old[dim_x] != io_view[dim_x] || old[dim_y] != io_view[dim_y];
+}
+
+void io_shift_view(int16_t x, int16_t y)
+{
+  io_view[dim_x] -= x;
+  io_view[dim_y] -= y;
+}
+
+/* Draws c at map position (x, y), if that's in view. */
+static inline void io_map_addch(int16_t y, int16_t x, char c)
+{
+  y -= io_view[dim_y];
+  x -= io_view[dim_x];
+  if (y >= 0 && y < IO_MAP_ROWS && x >= 0 && x < IO_MAP_COLS) {
+    io_mvaddch(y + 1, x, c);
+  }
+}
+
+/* Unlike mvprintw(), long strings are clipped at the edge, not wrapped. */
+static void io_mvprintw(int16_t y, int16_t x, const char *format, ...)
+{
+  char s[IO_COLS + 1];
+  va_list ap;
+  uint32_t i;
+
+  va_start(ap, format);
+  vsnprintf(s, sizeof (s), format, ap);
+  va_end(ap);
+
+  for (i = 0; s[i]; i++) {
+    io_mvaddch(y, x + i, s[i]);
+  }
+}
+
+static void io_erase(void)
+{
+  uint32_t y, x;
+
+  for (y = 0; y < IO_ROWS; y++) {
+    for (x = 0; x < IO_COLS; x++) {
+      io_back[y][x] = ' ';
+    }
+  }
+}
 
-void io_init_terminal(void)
+static void io_curses_init(void)
 {
   initscr();
   raw();
@@ -44,98 +196,511 @@ void io_init_terminal(void)
   init_pair(COLOR_WHITE, COLOR_WHITE, COLOR_BLACK);
 }
 
-void io_reset_terminal(void)
+static void io_curses_reset(void)
 {
   endwin();
+}
 
-  while (io_head) {
-    io_tail = io_head;
-    io_head = io_head->next;
-    free(io_tail);
+static void io_curses_put_run(int16_t y, int16_t x,
+                              const chtype *run, uint32_t n)
+{
+  chtype s[IO_COLS];
+  uint32_t i;
+
+  /* Line drawing is stored as the VT100 character for the line (see *
+   * io_box()), which curses wants translated for the terminal.       */
+  for (i = 0; i < n; i++) {
+    s[i] = ((run[i] & A_ALTCHARSET)                             ?
+            (NCURSES_ACS(run[i] & A_CHARTEXT) |
+             (run[i] & (A_ATTRIBUTES & ~A_ALTCHARSET)))          :
+            run[i]);
   }
-  io_tail = NULL;
+
+  /* Each cell carries its own attributes, so curses only changes *
+   * them where they actually differ within the run.              */
+  mvaddchnstr(y, x, s, n);
 }
 
-void io_queue_message(const char *format, ...)
+static void io_curses_flush(void)
 {
-  io_message_t *tmp;
-  va_list ap;
+  refresh();
+}
+
+/* Curses reads a byte at a time, so anything typed ahead is still *
+ * waiting on stdin.                                                */
+static int io_curses_key_pending(void)
+{
+  struct pollfd p;
+
+  p.fd = STDIN_FILENO;
+  p.events = POLLIN;
+
+  return poll(&p, 1, 0) > 0;
+}
+
+static int io_curses_getch(int ms)
+{
+  timeout(ms);
+
+  return getch();
+}
+
+/* Output for --replay, which has no terminal */
+static void io_null_init(void)
+{
+}
+
+static void io_null_put_run(int16_t y, int16_t x, const chtype *run, uint32_t n)
+{
+}
+
+static void io_null_flush(void)
+{
+}
+
+/* Where the framebuffer goes once the render thread has worked out     *
+ * what changed.  put_run() is handed each run of changed cells in a    *
+ * row, then flush() once per frame.  get_key() waits up to ms          *
+ * milliseconds (forever if ms is negative) and returns ERR if no key   *
+ * came.  key_pending() says whether a key is already waiting.  If      *
+ * get_key() touches the screen itself, as curses' getch() does,        *
+ * key_draws is set and we let the render thread finish first.  A       *
+ * headless backend has nothing to draw on, so we don't start the       *
+ * render thread or publish frames at all.                              */
+typedef struct io_backend {
+  void (*init)(void);
+  void (*reset)(void);
+  void (*put_run)(int16_t y, int16_t x, const chtype *run, uint32_t n);
+  void (*flush)(void);
+  int (*get_key)(int ms);
+  int (*key_pending)(void);
+  uint32_t key_draws;
+  uint32_t headless;
+} io_backend_t;
+
+static const io_backend_t io_backends[] = {
+  /* io_backend_curses */
+  {
+    io_curses_init,
+    io_curses_reset,
+    io_curses_put_run,
+    io_curses_flush,
+    io_curses_getch,
+    io_curses_key_pending,
+    1,
+    0
+  },
+  /* io_backend_ansi */
+  {
+    ansi_init,
+    ansi_reset,
+    ansi_put_run,
+    ansi_flush,
+    ansi_getch,
+    ansi_key_pending,
+    0,
+    0
+  },
+  /* io_backend_replay */
+  {
+    io_null_init,
+    io_null_init,
+    io_null_put_run,
+    io_null_flush,
+    replay_getch,
+    replay_key_pending,
+    0,
+    1
+  }
+};
+
+static const io_backend_t *io_backend = &io_backends[io_backend_curses];
+
+/* Terminal output happens on its own thread, so that a slow terminal   *
+ * never holds up the game.  io_refresh() copies io_back into a         *
+ * snapshot and publishes it; the render thread takes the newest        *
+ * snapshot and sends the cells that differ from io_front.  Snapshots   *
+ * go through a triple buffer: the game fills one, the render thread    *
+ * draws one, and the third holds whatever was published last.  Each    *
+ * side swaps its own for the third with one atomic exchange, so        *
+ * neither ever waits on the other.  If the game publishes faster than  *
+ * the terminal keeps up, frames in between are overwritten and never   *
+ * drawn.                                                               */
+typedef struct io_snapshot {
+  uint32_t seq;
+  chtype cell[IO_ROWS][IO_COLS];
+} io_snapshot_t;
+
+/* Set in io_snapshot_middle while it holds a snapshot not yet drawn. */
+#define IO_SNAPSHOT_FRESH 4
+
+static io_snapshot_t io_snapshot[3];
+static uint32_t io_snapshot_write = 0, io_snapshot_read = 1;
+static std::atomic<uint32_t> io_snapshot_middle(2);
+/* Sequence numbers of the last snapshot published and the last drawn. */
+static uint32_t io_snapshot_seq;
+static std::atomic<uint32_t> io_snapshot_drawn(0);
+static std::atomic<uint32_t> io_render_quit(0);
+static sem_t io_render_wake, io_render_done;
+static pthread_t io_render_thread;
+/* Most often we draw a frame while keys are typed ahead. */
+#define IO_TYPEAHEAD_MS 50
+static int64_t io_published_ms;
+
+static void io_render_snapshot(const io_snapshot_t *snap)
+{
+  uint32_t y, x, run;
+
+  for (y = 0; y < IO_ROWS; y++) {
+    for (x = 0; x < IO_COLS; x += run) {
+      for (run = 0;
+           x + run < IO_COLS && snap->cell[y][x + run] != io_front[y][x + run];
+           run++) {
+        io_front[y][x + run] = snap->cell[y][x + run];
+      }
+      if (run) {
+        io_backend->put_run(y, x, snap->cell[y] + x, run);
+      } else {
+        run = 1;
+      }
+    }
+  }
+
+  io_backend->flush();
+}
+
+static void *io_render(void *unused)
+{
+  while (!io_render_quit) {
+    sem_wait(&io_render_wake);
+    if (io_snapshot_middle & IO_SNAPSHOT_FRESH) {
+      io_snapshot_read = (io_snapshot_middle.exchange(io_snapshot_read) &
+                          ~IO_SNAPSHOT_FRESH);
+      {
+        PROFILE_THREAD_SCOPE("terminal output", PROFILE_THREAD_RENDER);
+        io_render_snapshot(&io_snapshot[io_snapshot_read]);
+      }
+      io_snapshot_drawn = io_snapshot[io_snapshot_read].seq;
+      sem_post(&io_render_done);
+    }
+  }
+
+  return NULL;
+}
+
+/* Waits until the last published snapshot is on the terminal. */
+static void io_render_sync(void)
+{
+  while (io_snapshot_drawn != io_snapshot_seq) {
+    if (sem_wait(&io_render_done) && errno != EINTR) {
+      break;
+    }
+  }
+}
+
+static int64_t io_now_ms(void)
+{
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  return now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+static void io_publish(void)
+{
+  io_snapshot_t *snap = &io_snapshot[io_snapshot_write];
+
+  if (io_backend->headless) {
+    return;
+  }
+
+  io_published_ms = io_now_ms();
+
+  memcpy(snap->cell, io_back, sizeof (snap->cell));
+  snap->seq = ++io_snapshot_seq;
+  io_snapshot_write = (io_snapshot_middle.exchange(io_snapshot_write |
+                                                   IO_SNAPSHOT_FRESH) &
+                       ~IO_SNAPSHOT_FRESH);
+  sem_post(&io_render_wake);
+}
+
+/* When the player holds down a key, the terminal gets a queue of keys  *
+ * ahead of us.  Every frame we'd draw for those is stale the moment we *
+ * read the next key, and over a slow link sending them all leaves the  *
+ * screen seconds behind the game.  So while keys are waiting, we don't *
+ * publish, except to let one frame out every IO_TYPEAHEAD_MS so the    *
+ * player can see where they're going.  io_back always holds the whole  *
+ * current screen, so whenever the keys run out, the next refresh shows *
+ * everything.                                                          */
+static void io_refresh(void)
+{
+  if (io_backend->key_pending() &&
+      io_now_ms() - io_published_ms < IO_TYPEAHEAD_MS) {
+    return;
+  }
+
+  io_publish();
+}
+
+/* Like getch() on stdscr with timeout(ms), which refreshes it first. */
+static int io_getch_timeout(int ms)
+{
+  /* Keeps the time spent waiting on the player out of whatever called *
+   * us, do_moves() in particular.                                     */
+  PROFILE_SCOPE("input wait");
+
+  int key;
+
+  io_refresh();
+  if (io_backend->key_draws) {
+    io_render_sync();
+  }
+
+  if ((key = io_backend->get_key(ms)) != ERR) {
+    replay_key(key);
+  }
+
+  return key;
+}
+
+static int io_getch(void)
+{
+  return io_getch_timeout(-1);
+}
+
+/* Blanks a rectangle and draws a box around its edge, with an optional *
+ * title in the top border; this is what we have instead of curses      *
+ * windows, so that it works the same with any backend.  Lines are      *
+ * stored as their VT100 line-drawing characters with A_ALTCHARSET.     */
+static void io_box(int16_t y, int16_t x, int16_t h, int16_t w,
+                   const char *title)
+{
+  int16_t i, j;
+
+  for (i = 0; i < h; i++) {
+    for (j = 0; j < w; j++) {
+      io_mvaddch(y + i, x + j, ' ');
+    }
+  }
+
+  io_attron(A_ALTCHARSET);
+  for (j = 1; j < w - 1; j++) {
+    io_mvaddch(y, x + j, 'q');
+    io_mvaddch(y + h - 1, x + j, 'q');
+  }
+  for (i = 1; i < h - 1; i++) {
+    io_mvaddch(y + i, x, 'x');
+    io_mvaddch(y + i, x + w - 1, 'x');
+  }
+  io_mvaddch(y, x, 'l');
+  io_mvaddch(y, x + w - 1, 'k');
+  io_mvaddch(y + h - 1, x, 'm');
+  io_mvaddch(y + h - 1, x + w - 1, 'j');
+  io_attroff(A_ALTCHARSET);
+
+  if (title) {
+    io_mvprintw(y, x + 1, "%s", title);
+  }
+}
+
+static char io_terrain_glyph(terrain_type t)
+{
+  switch (t) {
+  case ter_wall:
+  case ter_wall_immutable:
+  case ter_unknown:
+    return ' ';
+  case ter_floor:
+  case ter_floor_room:
+    return '.';
+  case ter_floor_hall:
+    return '#';
+  case ter_debug:
+    return '*';
+  case ter_stairs_up:
+    return '<';
+  case ter_stairs_down:
+    return '>';
+  default:
+    /* Use zero as an error symbol, since it stands out somewhat, and it's *
+     * not otherwise used.                                                 */
+    return '0';
+  }
+}
+
+void io_init_terminal(io_backend_type_t backend)
+{
+  io_backend = &io_backends[backend];
+  io_backend->init();
+  /* Both backends start from a cleared screen. */
+  io_erase();
+  memcpy(io_front, io_back, sizeof (io_front));
+
+  if (io_backend->headless) {
+    return;
+  }
+
+  sem_init(&io_render_wake, 0, 0);
+  sem_init(&io_render_done, 0, 0);
+  pthread_create(&io_render_thread, NULL, io_render, NULL);
+}
+
+void io_reset_terminal(void)
+{
+  if (io_backend->headless) {
+    return;
+  }
 
-  if (!(tmp = (io_message_t *) malloc(sizeof (*tmp)))) {
-    perror("malloc");
-    exit(1);
+  /* Let the last frame out before the backend puts the terminal back. */
+  io_render_sync();
+  io_render_quit = 1;
+  sem_post(&io_render_wake);
+  pthread_join(io_render_thread, NULL);
+  sem_destroy(&io_render_wake);
+  sem_destroy(&io_render_done);
+
+  io_backend->reset();
+}
+
+/* Only for stopping a run, which is why it goes through replay. */
+uint32_t io_key_pending(void)
+{
+  return replay_interrupt(io_backend->key_pending());
+}
+
+static io_message_t *io_next_message(io_message_type_t type)
+{
+  io_message_t *m;
+
+  /* If it's ever so full that the oldest message not yet printed would *
+   * be overwritten, skip it; the newest messages matter most.          */
+  if (io_message_tail - io_message_head == IO_MESSAGES) {
+    io_message_head++;
   }
 
-  tmp->next = NULL;
+  m = &io_message[io_message_tail++ % IO_MESSAGES];
+  m->type = type;
+  m->msg[0] = '\0';
+
+  return m;
+}
+
+void io_queue_message(const char *format, ...)
+{
+  va_list ap;
 
   va_start(ap, format);
 
-  vsnprintf(tmp->msg, sizeof (tmp->msg), format, ap);
+  vsnprintf(io_next_message(io_message_text)->msg,
+            sizeof (io_message[0].msg), format, ap);
 
   va_end(ap);
+}
 
-  if (!io_head) {
-    io_head = io_tail = tmp;
-  } else {
-    io_tail->next = tmp;
-    io_tail = tmp;
-  }
+void io_queue_pause(void)
+{
+  io_next_message(io_message_pause);
 }
 
 static void io_print_message_queue(uint32_t y, uint32_t x)
 {
-  while (io_head) {
-    io_tail = io_head;
-    attron(COLOR_PAIR(COLOR_CYAN));
-    mvprintw(y, x, "%-80s", io_head->msg);
-    attroff(COLOR_PAIR(COLOR_CYAN));
-    io_head = io_head->next;
-    if (io_head) {
-      attron(COLOR_PAIR(COLOR_CYAN));
-      mvprintw(y, x + 70, "%10s", " --more-- ");
-      attroff(COLOR_PAIR(COLOR_CYAN));
-      refresh();
-      getch();
+  io_message_t *m;
+
+  while (io_message_head != io_message_tail) {
+    m = &io_message[io_message_head++ % IO_MESSAGES];
+    io_attron(COLOR_PAIR(COLOR_CYAN));
+    io_mvprintw(y, x, "%-80s", m->msg);
+    io_attroff(COLOR_PAIR(COLOR_CYAN));
+    if (m->type == io_message_text && io_message_head != io_message_tail) {
+      io_attron(COLOR_PAIR(COLOR_CYAN));
+      io_mvprintw(y, x + 70, "%10s", " --more-- ");
+      io_attroff(COLOR_PAIR(COLOR_CYAN));
+      /* The player should get to read it even with keys typed ahead. */
+      io_publish();
+      io_getch();
+    }
+  }
+}
+
+/* Scrollback of the messages already printed, newest at the bottom. */
+static void io_display_message_history(dungeon *d)
+{
+  const char *text[IO_MESSAGES];
+  uint32_t i, count, offset;
+  int key;
+
+  count = 0;
+  for (i = (io_message_tail > IO_MESSAGES ? io_message_tail - IO_MESSAGES : 0);
+       i != io_message_head;
+       i++) {
+    if (io_message[i % IO_MESSAGES].type == io_message_text) {
+      text[count++] = io_message[i % IO_MESSAGES].msg;
     }
-    free(io_tail);
   }
-  io_tail = NULL;
+
+  offset = 0;
+  do {
+    io_erase();
+    io_mvprintw(0, 0, "Message history.  Arrows to scroll, "
+                "escape to continue.");
+    for (i = 0; i < 23 && i + offset < count; i++) {
+      io_attron(COLOR_PAIR(COLOR_CYAN));
+      io_mvprintw(23 - i, 0, "%s", text[count - 1 - i - offset]);
+      io_attroff(COLOR_PAIR(COLOR_CYAN));
+    }
+    switch (key = io_getch()) {
+    case KEY_UP:
+      if (offset + 23 < count) {
+        offset++;
+      }
+      break;
+    case KEY_DOWN:
+      if (offset) {
+        offset--;
+      }
+      break;
+    }
+  } while (key != 27);
+
+  io_display(d);
 }
 
 void io_display_tunnel(dungeon *d)
 {
-  uint32_t y, x;
-  clear();
-  for (y = 0; y < DUNGEON_Y; y++) {
-    for (x = 0; x < DUNGEON_X; x++) {
+  int32_t y, x;
+  io_erase();
+  for (y = io_view[dim_y]; y < io_view[dim_y] + IO_MAP_ROWS; y++) {
+    for (x = io_view[dim_x]; x < io_view[dim_x] + IO_MAP_COLS; x++) {
       if (charxy(x, y) == d->PC) {
-        mvaddch(y + 1, x, charxy(x, y)->symbol);
+        io_map_addch(y, x, charxy(x, y)->symbol);
       } else if (hardnessxy(x, y) == 255) {
-        mvaddch(y + 1, x, '*');
+        io_map_addch(y, x, '*');
       } else {
-        mvaddch(y + 1, x, '0' + (d->pc_tunnel[y][x] % 10));
+        io_map_addch(y, x, '0' + (d->pc_tunnel[y][x] % 10));
       }
     }
   }
-  refresh();
+  io_refresh();
 }
 
 void io_display_distance(dungeon *d)
 {
-  uint32_t y, x;
-  clear();
-  for (y = 0; y < DUNGEON_Y; y++) {
-    for (x = 0; x < DUNGEON_X; x++) {
+  int32_t y, x;
+  io_erase();
+  for (y = io_view[dim_y]; y < io_view[dim_y] + IO_MAP_ROWS; y++) {
+    for (x = io_view[dim_x]; x < io_view[dim_x] + IO_MAP_COLS; x++) {
       if (charxy(x, y)) {
-        mvaddch(y + 1, x, charxy(x, y)->symbol);
-      } else if (hardnessxy(x, y) != 0) {
-        mvaddch(y + 1, x, ' ');
+        io_map_addch(y, x, charxy(x, y)->symbol);
+      } else if (hardnessxy(x, y) != 0 ||
+                 d->pc_distance[y][x] == DISTANCE_UNREACHABLE) {
+        io_map_addch(y, x, ' ');
       } else {
-        mvaddch(y + 1, x, '0' + (d->pc_distance[y][x] % 10));
+        io_map_addch(y, x, '0' + (d->pc_distance[y][x] % 10));
       }
     }
   }
-  refresh();
+  io_refresh();
 }
 
 static char hardness_to_char[] =
@@ -143,25 +708,25 @@ static char hardness_to_char[] =
 
 void io_display_hardness(dungeon *d)
 {
-  uint32_t y, x;
-  clear();
-  for (y = 0; y < DUNGEON_Y; y++) {
-    for (x = 0; x < DUNGEON_X; x++) {
+  int32_t y, x;
+  io_erase();
+  for (y = io_view[dim_y]; y < io_view[dim_y] + IO_MAP_ROWS; y++) {
+    for (x = io_view[dim_x]; x < io_view[dim_x] + IO_MAP_COLS; x++) {
       /* Maximum hardness is 255.  We have 62 values to display it, but *
        * we only want one zero value, so we need to cover [1,255] with  *
        * 61 values, which gives us a divisor of 254 / 61 = 4.164.       *
        * Generally, we want to avoid floating point math, but this is   *
        * not gameplay, so we'll make an exception here to get maximal   *
        * hardness display resolution.                                   */
-      mvaddch(y + 1, x, (d->hardness[y][x]                             ?
-                         hardness_to_char[1 + (int) ((d->hardness[y][x] /
-                                                      4.2))] : ' '));
+      io_map_addch(y, x, (d->hardness[y][x]                          ?
+                          hardness_to_char[1 + (int) ((d->hardness[y][x] /
+                                                       4.2))] : ' '));
     }
   }
-  refresh();
+  io_refresh();
 }
 
-static void io_redisplay_visible_monsters(dungeon *d)
+static uint32_t io_redisplay_visible_monsters(dungeon *d)
 {
   /* This was initially supposed to only redisplay visible monsters.  After *
    * implementing that (comparitivly simple) functionality and testing, I   *
@@ -173,10 +738,18 @@ static void io_redisplay_visible_monsters(dungeon *d)
    * of this is to accelerate the rendering of multi-colored monsters, and  *
    * it is *significantly* faster than that (it eliminates flickering       *
    * artifacts), but it's still significantly slower than it could be.  I   *
-   * will revisit this in the future to add the acceleration matrix.        */
-  pair_t pos;
-  uint32_t color;
-  uint32_t illuminated;
+   * will revisit this in the future to add the acceleration matrix.        *
+   *                                                                        *
+   * Now that io_refresh() only sends what changed, this costs next to      *
+   * nothing on the wire unless something in the light radius changes.     *
+   * Returns nonzero if it drew anything that cycles colors, in which case  *
+   * the caller needs to call us again in a little while.                   */
+  pair_t pos, p;
+  character *c;
+  object *o;
+  uint32_t animated = 0;
+
+  io_frame++;
 
   for (pos[dim_y] = -PC_VISUAL_RANGE;
        pos[dim_y] <= PC_VISUAL_RANGE;
@@ -184,428 +757,298 @@ static void io_redisplay_visible_monsters(dungeon *d)
     for (pos[dim_x] = -PC_VISUAL_RANGE;
          pos[dim_x] <= PC_VISUAL_RANGE;
          pos[dim_x]++) {
-      if ((d->PC->position[dim_y] + pos[dim_y] < 0) ||
-          (d->PC->position[dim_y] + pos[dim_y] >= DUNGEON_Y) ||
-          (d->PC->position[dim_x] + pos[dim_x] < 0) ||
-          (d->PC->position[dim_x] + pos[dim_x] >= DUNGEON_X)) {
+      p[dim_y] = d->PC->position[dim_y] + pos[dim_y];
+      p[dim_x] = d->PC->position[dim_x] + pos[dim_x];
+      if ((p[dim_y] < 0) || (p[dim_y] >= DUNGEON_Y) ||
+          (p[dim_x] < 0) || (p[dim_x] >= DUNGEON_X)) {
         continue;
       }
-      if ((illuminated = is_illuminated(d->PC,
-                                        d->PC->position[dim_y] + pos[dim_y],
-                                        d->PC->position[dim_x] + pos[dim_x]))) {
-        attron(A_BOLD);
+      if (is_illuminated(d->PC, p[dim_y], p[dim_x])) {
+        io_attron(A_BOLD);
       }
-      if (d->character_map[d->PC->position[dim_y] + pos[dim_y]]
-                          [d->PC->position[dim_x] + pos[dim_x]] &&
-          can_see(d, d->PC->position,
-                  d->character_map[d->PC->position[dim_y] + pos[dim_y]]
-                                  [d->PC->position[dim_x] +
-                                   pos[dim_x]]->position, 1, 0)) {
-        attron(COLOR_PAIR((color = d->character_map[d->PC->position[dim_y] +
-                                                    pos[dim_y]]
-                                                   [d->PC->position[dim_x] +
-                                                    pos[dim_x]]->get_color())));
-        mvaddch(d->PC->position[dim_y] + pos[dim_y] + 1,
-                d->PC->position[dim_x] + pos[dim_x],
-                character_get_symbol(d->character_map[d->PC->position[dim_y] +
-                                                      pos[dim_y]]
-                                                     [d->PC->position[dim_x] +
-                                                      pos[dim_x]]));
-        attroff(COLOR_PAIR(color));
-      } else if (d->objmap[d->PC->position[dim_y] + pos[dim_y]]
-                          [d->PC->position[dim_x] + pos[dim_x]] &&
-                 (can_see(d, d->PC->position,
-                          d->objmap[d->PC->position[dim_y] + pos[dim_y]]
-                                   [d->PC->position[dim_x] +
-                                    pos[dim_x]]->get_position(), 1, 0) ||
-                 d->objmap[d->PC->position[dim_y] + pos[dim_y]]
-                          [d->PC->position[dim_x] + pos[dim_x]]->have_seen())) {
-        attron(COLOR_PAIR(d->objmap[d->PC->position[dim_y] + pos[dim_y]]
-                                   [d->PC->position[dim_x] +
-                                    pos[dim_x]]->get_color()));
-        mvaddch(d->PC->position[dim_y] + pos[dim_y] + 1,
-                d->PC->position[dim_x] + pos[dim_x],
-                d->objmap[d->PC->position[dim_y] + pos[dim_y]]
-                         [d->PC->position[dim_x] + pos[dim_x]]->get_symbol());
-        attroff(COLOR_PAIR(d->objmap[d->PC->position[dim_y] + pos[dim_y]]
-                                    [d->PC->position[dim_x] +
-                                     pos[dim_x]]->get_color()));
+      if ((c = charpair(p)) && can_see(d, d->PC->position, c->position, 1, 0)) {
+        animated |= c->color.size() > 1;
+        io_attron(COLOR_PAIR(c->get_color(io_frame)));
+        io_map_addch(p[dim_y], p[dim_x], character_get_symbol(c));
+        io_attroff(COLOR_PAIR(c->get_color(io_frame)));
+      } else if ((o = objpair(p)) &&
+                 (can_see(d, d->PC->position, o->get_position(), 1, 0) ||
+                  o->have_seen())) {
+        io_attron(COLOR_PAIR(o->get_color()));
+        io_map_addch(p[dim_y], p[dim_x], o->get_symbol());
+        io_attroff(COLOR_PAIR(o->get_color()));
       } else {
-        switch (pc_learned_terrain(d->PC,
-                                   d->PC->position[dim_y] + pos[dim_y],
-                                   d->PC->position[dim_x] +
-                                   pos[dim_x])) {
-        case ter_wall:
-        case ter_wall_immutable:
-        case ter_unknown:
-          mvaddch(d->PC->position[dim_y] + pos[dim_y] + 1,
-                  d->PC->position[dim_x] + pos[dim_x], ' ');
-          break;
-        case ter_floor:
-        case ter_floor_room:
-          mvaddch(d->PC->position[dim_y] + pos[dim_y] + 1,
-                  d->PC->position[dim_x] + pos[dim_x], '.');
-          break;
-        case ter_floor_hall:
-          mvaddch(d->PC->position[dim_y] + pos[dim_y] + 1,
-                  d->PC->position[dim_x] + pos[dim_x], '#');
-          break;
-        case ter_debug:
-          mvaddch(d->PC->position[dim_y] + pos[dim_y] + 1,
-                  d->PC->position[dim_x] + pos[dim_x], '*');
-          break;
-        case ter_stairs_up:
-          mvaddch(d->PC->position[dim_y] + pos[dim_y] + 1,
-                  d->PC->position[dim_x] + pos[dim_x], '<');
-          break;
-        case ter_stairs_down:
-          mvaddch(d->PC->position[dim_y] + pos[dim_y] + 1,
-                  d->PC->position[dim_x] + pos[dim_x], '>');
-          break;
-        default:
- /* Use zero as an error symbol, since it stands out somewhat, and it's *
-  * not otherwise used.                                                 */
-          mvaddch(d->PC->position[dim_y] + pos[dim_y] + 1,
-                  d->PC->position[dim_x] + pos[dim_x], '0');
-        }
+        io_map_addch(p[dim_y], p[dim_x],
+                     io_terrain_glyph(pc_learned_terrain(d->PC,
+                                                         p[dim_y], p[dim_x])));
       }
-      attroff(A_BOLD);
+      io_attroff(A_BOLD);
     }
   }
 
-  refresh();
+  io_refresh();
+
+  return animated;
 }
 
 static int compare_monster_distance(const void *v1, const void *v2)
 {
   const character *const *c1 = (const character *const *) v1;
   const character *const *c2 = (const character *const *) v2;
+  int d1, d2;
+
+  d1 = thedungeon->pc_distance[(*c1)->position[dim_y]][(*c1)->position[dim_x]];
+  d2 = thedungeon->pc_distance[(*c2)->position[dim_y]][(*c2)->position[dim_x]];
 
-  return (thedungeon->pc_distance[(*c1)->position[dim_y]]
-                                 [(*c1)->position[dim_x]] -
-          thedungeon->pc_distance[(*c2)->position[dim_y]]
-                                 [(*c2)->position[dim_x]]);
+  /* Equal distances fall back to map order, top to bottom. */
+  if (d1 != d2) {
+    return d1 - d2;
+  }
+  if ((*c1)->position[dim_y] != (*c2)->position[dim_y]) {
+    return (*c1)->position[dim_y] - (*c2)->position[dim_y];
+  }
+  return (*c1)->position[dim_x] - (*c2)->position[dim_x];
 }
 
-static character *io_nearest_visible_monster(dungeon *d)
-{
-  character **c, *n;
-  uint32_t x, y, count, i;
+/* The PC can't see past PC_VISUAL_RANGE, so we only need to ask the   *
+ * spatial index about that square, and it can't hold more than this. */
+#define IO_MAX_VISIBLE ((2 * PC_VISUAL_RANGE + 1) * (2 * PC_VISUAL_RANGE + 1))
 
-  c = (character **) malloc(d->num_monsters * sizeof (*c));
+/* Fills c with the monsters the PC can see, sorted by distance. */
+static uint32_t io_visible_monsters(dungeon *d, character **c)
+{
+  uint32_t count, i, n;
 
-  /* Get a linear list of monsters */
-  for (count = 0, y = 1; y < DUNGEON_Y - 1; y++) {
-    for (x = 1; x < DUNGEON_X - 1; x++) {
-      if (d->character_map[y][x] && d->character_map[y][x] != d->PC) {
-        c[count++] = d->character_map[y][x];
-      }
+  count = spatial_query(d, character_get_pos(d->PC), PC_VISUAL_RANGE,
+                        c, IO_MAX_VISIBLE);
+  for (n = i = 0; i < count; i++) {
+    if (can_see(d, character_get_pos(d->PC), character_get_pos(c[i]), 1, 0)) {
+      c[n++] = c[i];
     }
   }
 
   /* Sort it by distance from PC */
   thedungeon = d;
-  qsort(c, count, sizeof (*c), compare_monster_distance);
+  qsort(c, n, sizeof (*c), compare_monster_distance);
 
-  for (n = NULL, i = 0; i < count; i++) {
-    if (can_see(d, character_get_pos(d->PC), character_get_pos(c[i]), 1, 0)) {
-      n = c[i];
-      break;
-    }
-  }
+  return n;
+}
 
-  free(c);
+static character *io_nearest_visible_monster(dungeon *d)
+{
+  character *c[IO_MAX_VISIBLE];
 
-  return n;
+  return io_visible_monsters(d, c) ? c[0] : NULL;
 }
 
 void io_display(dungeon *d)
 {
+  PROFILE_SCOPE("io_display");
   pair_t pos;
   uint32_t illuminated;
   uint32_t color;
   character *c;
+  object *o;
   int32_t visible_monsters;
 
-  clear();
-  for (visible_monsters = -1, pos[dim_y] = 0;
-       pos[dim_y] < DUNGEON_Y;
+  io_erase();
+  io_frame++;
+  io_view_follow(d->PC->position);
+  for (visible_monsters = -1, pos[dim_y] = io_view[dim_y];
+       pos[dim_y] < io_view[dim_y] + IO_MAP_ROWS;
        pos[dim_y]++) {
-    for (pos[dim_x] = 0; pos[dim_x] < DUNGEON_X; pos[dim_x]++) {
+    for (pos[dim_x] = io_view[dim_x];
+         pos[dim_x] < io_view[dim_x] + IO_MAP_COLS;
+         pos[dim_x]++) {
       if ((illuminated = is_illuminated(d->PC,
                                         pos[dim_y],
                                         pos[dim_x]))) {
-        attron(A_BOLD);
+        io_attron(A_BOLD);
       }
-      if (d->character_map[pos[dim_y]]
-                          [pos[dim_x]] &&
-          can_see(d,
-                  character_get_pos(d->PC),
-                  character_get_pos(d->character_map[pos[dim_y]]
-                                                    [pos[dim_x]]), 1, 0)) {
+      if ((c = charpair(pos)) &&
+          can_see(d, character_get_pos(d->PC), character_get_pos(c), 1, 0)) {
         visible_monsters++;
-        attron(COLOR_PAIR((color = d->character_map[pos[dim_y]]
-                                                   [pos[dim_x]]->get_color())));
-        mvaddch(pos[dim_y] + 1, pos[dim_x],
-                character_get_symbol(d->character_map[pos[dim_y]]
-                                                     [pos[dim_x]]));
-        attroff(COLOR_PAIR(color));
-      } else if (d->objmap[pos[dim_y]]
-                          [pos[dim_x]] &&
-                 (d->objmap[pos[dim_y]]
-                           [pos[dim_x]]->have_seen() ||
+        io_attron(COLOR_PAIR((color = c->get_color(io_frame))));
+        io_map_addch(pos[dim_y], pos[dim_x], character_get_symbol(c));
+        io_attroff(COLOR_PAIR(color));
+      } else if ((o = objpair(pos)) &&
+                 (o->have_seen() ||
                   can_see(d, character_get_pos(d->PC), pos, 1, 0))) {
-        attron(COLOR_PAIR(d->objmap[pos[dim_y]]
-                                   [pos[dim_x]]->get_color()));
-        mvaddch(pos[dim_y] + 1, pos[dim_x],
-                d->objmap[pos[dim_y]]
-                         [pos[dim_x]]->get_symbol());
-        attroff(COLOR_PAIR(d->objmap[pos[dim_y]]
-                                    [pos[dim_x]]->get_color()));
+        io_attron(COLOR_PAIR(o->get_color()));
+        io_map_addch(pos[dim_y], pos[dim_x], o->get_symbol());
+        io_attroff(COLOR_PAIR(o->get_color()));
       } else {
-        switch (pc_learned_terrain(d->PC,
-                                   pos[dim_y],
-                                   pos[dim_x])) {
-        case ter_wall:
-        case ter_wall_immutable:
-        case ter_unknown:
-          mvaddch(pos[dim_y] + 1, pos[dim_x], ' ');
-          break;
-        case ter_floor:
-        case ter_floor_room:
-          mvaddch(pos[dim_y] + 1, pos[dim_x], '.');
-          break;
-        case ter_floor_hall:
-          mvaddch(pos[dim_y] + 1, pos[dim_x], '#');
-          break;
-        case ter_debug:
-          mvaddch(pos[dim_y] + 1, pos[dim_x], '*');
-          break;
-        case ter_stairs_up:
-          mvaddch(pos[dim_y] + 1, pos[dim_x], '<');
-          break;
-        case ter_stairs_down:
-          mvaddch(pos[dim_y] + 1, pos[dim_x], '>');
-          break;
-        default:
- /* Use zero as an error symbol, since it stands out somewhat, and it's *
-  * not otherwise used.                                                 */
-          mvaddch(pos[dim_y] + 1, pos[dim_x], '0');
-        }
+        io_map_addch(pos[dim_y], pos[dim_x],
+                     io_terrain_glyph(pc_learned_terrain(d->PC,
+                                                         pos[dim_y],
+                                                         pos[dim_x])));
       }
       if (illuminated) {
-        attroff(A_BOLD);
+        io_attroff(A_BOLD);
       }
     }
   }
 
-  mvprintw(23, 1, "PC position is (%2d,%2d).",
-           d->PC->position[dim_x], d->PC->position[dim_y]);
-  mvprintw(22, 1, "%d known %s.", visible_monsters,
-           visible_monsters > 1 ? "monsters" : "monster");
-  mvprintw(22, 30, "Nearest visible monster: ");
+  io_mvprintw(23, 1, "PC position is (%2d,%2d).",
+              d->PC->position[dim_x], d->PC->position[dim_y]);
+  io_mvprintw(22, 1, "%d known %s.", visible_monsters,
+              visible_monsters > 1 ? "monsters" : "monster");
+  io_mvprintw(22, 30, "Nearest visible monster: ");
   if ((c = io_nearest_visible_monster(d))) {
-    attron(COLOR_PAIR(COLOR_RED));
-    mvprintw(22, 55, "%c at %d %c by %d %c.",
-             c->symbol,
-             abs(c->position[dim_y] - d->PC->position[dim_y]),
-             ((c->position[dim_y] - d->PC->position[dim_y]) <= 0 ?
-              'N' : 'S'),
-             abs(c->position[dim_x] - d->PC->position[dim_x]),
-             ((c->position[dim_x] - d->PC->position[dim_x]) <= 0 ?
-              'W' : 'E'));
-    attroff(COLOR_PAIR(COLOR_RED));
+    io_attron(COLOR_PAIR(COLOR_RED));
+    io_mvprintw(22, 55, "%c at %d %c by %d %c.",
+                c->symbol,
+                abs(c->position[dim_y] - d->PC->position[dim_y]),
+                ((c->position[dim_y] - d->PC->position[dim_y]) <= 0 ?
+                 'N' : 'S'),
+                abs(c->position[dim_x] - d->PC->position[dim_x]),
+                ((c->position[dim_x] - d->PC->position[dim_x]) <= 0 ?
+                 'W' : 'E'));
+    io_attroff(COLOR_PAIR(COLOR_RED));
   } else {
-    attron(COLOR_PAIR(COLOR_BLUE));
-    mvprintw(22, 55, "NONE.");
-    attroff(COLOR_PAIR(COLOR_BLUE));
+    io_attron(COLOR_PAIR(COLOR_BLUE));
+    io_mvprintw(22, 55, "NONE.");
+    io_attroff(COLOR_PAIR(COLOR_BLUE));
   }
-  mvprintw(21, 1, "HP: %d  SPD: %d", d->PC->hp, d->PC->speed);
+  io_mvprintw(21, 1, "HP: %d  SPD: %d", d->PC->hp, d->PC->speed);
   
   io_print_message_queue(0, 0);
 
-  refresh();
+  io_refresh();
 }
 
-static void io_redisplay_non_terrain(dungeon *d, pair_t cursor)
+static uint32_t io_redisplay_non_terrain(dungeon *d, pair_t cursor)
 {
-  /* For the wiz-mode teleport, in order to see color-changing effects. */
+  /* For the wiz-mode teleport, in order to see color-changing effects. *
+   * Like io_redisplay_visible_monsters(), returns nonzero if anything  *
+   * it drew cycles colors.                                             */
   pair_t pos;
   uint32_t color;
-  uint32_t illuminated;
+  character *c;
+  object *o;
+  uint32_t animated = 0;
 
-  for (pos[dim_y] = 0; pos[dim_y] < DUNGEON_Y; pos[dim_y]++) {
-    for (pos[dim_x] = 0; pos[dim_x] < DUNGEON_X; pos[dim_x]++) {
-      if ((illuminated = is_illuminated(d->PC,
-                                        pos[dim_y],
-                                        pos[dim_x]))) {
-        attron(A_BOLD);
+  io_frame++;
+
+  for (pos[dim_y] = io_view[dim_y];
+       pos[dim_y] < io_view[dim_y] + IO_MAP_ROWS;
+       pos[dim_y]++) {
+    for (pos[dim_x] = io_view[dim_x];
+         pos[dim_x] < io_view[dim_x] + IO_MAP_COLS;
+         pos[dim_x]++) {
+      if (is_illuminated(d->PC, pos[dim_y], pos[dim_x])) {
+        io_attron(A_BOLD);
       }
       if (cursor[dim_y] == pos[dim_y] && cursor[dim_x] == pos[dim_x]) {
-        mvaddch(pos[dim_y] + 1, pos[dim_x], '*');
-      } else if (d->character_map[pos[dim_y]][pos[dim_x]]) {
-        attron(COLOR_PAIR((color = d->character_map[pos[dim_y]]
-                                                   [pos[dim_x]]->get_color())));
-        mvaddch(pos[dim_y] + 1, pos[dim_x],
-                character_get_symbol(d->character_map[pos[dim_y]][pos[dim_x]]));
-        attroff(COLOR_PAIR(color));
-      } else if (d->objmap[pos[dim_y]][pos[dim_x]]) {
-        attron(COLOR_PAIR(d->objmap[pos[dim_y]][pos[dim_x]]->get_color()));
-        mvaddch(pos[dim_y] + 1, pos[dim_x],
-                d->objmap[pos[dim_y]][pos[dim_x]]->get_symbol());
-        attroff(COLOR_PAIR(d->objmap[pos[dim_y]][pos[dim_x]]->get_color()));
+        io_map_addch(pos[dim_y], pos[dim_x], '*');
+      } else if ((c = charpair(pos))) {
+        animated |= c->color.size() > 1;
+        io_attron(COLOR_PAIR((color = c->get_color(io_frame))));
+        io_map_addch(pos[dim_y], pos[dim_x], character_get_symbol(c));
+        io_attroff(COLOR_PAIR(color));
+      } else if ((o = objpair(pos))) {
+        io_attron(COLOR_PAIR(o->get_color()));
+        io_map_addch(pos[dim_y], pos[dim_x], o->get_symbol());
+        io_attroff(COLOR_PAIR(o->get_color()));
       }
-      attroff(A_BOLD);
+      io_attroff(A_BOLD);
     }
   }
 
-  refresh();
+  io_refresh();
+
+  return animated;
 }
 
 void io_display_no_fog(dungeon *d)
 {
-  uint32_t y, x;
+  int32_t y, x;
   uint32_t color;
   character *c;
 
-  clear();
-  for (y = 0; y < DUNGEON_Y; y++) {
-    for (x = 0; x < DUNGEON_X; x++) {
+  io_erase();
+  io_frame++;
+  for (y = io_view[dim_y]; y < io_view[dim_y] + IO_MAP_ROWS; y++) {
+    for (x = io_view[dim_x]; x < io_view[dim_x] + IO_MAP_COLS; x++) {
       if (d->character_map[y][x]) {
-        attron(COLOR_PAIR((color = d->character_map[y][x]->get_color())));
-        mvaddch(y + 1, x, character_get_symbol(d->character_map[y][x]));
-        attroff(COLOR_PAIR(color));
+        io_attron(COLOR_PAIR((color =
+                              d->character_map[y][x]->get_color(io_frame))));
+        io_map_addch(y, x, character_get_symbol(d->character_map[y][x]));
+        io_attroff(COLOR_PAIR(color));
       } else if (d->objmap[y][x]) {
-        attron(COLOR_PAIR(d->objmap[y][x]->get_color()));
-        mvaddch(y + 1, x, d->objmap[y][x]->get_symbol());
-        attroff(COLOR_PAIR(d->objmap[y][x]->get_color()));
+        io_attron(COLOR_PAIR(d->objmap[y][x]->get_color()));
+        io_map_addch(y, x, d->objmap[y][x]->get_symbol());
+        io_attroff(COLOR_PAIR(d->objmap[y][x]->get_color()));
       } else {
-        switch (mapxy(x, y)) {
-        case ter_wall:
-        case ter_wall_immutable:
-          mvaddch(y + 1, x, ' ');
-          break;
-        case ter_floor:
-        case ter_floor_room:
-          mvaddch(y + 1, x, '.');
-          break;
-        case ter_floor_hall:
-          mvaddch(y + 1, x, '#');
-          break;
-        case ter_debug:
-          mvaddch(y + 1, x, '*');
-          break;
-        case ter_stairs_up:
-          mvaddch(y + 1, x, '<');
-          break;
-        case ter_stairs_down:
-          mvaddch(y + 1, x, '>');
-          break;
-        default:
- /* Use zero as an error symbol, since it stands out somewhat, and it's *
-  * not otherwise used.                                                 */
-          mvaddch(y + 1, x, '0');
-        }
+        io_map_addch(y, x, io_terrain_glyph(mapxy(x, y)));
       }
     }
   }
 
-  mvprintw(23, 1, "PC position is (%2d,%2d).",
-           d->PC->position[dim_x], d->PC->position[dim_y]);
-  mvprintw(22, 1, "%d %s.", d->num_monsters,
-           d->num_monsters > 1 ? "monsters" : "monster");
-  mvprintw(22, 30, "Nearest visible monster: ");
+  io_mvprintw(23, 1, "PC position is (%2d,%2d).",
+              d->PC->position[dim_x], d->PC->position[dim_y]);
+  io_mvprintw(22, 1, "%d %s.", d->num_monsters,
+              d->num_monsters > 1 ? "monsters" : "monster");
+  io_mvprintw(22, 30, "Nearest visible monster: ");
   if ((c = io_nearest_visible_monster(d))) {
-    attron(COLOR_PAIR(COLOR_RED));
-    mvprintw(22, 55, "%c at %d %c by %d %c.",
-             c->symbol,
-             abs(c->position[dim_y] - d->PC->position[dim_y]),
-             ((c->position[dim_y] - d->PC->position[dim_y]) <= 0 ?
-              'N' : 'S'),
-             abs(c->position[dim_x] - d->PC->position[dim_x]),
-             ((c->position[dim_x] - d->PC->position[dim_x]) <= 0 ?
-              'W' : 'E'));
-    attroff(COLOR_PAIR(COLOR_RED));
+    io_attron(COLOR_PAIR(COLOR_RED));
+    io_mvprintw(22, 55, "%c at %d %c by %d %c.",
+                c->symbol,
+                abs(c->position[dim_y] - d->PC->position[dim_y]),
+                ((c->position[dim_y] - d->PC->position[dim_y]) <= 0 ?
+                 'N' : 'S'),
+                abs(c->position[dim_x] - d->PC->position[dim_x]),
+                ((c->position[dim_x] - d->PC->position[dim_x]) <= 0 ?
+                 'W' : 'E'));
+    io_attroff(COLOR_PAIR(COLOR_RED));
   } else {
-    attron(COLOR_PAIR(COLOR_BLUE));
-    mvprintw(22, 55, "NONE.");
-    attroff(COLOR_PAIR(COLOR_BLUE));
+    io_attron(COLOR_PAIR(COLOR_BLUE));
+    io_mvprintw(22, 55, "NONE.");
+    io_attroff(COLOR_PAIR(COLOR_BLUE));
   }
 
   io_print_message_queue(0, 0);
 
-  refresh();
+  io_refresh();
 }
 
 void io_display_monster_list(dungeon *d)
 {
-  mvprintw(11, 33, " HP:    XXXXX ");
-  mvprintw(12, 33, " Speed: XXXXX ");
-  mvprintw(14, 27, " Hit any key to continue. ");
-  refresh();
-  getch();
+  io_mvprintw(11, 33, " HP:    XXXXX ");
+  io_mvprintw(12, 33, " Speed: XXXXX ");
+  io_mvprintw(14, 27, " Hit any key to continue. ");
+  io_refresh();
+  io_getch();
 }
 
 uint32_t io_teleport_pc(dungeon *d)
 {
   pair_t dest;
   int c;
-  fd_set readfs;
-  struct timeval tv;
+  uint32_t animated, n;
+  int32_t x, y;
 
   pc_reset_visibility(d->PC);
   io_display_no_fog(d);
 
-  mvprintw(0, 0,
-           "Choose a location.  'g' or '.' to teleport to; 'r' for random.");
+  io_mvprintw(0, 0,
+              "Choose a location.  'g' or '.' to teleport to; 'r' for random.");
 
   dest[dim_y] = d->PC->position[dim_y];
   dest[dim_x] = d->PC->position[dim_x];
 
-  mvaddch(dest[dim_y] + 1, dest[dim_x], '*');
-  refresh();
+  io_map_addch(dest[dim_y], dest[dim_x], '*');
+  io_refresh();
 
   do {
-    do{
-      FD_ZERO(&readfs);
-      FD_SET(STDIN_FILENO, &readfs);
-
-      tv.tv_sec = 0;
-      tv.tv_usec = 125000; /* An eigth of a second */
-
-      io_redisplay_non_terrain(d, dest);
-    } while (!select(STDIN_FILENO + 1, &readfs, NULL, NULL, &tv));
+    do {
+      animated = io_redisplay_non_terrain(d, dest);
+    } while ((c = io_getch_timeout(animated ? IO_ANIMATION_MS : -1)) == ERR);
     /* Can simply draw the terrain when we move the cursor away, *
      * because if it is a character or object, the refresh       *
      * function will fix it for us.                              */
-    switch (mappair(dest)) {
-    case ter_wall:
-    case ter_wall_immutable:
-    case ter_unknown:
-      mvaddch(dest[dim_y] + 1, dest[dim_x], ' ');
-      break;
-    case ter_floor:
-    case ter_floor_room:
-      mvaddch(dest[dim_y] + 1, dest[dim_x], '.');
-      break;
-    case ter_floor_hall:
-      mvaddch(dest[dim_y] + 1, dest[dim_x], '#');
-      break;
-    case ter_debug:
-      mvaddch(dest[dim_y] + 1, dest[dim_x], '*');
-      break;
-    case ter_stairs_up:
-      mvaddch(dest[dim_y] + 1, dest[dim_x], '<');
-      break;
-    case ter_stairs_down:
-      mvaddch(dest[dim_y] + 1, dest[dim_x], '>');
-      break;
-    default:
- /* Use zero as an error symbol, since it stands out somewhat, and it's *
-  * not otherwise used.                                                 */
-      mvaddch(dest[dim_y] + 1, dest[dim_x], '0');
-    }
-    switch ((c = getch())) {
+    io_map_addch(dest[dim_y], dest[dim_x], io_terrain_glyph(mappair(dest)));
+    switch (c) {
     case '7':
     case 'y':
     case KEY_HOME:
@@ -675,23 +1118,40 @@ uint32_t io_teleport_pc(dungeon *d)
       }
       break;
     }
+    /* Moving the cursor off the screen scrolls the whole map. */
+    if (io_view_follow(dest)) {
+      io_display_no_fog(d);
+      io_mvprintw(0, 0, "Choose a location.  "
+                  "'g' or '.' to teleport to; 'r' for random.");
+    }
   } while (c != 'g' && c != '.' && c != 'r');
 
   if (c == 'r') {
-    do {
-      dest[dim_x] = rand_range(1, DUNGEON_X - 2);
-      dest[dim_y] = rand_range(1, DUNGEON_Y - 2);
-    } while (charpair(dest) || mappair(dest) < ter_floor);
+    /* Somewhere we could have walked to, so we don't get shut in: any *
+     * empty cell pc_distance reaches, each as likely as the next.     */
+    for (n = 0, y = 1; y < DUNGEON_Y - 1; y++) {
+      for (x = 1; x < DUNGEON_X - 1; x++) {
+        if (d->pc_distance[y][x] != DISTANCE_UNREACHABLE && !charxy(x, y) &&
+            !(rand() % ++n)) {
+          dest[dim_x] = x;
+          dest[dim_y] = y;
+        }
+      }
+    }
   }
 
-  if (charpair(dest) && charpair(dest) != d->PC) {
+  if (c == 'r' && !n) {
+    io_queue_message("Teleport failed.  Nowhere to go.");
+  } else if (charpair(dest) && charpair(dest) != d->PC) {
     io_queue_message("Teleport failed.  Destination occupied.");
   } else {  
+    zobrist_toggle_character(d, d->PC);
     d->character_map[d->PC->position[dim_y]][d->PC->position[dim_x]] = NULL;
     d->character_map[dest[dim_y]][dest[dim_x]] = d->PC;
 
     d->PC->position[dim_y] = dest[dim_y];
     d->PC->position[dim_x] = dest[dim_x];
+    zobrist_toggle_character(d, d->PC);
   }
 
   pc_observe_terrain(d->PC, d);
@@ -707,8 +1167,7 @@ uint32_t io_inspect_monster(dungeon *d)
 {
   pair_t dest;
   int c;
-  fd_set readfs;
-  struct timeval tv;
+  uint32_t animated;
   character *tmp_character;
   std::string tmp_str;
   char character_info[80], dmg_die[20];
@@ -716,55 +1175,23 @@ uint32_t io_inspect_monster(dungeon *d)
   pc_reset_visibility(d->PC);
   io_display_no_fog(d);
 
-  mvprintw(0, 0, "Select a monster. 't' to inspect; 'escape' to exit.");
+  io_mvprintw(0, 0, "Select a monster. 't' to inspect; 'escape' to exit.");
 
   dest[dim_y] = d->PC->position[dim_y];
   dest[dim_x] = d->PC->position[dim_x];
 
-  mvaddch(dest[dim_y] + 1, dest[dim_x], '*');
-  refresh();
+  io_map_addch(dest[dim_y], dest[dim_x], '*');
+  io_refresh();
 
   do {
-    do{
-      FD_ZERO(&readfs);
-      FD_SET(STDIN_FILENO, &readfs);
-
-      tv.tv_sec = 0;
-      tv.tv_usec = 125000; /* An eigth of a second */
-
-      io_redisplay_non_terrain(d, dest);
-    } while (!select(STDIN_FILENO + 1, &readfs, NULL, NULL, &tv));
+    do {
+      animated = io_redisplay_non_terrain(d, dest);
+    } while ((c = io_getch_timeout(animated ? IO_ANIMATION_MS : -1)) == ERR);
     /* Can simply draw the terrain when we move the cursor away, *
      * because if it is a character or object, the refresh       *
      * function will fix it for us.                              */
-    switch (mappair(dest)) {
-    case ter_wall:
-    case ter_wall_immutable:
-    case ter_unknown:
-      mvaddch(dest[dim_y] + 1, dest[dim_x], ' ');
-      break;
-    case ter_floor:
-    case ter_floor_room:
-      mvaddch(dest[dim_y] + 1, dest[dim_x], '.');
-      break;
-    case ter_floor_hall:
-      mvaddch(dest[dim_y] + 1, dest[dim_x], '#');
-      break;
-    case ter_debug:
-      mvaddch(dest[dim_y] + 1, dest[dim_x], '*');
-      break;
-    case ter_stairs_up:
-      mvaddch(dest[dim_y] + 1, dest[dim_x], '<');
-      break;
-    case ter_stairs_down:
-      mvaddch(dest[dim_y] + 1, dest[dim_x], '>');
-      break;
-    default:
- /* Use zero as an error symbol, since it stands out somewhat, and it's *
-  * not otherwise used.                                                 */
-      mvaddch(dest[dim_y] + 1, dest[dim_x], '0');
-    }
-    switch ((c = getch())) {
+    io_map_addch(dest[dim_y], dest[dim_x], io_terrain_glyph(mappair(dest)));
+    switch (c) {
     case '7':
     case 'y':
     case KEY_HOME:
@@ -839,25 +1266,29 @@ uint32_t io_inspect_monster(dungeon *d)
       if(tmp_character && (tmp_character != d->PC)) {
 	/* Clear space for extra character info */
 	for(uint32_t y = 21; y < 23; y++) {
-	  for(uint32_t x = 1; x < DUNGEON_X; x++) {
-	    mvaddch(y, x, ' ');
+	  for(uint32_t x = 1; x < IO_COLS; x++) {
+	    io_mvaddch(y, x, ' ');
 	  }
 	}
-	mvprintw(21, 1, tmp_character->name);
+	io_mvprintw(21, 1, tmp_character->name);
 	sprintf(dmg_die, "%d+%dd%d", (*tmp_character->damage).get_base(), (*tmp_character->damage).get_number(), (*tmp_character->damage).get_sides());
 	sprintf(character_info, "HP: %d  DAM: %s  SPD: %d", tmp_character->hp, dmg_die, tmp_character->speed);
-	mvprintw(22, 1, character_info);
+	io_mvprintw(22, 1, character_info);
 	
 	std::istringstream s(((npc *)tmp_character)->description);
 	while(getline(s, tmp_str, '\n')) {
 	  io_queue_message(tmp_str.c_str());
 	}
-	io_queue_message("");
+	io_queue_pause();
 	io_print_message_queue(0, 0);
-	mvprintw(0, 0, "Select a monster. 't' to inspect; 'escape' to exit.");
+	io_mvprintw(0, 0, "Select a monster. 't' to inspect; 'escape' to exit.");
       }
       break;
     }
+    if (io_view_follow(dest)) {
+      io_display_no_fog(d);
+      io_mvprintw(0, 0, "Select a monster. 't' to inspect; 'escape' to exit.");
+    }
     /* Only exit on escape key */
   } while (c != 27);
 
@@ -870,86 +1301,76 @@ int32_t io_display_equipment(dungeon *d, bool selection, const char *prompt)
 {
   uint32_t i, y;
   uint8_t win_x = 10;
-  uint8_t win_width = DUNGEON_X - (win_x << 1);
-  uint8_t win_height = DUNGEON_Y - 1;
+  uint8_t win_y = 1;
+  uint8_t win_width = IO_COLS - (win_x << 1);
+  uint8_t win_height = IO_MAP_ROWS - 1;
   int c;
   uint32_t index, equip_size;
   bool equip_available = false;
   
-  /* Create equipment window */
-  WINDOW *equip_win;
-  equip_win = newwin(win_height, win_width, 1, win_x);
-  keypad(equip_win, TRUE);
-  box(equip_win, 0, 0);
-
-  /* mvwprintw(WINDOW, y, x, Format, args) */
-  mvwprintw(equip_win, 0, 1, "%s", "Equipment");
+  /* Draw equipment window */
+  io_box(win_y, win_x, win_height, win_width, "Equipment");
   
   y = 1;
   equip_size = d->PC->equipment.size();
   if(selection) {
-    mvwprintw(equip_win, y++, 1, "%s", prompt);
+    io_mvprintw(win_y + y++, win_x + 1, "%s", prompt);
   }
   for(i = 0; i < equip_size; i++) {
     /* Equipment slots lettered 'a' - 'l'. ASCII value of 'a' is 97. */
     if(d->PC->equipment[i]) {
-      mvwprintw(equip_win, y, 1, "%c: %s", (i + 97), (*d->PC->equipment[i]).get_name());
+      io_mvprintw(win_y + y, win_x + 1, "%c: %s", (i + 97),
+                  (*d->PC->equipment[i]).get_name());
       equip_available = true;
     } else {
-      mvwprintw(equip_win, y, 1, "%c: ", (i + 97));
+      io_mvprintw(win_y + y, win_x + 1, "%c: ", (i + 97));
     }
     y++;
   }
   if(selection && equip_available) {
-    mvwprintw(equip_win, ++y, 1, "%s", "Press s to select highlighted slot");
+    io_mvprintw(win_y + ++y, win_x + 1, "%s",
+                "Press s to select highlighted slot");
   }
-  mvwprintw(equip_win, ++y, 1, "%s", "Press escape or F1 to close");
-  
-  /* Display the window */
-  wrefresh(equip_win);
+  io_mvprintw(win_y + ++y, win_x + 1, "%s", "Press escape or F1 to close");
 
   index = 0;
   if(selection && equip_available) {
     equip_size--;  // Account for 0 indexing of vector
-    wattron(equip_win, A_BOLD);
-    mvwaddch(equip_win, (index + 2), 1, (index + 97));
-    wattroff(equip_win, A_BOLD);
+    io_attron(A_BOLD);
+    io_mvaddch(win_y + (index + 2), win_x + 1, (index + 97));
+    io_attroff(A_BOLD);
     do {
-      switch((c=wgetch(equip_win)))
+      switch((c=io_getch()))
 	{
 	case KEY_UP:
 	case 'k':
 	  if(index > 0) {
-	    mvwaddch(equip_win, (index + 2), 1, (index + 97));
+	    io_mvaddch(win_y + (index + 2), win_x + 1, (index + 97));
 	    index--;
-	    wattron(equip_win, A_BOLD);
-	    mvwaddch(equip_win, (index + 2), 1, (index + 97));
-	    wattroff(equip_win, A_BOLD);
+	    io_attron(A_BOLD);
+	    io_mvaddch(win_y + (index + 2), win_x + 1, (index + 97));
+	    io_attroff(A_BOLD);
 	  }
 	  break;
 	case KEY_DOWN:
 	case 'j':
 	  if(index < equip_size) {
-	    mvwaddch(equip_win, (index + 2), 1, (index + 97));
+	    io_mvaddch(win_y + (index + 2), win_x + 1, (index + 97));
 	    index++;
-	    wattron(equip_win, A_BOLD);
-	    mvwaddch(equip_win, (index + 2), 1, (index + 97));
-	    wattroff(equip_win, A_BOLD);
+	    io_attron(A_BOLD);
+	    io_mvaddch(win_y + (index + 2), win_x + 1, (index + 97));
+	    io_attroff(A_BOLD);
 	  }	  
 	  break;
 	}
     } while (c != 's' && c != 27 && c != KEY_F(1));
   }else {
     do {
-      c = wgetch(equip_win);
+      c = io_getch();
     } while (c != 27 && c != KEY_F(1));
   }
   
-  /* Clear the border then deallocate memory for equipment window */
-  wborder(equip_win, ' ', ' ', ' ',' ',' ',' ',' ',' ');
-  wrefresh(equip_win);
-  delwin(equip_win);
-
+  /* Redrawing the dungeon takes the window away */
   io_display(d);
 
   if (c == 's') {
@@ -963,82 +1384,72 @@ uint32_t io_display_inventory(dungeon *d, bool selection, const char *prompt)
 {
   uint32_t i, y;
   uint8_t win_x = 10;
-  uint8_t win_width = DUNGEON_X - (win_x << 1);
-  uint8_t win_height = DUNGEON_Y - 1;
+  uint8_t win_y = 1;
+  uint8_t win_width = IO_COLS - (win_x << 1);
+  uint8_t win_height = IO_MAP_ROWS - 1;
   int c;
   uint32_t index, invt_size;
   
-  /* Create inventory window */
-  WINDOW *inventory_win;
-  inventory_win = newwin(win_height, win_width, 1, win_x);
-  keypad(inventory_win, TRUE);
-  box(inventory_win, 0, 0);
-
-  /* mvwprintw(WINDOW, y, x, Format, args) */
-  mvwprintw(inventory_win, 0, 1, "%s", "Inventory");
+  /* Draw inventory window */
+  io_box(win_y, win_x, win_height, win_width, "Inventory");
   
   y = 1;
   invt_size = d->PC->inventory.size();
   if(invt_size == 0) {
-    mvwprintw(inventory_win, y++, 1, "%s", "No Items In Pack");
+    io_mvprintw(win_y + y++, win_x + 1, "%s", "No Items In Pack");
   } else if(selection) {
-    mvwprintw(inventory_win, y++, 1, "%s", prompt);
+    io_mvprintw(win_y + y++, win_x + 1, "%s", prompt);
   }
   for(i = 0; i < invt_size; i++) {
     /* Inventory slots numbered 0-9. */
-    mvwprintw(inventory_win, y, 1, "%d: %s", i, (*d->PC->inventory[i]).get_name());
+    io_mvprintw(win_y + y, win_x + 1, "%d: %s", i,
+                (*d->PC->inventory[i]).get_name());
     y++;
   }
   if(selection && invt_size) {
-    mvwprintw(inventory_win, ++y, 1, "%s", "Press s to select highlighted slot");
+    io_mvprintw(win_y + ++y, win_x + 1, "%s",
+                "Press s to select highlighted slot");
   }
-  mvwprintw(inventory_win, ++y, 1, "%s", "Press escape or F1 to close");
-  
-  /* Display the window */
-  wrefresh(inventory_win);
+  io_mvprintw(win_y + ++y, win_x + 1, "%s", "Press escape or F1 to close");
 
   index = 0;
   if(selection && invt_size) {
     invt_size--;  // Account for 0 indexing of vector
-    wattron(inventory_win, A_BOLD);
-    mvwaddch(inventory_win, (index + 2), 1, (index + 48));
-    wattroff(inventory_win, A_BOLD);
+    io_attron(A_BOLD);
+    io_mvaddch(win_y + (index + 2), win_x + 1, (index + 48));
+    io_attroff(A_BOLD);
     do {
-      switch((c=wgetch(inventory_win)))
+      switch((c=io_getch()))
 	{
 	case KEY_UP:
 	case 'k':
 	  if(index > 0) {
-	    mvwaddch(inventory_win, (index + 2), 1, (index + 48));
+	    io_mvaddch(win_y + (index + 2), win_x + 1, (index + 48));
 	    index--;
-	    wattron(inventory_win, A_BOLD);
-	    mvwaddch(inventory_win, (index + 2), 1, (index + 48));
-	    wattroff(inventory_win, A_BOLD);
+	    io_attron(A_BOLD);
+	    io_mvaddch(win_y + (index + 2), win_x + 1, (index + 48));
+	    io_attroff(A_BOLD);
 	  }
 	  break;
 	case KEY_DOWN:
 	case 'j':
 	  if(index < invt_size) {
-	    mvwaddch(inventory_win, (index + 2), 1, (index + 48));
+	    io_mvaddch(win_y + (index + 2), win_x + 1, (index + 48));
 	    index++;
-	    wattron(inventory_win, A_BOLD);
-	    mvwaddch(inventory_win, (index + 2), 1, (index + 48));
-	    wattroff(inventory_win, A_BOLD);
+	    io_attron(A_BOLD);
+	    io_mvaddch(win_y + (index + 2), win_x + 1, (index + 48));
+	    io_attroff(A_BOLD);
 	  }
 	  break;
 	}
     } while (c != 's' && c != 27 && c != KEY_F(1));
   } else {
     do {
-      c = wgetch(inventory_win);
+      c = io_getch();
     } while (c != 27 && c != KEY_F(1));
   }
   
-  /* Clear the border then deallocate memory for inventory window */
-  wborder(inventory_win, ' ', ' ', ' ',' ',' ',' ',' ',' ');
-  wrefresh(inventory_win);
-  delwin(inventory_win);
-
+  /* Redrawing the dungeon takes the window away */
   io_display(d);
 
   if (c == 's') {
@@ -1052,8 +1463,9 @@ object *io_display_stack(dungeon *d, object *top)
 {
   uint32_t i, y, index;
   uint8_t win_x = 10;
-  uint8_t win_width = DUNGEON_X - (win_x << 1);
-  uint8_t win_height = DUNGEON_Y - 1;
+  uint8_t win_y = 1;
+  uint8_t win_width = IO_COLS - (win_x << 1);
+  uint8_t win_height = IO_MAP_ROWS - 1;
   int c;
   object *tmp_obj;
   std::vector<object *> stack = std::vector<object *>(16);
@@ -1065,69 +1477,67 @@ object *io_display_stack(dungeon *d, object *top)
     top = (*top).get_next();
   }
   
-  /* Create inventory window */
-  WINDOW *stack_win;
-  stack_win = newwin(win_height, win_width, 1, win_x);
-  keypad(stack_win, TRUE);
-  box(stack_win, 0, 0);
-
-  /* mvwprintw(WINDOW, y, x, Format, args) */
-  mvwprintw(stack_win, 0, 1, "%s", "Item Stack");
+  /* Draw stack window */
+  io_box(win_y, win_x, win_height, win_width, "Item Stack");
 
   y = 1;
-  mvwprintw(stack_win, y++, 1, "%s", "Select Item From Stack To Pickup:");
+  io_mvprintw(win_y + y++, win_x + 1, "%s",
+              "Select Item From Stack To Pickup:");
   for(i = 0; i < stack.size(); i++) {
     tmp_obj = stack[i];
-    mvwaddch(stack_win, y, 1, (*tmp_obj).get_raw_symbol());
-    mvwprintw(stack_win, y++, 2, ": %s", (*tmp_obj).get_name());
+    io_mvaddch(win_y + y, win_x + 1, (*tmp_obj).get_raw_symbol());
+    io_mvprintw(win_y + y++, win_x + 2, ": %s", (*tmp_obj).get_name());
   }
-  mvwprintw(stack_win, ++y, 1, "%s", "Press s to select highlighted slot");
-  mvwprintw(stack_win, ++y, 1, "%s", "Press escape or F1 to close");
+  io_mvprintw(win_y + ++y, win_x + 1, "%s",
+              "Press s to select highlighted slot");
+  io_mvprintw(win_y + ++y, win_x + 1, "%s", "Press escape or F1 to close");
   
   index = 0;
-  wattron(stack_win, A_BOLD);
-  mvwaddch(stack_win, (index + 2), 1, (*stack[index]).get_raw_symbol());
-  wattroff(stack_win, A_BOLD);
+  io_attron(A_BOLD);
+  io_mvaddch(win_y + (index + 2), win_x + 1, (*stack[index]).get_raw_symbol());
+  io_attroff(A_BOLD);
   do {
-    switch((c=wgetch(stack_win)))
+    switch((c=io_getch()))
       {
       case KEY_UP:
       case 'k':
 	if(index > 0) {
-	  mvwaddch(stack_win, (index + 2), 1, (*stack[index]).get_raw_symbol());
+	  io_mvaddch(win_y + (index + 2), win_x + 1,
+		     (*stack[index]).get_raw_symbol());
 	  index--;
-	  wattron(stack_win, A_BOLD);
-	  mvwaddch(stack_win, (index + 2), 1, (*stack[index]).get_raw_symbol());
-	  wattroff(stack_win, A_BOLD);
+	  io_attron(A_BOLD);
+	  io_mvaddch(win_y + (index + 2), win_x + 1,
+		     (*stack[index]).get_raw_symbol());
+	  io_attroff(A_BOLD);
 	}
 	break;
       case KEY_DOWN:
       case 'j':
 	if(index < (stack.size()-1)) {
-	  mvwaddch(stack_win, (index + 2), 1, (*stack[index]).get_raw_symbol());
+	  io_mvaddch(win_y + (index + 2), win_x + 1,
+		     (*stack[index]).get_raw_symbol());
 	  index++;
-	  wattron(stack_win, A_BOLD);
-	  mvwaddch(stack_win, (index + 2), 1, (*stack[index]).get_raw_symbol());
-	  wattroff(stack_win, A_BOLD);
+	  io_attron(A_BOLD);
+	  io_mvaddch(win_y + (index + 2), win_x + 1,
+		     (*stack[index]).get_raw_symbol());
+	  io_attroff(A_BOLD);
 	}
 	break;
       }
   } while (c != 's' && c != 27 && c != KEY_F(1));
   
-  /* Clear the border then deallocate memory for inventory window */
-  wborder(stack_win, ' ', ' ', ' ',' ',' ',' ',' ',' ');
-  wrefresh(stack_win);
-  delwin(stack_win);
-
+  /* Redrawing the dungeon takes the window away */
   io_display(d);
 
   if (c == 's') {
+    zobrist_toggle_objects(d, d->PC->position);
     if(index > 0) {
       (*stack[index-1]).set_next(stack[index+1]);
     } else {
       objpair(d->PC->position) = (*stack[index]).get_next();
     }
     (*stack[index]).set_next(nullptr);
+    zobrist_toggle_objects(d, d->PC->position);
     return stack[index];
   }
 
@@ -1177,9 +1587,9 @@ static void io_scroll_monster_list(char (*s)[60], uint32_t count)
 
   while (1) {
     for (i = 0; i < 13; i++) {
-      mvprintw(i + 6, 9, " %-60s ", s[i + offset]);
+      io_mvprintw(i + 6, 9, " %-60s ", s[i + offset]);
     }
-    switch (getch()) {
+    switch (io_getch()) {
     case KEY_UP:
       if (offset) {
         offset--;
@@ -1216,11 +1626,11 @@ static void io_list_monsters_display(dungeon *d,
 
   s = (char (*)[60]) malloc((count + 1) * sizeof (*s));
 
-  mvprintw(3, 9, " %-60s ", "");
+  io_mvprintw(3, 9, " %-60s ", "");
   /* Borrow the first element of our array for this string: */
   snprintf(s[0], 60, "You know of %d monsters:", count);
-  mvprintw(4, 9, " %-60s ", s);
-  mvprintw(5, 9, " %-60s ", "");
+  io_mvprintw(4, 9, " %-60s ", s[0]);
+  io_mvprintw(5, 9, " %-60s ", "");
 
   for (i = 0; i < count; i++) {
     snprintf(tmp, 41, "%3s%s (%c): ",
@@ -1250,19 +1660,19 @@ static void io_list_monsters_display(dungeon *d,
     if (count <= 13) {
       /* Handle the non-scrolling case right here. *
        * Scrolling in another function.            */
-      mvprintw(i + 6, 9, " %-60s ", s[i]);
+      io_mvprintw(i + 6, 9, " %-60s ", s[i]);
     }
   }
 
   if (count <= 13) {
-    mvprintw(count + 6, 9, " %-60s ", "");
-    mvprintw(count + 7, 9, " %-60s ", "Hit escape to continue.");
-    while (getch() != 27 /* escape */)
+    io_mvprintw(count + 6, 9, " %-60s ", "");
+    io_mvprintw(count + 7, 9, " %-60s ", "Hit escape to continue.");
+    while (io_getch() != 27 /* escape */)
       ;
   } else {
-    mvprintw(19, 9, " %-60s ", "");
-    mvprintw(20, 9, " %-60s ",
-             "Arrows to scroll, escape to continue.");
+    io_mvprintw(19, 9, " %-60s ", "");
+    io_mvprintw(20, 9, " %-60s ",
+                "Arrows to scroll, escape to continue.");
     io_scroll_monster_list(s, count);
   }
 
@@ -1271,41 +1681,72 @@ static void io_list_monsters_display(dungeon *d,
 
 static void io_list_monsters(dungeon *d)
 {
-  character **c;
-  uint32_t x, y, count;
-
-  c = (character **) malloc(d->num_monsters * sizeof (*c));
-
-  /* Get a linear list of monsters */
-  for (count = 0, y = 1; y < DUNGEON_Y - 1; y++) {
-    for (x = 1; x < DUNGEON_X - 1; x++) {
-      if (d->character_map[y][x] && d->character_map[y][x] != d->PC &&
-          can_see(d, character_get_pos(d->PC),
-                  character_get_pos(d->character_map[y][x]), 1, 0)) {
-        c[count++] = d->character_map[y][x];
-      }
-    }
-  }
+  character *c[IO_MAX_VISIBLE];
+  uint32_t count;
 
-  /* Sort it by distance from PC */
-  thedungeon = d;
-  qsort(c, count, sizeof (*c), compare_monster_distance);
+  count = io_visible_monsters(d, c);
 
   /* Display it */
   io_list_monsters_display(d, c, count);
-  free(c);
 
   /* And redraw the dungeon */
   io_display(d);
 }
 
+/* The number pad direction (5 for none) a movement key stands for, or *
+ * zero if it isn't one.                                               */
+static uint32_t io_key_direction(int key)
+{
+  switch (key) {
+  case '7':
+  case 'y':
+  case KEY_HOME:
+    return 7;
+  case '8':
+  case 'k':
+  case KEY_UP:
+    return 8;
+  case '9':
+  case 'u':
+  case KEY_PPAGE:
+    return 9;
+  case '6':
+  case 'l':
+  case KEY_RIGHT:
+    return 6;
+  case '3':
+  case 'n':
+  case KEY_NPAGE:
+    return 3;
+  case '2':
+  case 'j':
+  case KEY_DOWN:
+    return 2;
+  case '1':
+  case 'b':
+  case KEY_END:
+    return 1;
+  case '4':
+  case 'h':
+  case KEY_LEFT:
+    return 4;
+  case '5':
+  case ' ':
+  case '.':
+  case KEY_B2:
+    return 5;
+  default:
+    return 0;
+  }
+}
+
 void io_handle_input(dungeon *d)
 {
   uint32_t fail_code;
+  uint32_t dir;
   int key;
-  fd_set readfs;
-  struct timeval tv;
   uint32_t fog_off = 0;
+  uint32_t animated;
   pair_t tmp = { DUNGEON_X, DUNGEON_Y };
   object *tmp_obj;
   char obj_info[80];
@@ -1315,22 +1756,22 @@ void io_handle_input(dungeon *d)
   equip_position_t e_pos;
   
   do {
-    do{
-      FD_ZERO(&readfs);
-      FD_SET(STDIN_FILENO, &readfs);
-
-      tv.tv_sec = 0;
-      tv.tv_usec = 125000; /* An eigth of a second */
-
-      if (fog_off) {
+    /* We used to wake up and redraw eight times a second whether or not *
+     * anything had changed.  Now we sleep until a key comes, unless a    *
+     * multi-colored monster is on screen and needs its colors cycled.    */
+    do {
+      if (io_backend->key_pending()) {
+        /* Nobody will see the colors change before the next command. */
+        animated = 0;
+      } else if (fog_off) {
         /* Out-of-bounds cursor will not be rendered. */
-        io_redisplay_non_terrain(d, tmp);
+        animated = io_redisplay_non_terrain(d, tmp);
       } else {
-        io_redisplay_visible_monsters(d);
+        animated = io_redisplay_visible_monsters(d);
       }
-    } while (!select(STDIN_FILENO + 1, &readfs, NULL, NULL, &tv));
+    } while ((key = io_getch_timeout(animated ? IO_ANIMATION_MS : -1)) == ERR);
     fog_off = 0;
-    switch (key = getch()) {
+    switch (key) {
     case '7':
     case 'y':
     case KEY_HOME:
@@ -1377,6 +1818,39 @@ void io_handle_input(dungeon *d)
     case KEY_B2:
       fail_code = 0;
       break;
+    case 'Y':
+      fail_code = move_pc_run(d, 7);
+      break;
+    case 'K':
+      fail_code = move_pc_run(d, 8);
+      break;
+    case 'U':
+      fail_code = move_pc_run(d, 9);
+      break;
+    case 'N':
+      fail_code = move_pc_run(d, 3);
+      break;
+    case 'J':
+      fail_code = move_pc_run(d, 2);
+      break;
+    case 'B':
+      fail_code = move_pc_run(d, 1);
+      break;
+    case 'R':
+      /* Shift-h and shift-l were already taken, so there's also a run *
+       * command that takes any movement key for its direction.        */
+      io_mvprintw(0, 0, "Run which way?");
+      if ((dir = io_key_direction(io_getch()))) {
+        fail_code = move_pc_run(d, dir);
+      } else {
+        io_mvprintw(0, 0, "%-80s", "");
+        fail_code = 1;
+      }
+      break;
+    case 'Z':
+      /* Rest until disturbed */
+      fail_code = move_pc_run(d, 5);
+      break;
     case '>':
       fail_code = move_pc(d, '>');
       break;
@@ -1427,6 +1901,7 @@ void io_handle_input(dungeon *d)
 	    }
 	  } else {
 	    d->PC->inventory.push_back(tmp_obj);
+	    zobrist_toggle_objects(d, d->PC->position);
 	    objpair(d->PC->position) = nullptr;
 	    io_queue_message("Picked up %s", (*tmp_obj).get_name());
 	  }
@@ -1443,24 +1918,24 @@ void io_handle_input(dungeon *d)
 	tmp_obj = d->PC->inventory[selection];
 	/* Clear space for extra character info */
 	for(uint32_t y = 21; y < 24; y++) {
-	  for(uint32_t x = 1; x < DUNGEON_X; x++) {
-	    mvaddch(y, x, ' ');
+	  for(uint32_t x = 1; x < IO_COLS; x++) {
+	    io_mvaddch(y, x, ' ');
 	  }
 	}
-	mvprintw(21, 1, (*tmp_obj).get_name());
-	mvprintw(22, 1, (*tmp_obj).get_type_name());	
+	io_mvprintw(21, 1, (*tmp_obj).get_name());
+	io_mvprintw(22, 1, (*tmp_obj).get_type_name());	
 	sprintf(dmg_die, "%d+%dd%d", (*tmp_obj).get_damage_base(),
 		(*tmp_obj).get_damage_number(), (*tmp_obj).get_damage_sides());
 	sprintf(obj_info, "HIT: %d  DAM: %s  DEF: %d  SPD: %d  DGE: %d  WGT: %d",
 		(*tmp_obj).get_hit(), dmg_die, (*tmp_obj).get_defence(),
 		(*tmp_obj).get_speed(), (*tmp_obj).get_dodge(), (*tmp_obj).get_weight());
-	mvprintw(23, 1, obj_info);
+	io_mvprintw(23, 1, obj_info);
 	
 	std::istringstream s((*tmp_obj).get_desc());
 	while(getline(s, tmp_str, '\n')) {
 	  io_queue_message(tmp_str.c_str());
 	}
-	io_queue_message("");
+	io_queue_pause();
 	io_print_message_queue(0, 0);
       }
       fail_code = 1;
@@ -1518,10 +1993,12 @@ void io_handle_input(dungeon *d)
 	d->PC->equipment[selection] = nullptr;
 	/* If inventory is full then drop item onto ground */
 	if(d->PC->inventory.size() == d->PC->inventory.capacity()){
+	  zobrist_toggle_objects(d, d->PC->position);
 	  if(objpair(d->PC->position)) {
 	    (*tmp_obj).set_next(objpair(d->PC->position));
 	  }
 	  objpair(d->PC->position) = tmp_obj;
+	  zobrist_toggle_objects(d, d->PC->position);
 	  io_queue_message("Inventory full, %s dropped", (*tmp_obj).get_name());
 	} else {
 	  d->PC->inventory.push_back(tmp_obj);
@@ -1538,10 +2015,12 @@ void io_handle_input(dungeon *d)
 	  io_display_inventory(d, true, "Select Item To DROP:")) >= 0) {
 	  
 	tmp_obj = d->PC->inventory[selection];
+	zobrist_toggle_objects(d, d->PC->position);
 	if(objpair(d->PC->position)) {
 	  (*tmp_obj).set_next(objpair(d->PC->position));	  
 	}
 	objpair(d->PC->position) = tmp_obj;
+	zobrist_toggle_objects(d, d->PC->position);
 	d->PC->inventory.erase(d->PC->inventory.begin() + selection);
 	io_queue_message("Dropped %s", (*tmp_obj).get_name());
 	io_print_message_queue(0, 0);
@@ -1575,6 +2054,11 @@ void io_handle_input(dungeon *d)
       io_list_monsters(d);
       fail_code = 1;
       break;
+    case 'P':
+      /* Look back over earlier messages */
+      io_display_message_history(d);
+      fail_code = 1;
+      break;
     case 'q':
       /* Demonstrate use of the message queue.  You can use this for *
        * printf()-style debugging (though gdb is probably a better   *
@@ -1606,7 +2090,7 @@ void io_handle_input(dungeon *d)
        * octal, thus allowing us to do reverse lookups.  If a key has a *
        * name defined in the header, you can use the name here, else    *
        * you can directly use the octal value.                          */
-      mvprintw(0, 0, "Unbound key: %#o ", key);
+      io_mvprintw(0, 0, "Unbound key: %#o ", key);
       fail_code = 1;
     }
   } while (fail_code);
@@ -1,12 +1,26 @@
 #ifndef IO_H
 # define IO_H
 
+# include <stdint.h>
+
 class dungeon;
 
-void io_init_terminal(void);
+typedef enum io_backend_type {
+  io_backend_curses,
+  io_backend_ansi,
+  /* Draws nothing and takes keys from a --replay recording */
+  io_backend_replay
+} io_backend_type_t;
+
+void io_init_terminal(io_backend_type_t backend);
 void io_reset_terminal(void);
 void io_display(dungeon *d);
 void io_handle_input(dungeon *d);
 void io_queue_message(const char *format, ...);
+void io_queue_pause(void);
+uint32_t io_key_pending(void);
+/* Everything on the map has moved x and y cells toward the origin (see *
+ * world.cpp); so does the view, so that the screen stays put.          */
+void io_shift_view(int16_t x, int16_t y);
 
 #endif
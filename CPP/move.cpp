@@ -16,6 +16,13 @@
 #include "io.h"
 #include "npc.h"
 #include "object.h"
+#include "bitboard.h"
+#include "spatial.h"
+#include "profile.h"
+#include "replay.h"
+#include "zobrist.h"
+#include "world.h"
+#include "intent.h"
 
 void do_combat(dungeon *d, character *atk, character *def)
 {
@@ -65,10 +72,12 @@ void do_combat(dungeon *d, character *atk, character *def)
 	dmg += (*d->PC->equipment[i]).roll_dice();
       }
     }
+    zobrist_toggle_character(d, def);
     def->hp -= dmg;
     if(def->hp < 0) {
       def->alive = 0;
       charpair(def->position) = nullptr;
+      spatial_remove(d, def);
       d->num_monsters--;
       io_queue_message("You smite %s%s!", is_unique(def) ? "" : "the ", def->name);
       
@@ -81,13 +90,14 @@ void do_combat(dungeon *d, character *atk, character *def)
 	io_queue_message("As you land the final blow, %s falls to", def->name);
 	io_queue_message("their knees. The light begins to fade from their eyes");
 	io_queue_message("and an eerie hush falls over the dungeon...");
-	io_queue_message("");
+	io_queue_pause();
       }
     } else {
       io_queue_message("You deal %d damage to %s%s", dmg, is_unique(def) ? "" : "the ", def->name);
     }
   } else {
     dmg = (*atk->damage).roll();
+    zobrist_toggle_character(d, def);
     def->hp -= dmg;    
     if(def->hp < 0) {
       def->alive = 0;
@@ -97,21 +107,21 @@ void do_combat(dungeon *d, character *atk, character *def)
 			 atk->name, organs[rand() % (sizeof (organs) /
 						     sizeof (organs[0]))]);
 	io_queue_message("   ...you wonder if there is an afterlife.");
-	/* Queue an empty message, otherwise the game will not pause for *
-	 * player to see above.                                          */
-	io_queue_message("");
       } else {
 	io_queue_message("Your last thoughts fade away as "
 			 "%s%s eats your %s...",
 			 is_unique(atk) ? "" : "the ",
 			 atk->name, organs[part]);
-	io_queue_message("");
       }
-      /* Queue an empty message, otherwise the game will not pause for *
-       * player to see above.                                          */
-      io_queue_message("");
+      /* Wait for a key, or the player won't get to see the above. */
+      io_queue_pause();
     }
   }
+
+  /* Unless it died and left the map */
+  if (def->alive) {
+    zobrist_toggle_character(d, def);
+  }
 }
 
 void move_character(dungeon *d, character *c, pair_t next)
@@ -138,23 +148,34 @@ void move_character(dungeon *d, character *c, pair_t next)
     } else {
       /* NPC moving into other NPC so displace or swap */
       uint32_t move = (rand() % 8);
-      pair_t dest; 
+      uint32_t open = bitboard_window(d->passable, next[dim_x], next[dim_y]);
+      pair_t dest, from;
       if(charxy((next[dim_x] + moveset[move][0]), (next[dim_y] + moveset[move][1])) == c) {
 	move = (move + 1) % 8;
       }
       for(uint32_t cnt = 0; cnt < 8; cnt++) {
 	dest[dim_x] = next[dim_x] + moveset[move][0];
 	dest[dim_y] = next[dim_y] + moveset[move][1];
-	if((charpair(dest) == c) || ((mappair(dest) >= ter_floor) && !charpair(dest))) {
+	if((charpair(dest) == c) ||
+	   ((open & window_bit(moveset[move][0], moveset[move][1])) &&
+	    !charpair(dest))) {
+	  zobrist_toggle_character(d, c);
+	  zobrist_toggle_character(d, charpair(next));
 	  charpair(c->position) = nullptr;
 	  
 	  charpair(next)->position[dim_x] = dest[dim_x];
 	  charpair(next)->position[dim_y] = dest[dim_y];
 	  charpair(dest) = charpair(next);
+	  spatial_move(d, charpair(dest), next);
 	  
+	  from[dim_x] = c->position[dim_x];
+	  from[dim_y] = c->position[dim_y];
 	  c->position[dim_x] = next[dim_x];
 	  c->position[dim_y] = next[dim_y];
 	  charpair(next) = c;
+	  spatial_move(d, c, from);
+	  zobrist_toggle_character(d, c);
+	  zobrist_toggle_character(d, charpair(dest));
 	  break;
 	}
 	move = (move + 1) % 8;
@@ -162,11 +183,17 @@ void move_character(dungeon *d, character *c, pair_t next)
     }
   } else {
     /* No character in new position. */
+    pair_t from = { c->position[dim_x], c->position[dim_y] };
 
+    zobrist_toggle_character(d, c);
     d->character_map[c->position[dim_y]][c->position[dim_x]] = NULL;
     c->position[dim_y] = next[dim_y];
     c->position[dim_x] = next[dim_x];
     d->character_map[c->position[dim_y]][c->position[dim_x]] = c;
+    zobrist_toggle_character(d, c);
+    if (c != d->PC) {
+      spatial_move(d, c, from);
+    }
   }
 
   if (c == d->PC) {
@@ -177,7 +204,8 @@ void move_character(dungeon *d, character *c, pair_t next)
 
 void do_moves(dungeon *d)
 {
-  pair_t next;
+  PROFILE_SCOPE("do_moves");
+  npc_intent_t *i;
   character *c;
   event *e;
 
@@ -206,7 +234,7 @@ void do_moves(dungeon *d)
   }
 
   while (pc_is_alive(d) &&
-         (e = (event *) heap_remove_min(&d->events)) &&
+         (e = intent_next(d)) &&
          ((e->type != event_character_turn) || (e->c != d->PC))) {
     d->time = e->time;
     if (e->type == event_character_turn) {
@@ -222,13 +250,31 @@ void do_moves(dungeon *d)
       continue;
     }
 
-    npc_next_pos(d, (npc *) c, next);
-    move_character(d, (npc *) c, next);
+    if (d->dormant && npc_dormant_turn(d, (npc *) c, e)) {
+      continue;
+    }
+
+    if (d->lod && npc_lod_turn(d, (npc *) c, e)) {
+      continue;
+    }
+
+    {
+      PROFILE_SCOPE_DETAIL("npc turn", c->name);
+      i = intent_get(d, (npc *) c);
+      npc_commit(d, (npc *) c, i);
+      move_character(d, (npc *) c, i->next);
+    }
 
     heap_insert(&d->events, update_event(d, e, 1000 / c->speed));
   }
 
-  io_display(d);
+  /* Anything --threads took off the queue that the PC didn't live to see */
+  intent_flush(d);
+
+  PROFILE_COUNTER("event queue", d->events.size);
+  PROFILE_COUNTER("live monsters", d->num_monsters);
+  PROFILE_COUNTER("heap bytes", profile_heap_bytes());
+
   if (pc_is_alive(d) && e->c == d->PC) {
     c = e->c;
     d->time = e->time;
@@ -237,10 +283,175 @@ void do_moves(dungeon *d)
      * and recreated every time we leave and re-enter this function.    */
     e->c = NULL;
     event_delete(e);
-    io_handle_input(d);
+    world_follow_pc(d);
+    if (d->dormant) {
+      npc_dormant_wake(d);
+    }
+    if (d->lod) {
+      npc_lod_promote(d);
+    }
+    replay_turn(d);
+    if (d->autopilot) {
+      move_pc_autopilot(d);
+    } else if (!move_pc_keep_running(d)) {
+      io_display(d);
+      io_handle_input(d);
+    }
+  } else if (!d->autopilot) {
+    io_display(d);
+  }
+}
+
+/* The PC's AI from before it had a player, pc_next_pos(), takes the *
+ * turn.  Bumping into walls just wastes it, quietly, since there's  *
+ * nobody to tell.                                                    */
+void move_pc_autopilot(dungeon *d)
+{
+  pair_t dir, next;
+
+  pc_next_pos(d, dir);
+  if (!dir[dim_x] && !dir[dim_y]) {
+    return;
+  }
+
+  next[dim_x] = d->PC->position[dim_x] + dir[dim_x];
+  next[dim_y] = d->PC->position[dim_y] + dir[dim_y];
+  if (mappair(next) >= ter_floor) {
+    move_character(d, d->PC, next);
+    dijkstra(d);
+    dijkstra_tunnel(d);
   }
 }
 
+/* Running takes the PC's turns for it, one step after another without *
+ * drawing anything or reading a key, until something worth stopping   *
+ * for happens: a monster comes into view, an object turns up, the PC   *
+ * gets hurt, the corridor forks or the way ahead ends, or a key is     *
+ * pressed.  Resting is running in direction 5: it stays put until      *
+ * disturbed.  Nobody runs forever, in case of a loop.                  */
+#define RUN_MAX_TURNS 100
+
+static uint32_t run_monster_in_view(dungeon *d)
+{
+  character *c[(2 * PC_VISUAL_RANGE + 1) * (2 * PC_VISUAL_RANGE + 1)];
+  uint32_t count, i;
+
+  count = spatial_query(d, d->PC->position, PC_VISUAL_RANGE,
+                        c, sizeof (c) / sizeof (c[0]));
+  for (i = 0; i < count; i++) {
+    if (can_see(d, d->PC->position, c[i]->position, 1, 0)) {
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+/* Which way to take the next step, or zero to stop.  In a room we just *
+ * keep going straight while there's room floor ahead.  In a corridor   *
+ * we follow it around corners, so we look at every open cell next to  *
+ * us that isn't behind us.  Corridors are dug four-connected, so a     *
+ * diagonal that touches one of the straight ways on is the same way    *
+ * on, cutting the corner.  One way on is the way we go; none is a dead *
+ * end, and more is a fork.                                             */
+static uint32_t run_next_dir(dungeon *d)
+{
+  static const uint32_t keypad[3][3] = {
+    { 7, 8, 9 },
+    { 4, 5, 6 },
+    { 1, 2, 3 }
+  };
+  int16_t dx, dy, ox, oy, x, y, way_x, way_y;
+  uint32_t open[3][3];
+  uint32_t ways;
+
+  x = d->PC->position[dim_x];
+  y = d->PC->position[dim_y];
+  dx = (d->PC->run % 3 == 1) ? -1 : (d->PC->run % 3 == 0) ? 1 : 0;
+  dy = (d->PC->run <= 3) ? 1 : (d->PC->run >= 7) ? -1 : 0;
+
+  if (mapxy(x, y) != ter_floor_hall) {
+    return (mapxy(x + dx, y + dy) == ter_floor_room) ? d->PC->run : 0;
+  }
+
+  for (oy = -1; oy <= 1; oy++) {
+    for (ox = -1; ox <= 1; ox++) {
+      open[oy + 1][ox + 1] = ((ox || oy) && (ox * dx + oy * dy >= 0) &&
+                              passablexy(x + ox, y + oy));
+    }
+  }
+
+  ways = 0;
+  way_x = way_y = 0;
+  for (oy = -1; oy <= 1; oy++) {
+    for (ox = -1; ox <= 1; ox++) {
+      if (open[oy + 1][ox + 1] &&
+          !(ox && oy && (open[1][ox + 1] || open[oy + 1][1]))) {
+        ways++;
+        way_x = ox;
+        way_y = oy;
+      }
+    }
+  }
+
+  /* Stop at the mouth of a room rather than run on into it. */
+  if (ways != 1 || mapxy(x + way_x, y + way_y) != ter_floor_hall) {
+    return 0;
+  }
+
+  return keypad[way_y + 1][way_x + 1];
+}
+
+uint32_t move_pc_keep_running(dungeon *d)
+{
+  uint32_t dir;
+
+  if (!d->PC->run) {
+    return 0;
+  }
+
+  if (io_key_pending()                                  ||
+      d->PC->hp < d->PC->run_hp                         ||
+      d->PC->objects_seen > d->PC->run_objects          ||
+      (d->PC->run != 5 && objpair(d->PC->position))     ||
+      run_monster_in_view(d)                            ||
+      ++d->PC->run_turns > RUN_MAX_TURNS                ||
+      !(dir = (d->PC->run == 5) ? 5 : run_next_dir(d))) {
+    d->PC->run = 0;
+
+    return 0;
+  }
+
+  d->PC->run = dir;
+  d->PC->run_hp = d->PC->hp;
+  d->PC->run_objects = d->PC->objects_seen;
+
+  /* Standing still changes nothing that move_pc() would recompute. */
+  if (dir != 5) {
+    move_pc(d, dir);
+  }
+
+  return 1;
+}
+
+/* Takes the first step of a run, which counts as the PC's turn just like *
+ * move_pc(), and returns what it returns.                                */
+uint32_t move_pc_run(dungeon *d, uint32_t dir)
+{
+  uint32_t fail_code;
+
+  d->PC->run_turns = 0;
+  d->PC->run_hp = d->PC->hp;
+  d->PC->run_objects = d->PC->objects_seen;
+
+  if (dir != 5 && (fail_code = move_pc(d, dir))) {
+    return fail_code;
+  }
+  d->PC->run = dir;
+
+  return 0;
+}
+
 void dir_nearest_wall(dungeon *d, character *c, pair_t dir)
 {
   dir[dim_x] = dir[dim_y] = 0;
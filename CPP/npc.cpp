@@ -8,6 +8,11 @@
 #include "path.h"
 #include "event.h"
 #include "pc.h"
+#include "bitboard.h"
+#include "spatial.h"
+#include "zobrist.h"
+#include "profile.h"
+#include "flow.h"
 
 static uint32_t max_monster_cells(dungeon *d)
 {
@@ -39,7 +44,42 @@ void gen_monsters(dungeon *d)
   }
 }
 
-void npc_next_pos_rand_tunnel(dungeon *d, npc *c, pair_t next)
+/* Every dig npc_commit() has carried out */
+static uint32_t npc_dig_count;
+
+/* A monster's random numbers come from its own stream, so what it does *
+ * doesn't depend on how many numbers anybody else drew first.  This is *
+ * splitmix32: add the golden ratio, then mix.  Like rand(), it's never *
+ * negative.                                                            */
+static uint32_t npc_rand(uint32_t *rng)
+{
+  uint32_t z;
+
+  z = (*rng += 0x9e3779b9);
+  z = (z ^ (z >> 16)) * 0x85ebca6b;
+  z = (z ^ (z >> 13)) * 0xc2b2ae35;
+
+  return (z ^ (z >> 16)) & RAND_MAX;
+}
+
+/* A tunneler heading into p goes straight in if there's 85 or less of *
+ * the rock left, digging out whatever there is, and otherwise stays   *
+ * put and digs away 85 of it.  npc_commit() does the digging.         */
+static void npc_tunnel_into(dungeon *d, npc_intent_t *i, pair_t p)
+{
+  if (hardnesspair(p)) {
+    i->dig = hardnesspair(p) <= 85 ? npc_dig_through : npc_dig_some;
+    i->dig_at[dim_y] = p[dim_y];
+    i->dig_at[dim_x] = p[dim_x];
+  }
+
+  if (hardnesspair(p) <= 85) {
+    i->next[dim_y] = p[dim_y];
+    i->next[dim_x] = p[dim_x];
+  }
+}
+
+void npc_next_pos_rand_tunnel(dungeon *d, npc *c, npc_intent_t *i)
 {
   pair_t n;
   union {
@@ -48,9 +88,9 @@ void npc_next_pos_rand_tunnel(dungeon *d, npc *c, pair_t next)
   } r;
 
   do {
-    n[dim_y] = next[dim_y];
-    n[dim_x] = next[dim_x];
-    r.i = rand();
+    n[dim_y] = i->next[dim_y];
+    n[dim_x] = i->next[dim_x];
+    r.i = npc_rand(&i->rng);
     if (r.a[0] > 85 /* 255 / 3 */) {
       if (r.a[0] & 1) {
         n[dim_y]--;
@@ -67,35 +107,31 @@ void npc_next_pos_rand_tunnel(dungeon *d, npc *c, pair_t next)
     }
   } while (mappair(n) == ter_wall_immutable);
 
-  if (hardnesspair(n) <= 85) {
-    if (hardnesspair(n)) {
-      hardnesspair(n) = 0;
-      mappair(n) = ter_floor_hall;
-
-      /* Update distance maps because map has changed. */
-      dijkstra(d);
-      dijkstra_tunnel(d);
-    }
-
-    next[dim_x] = n[dim_x];
-    next[dim_y] = n[dim_y];
-  } else {
-    hardnesspair(n) -= 85;
-  }
+  npc_tunnel_into(d, i, n);
 }
 
-void npc_next_pos_rand(dungeon *d, npc *c, pair_t next)
+void npc_next_pos_rand(dungeon *d, npc *c, npc_intent_t *i)
 {
   pair_t n;
   union {
     uint32_t i;
     uint8_t a[4];
   } r;
+  uint32_t open;
+
+  /* Fetch all eight neighbours at once, rather than go back *
+   * to the map every time the dice send us into a wall.     */
+  open = bitboard_window(d->passable, i->next[dim_x], i->next[dim_y]);
+  if (!open) {
+    /* Walled in, right where we stand (a PASS monster can shove us into *
+     * the rock).  No roll will ever get us out, so stay put.            */
+    return;
+  }
 
   do {
-    n[dim_y] = next[dim_y];
-    n[dim_x] = next[dim_x];
-    r.i = rand();
+    n[dim_y] = i->next[dim_y];
+    n[dim_x] = i->next[dim_x];
+    r.i = npc_rand(&i->rng);
     if (r.a[0] > 85 /* 255 / 3 */) {
       if (r.a[0] & 1) {
         n[dim_y]--;
@@ -110,13 +146,14 @@ void npc_next_pos_rand(dungeon *d, npc *c, pair_t next)
         n[dim_x]++;
       }
     }
-  } while (mappair(n) < ter_floor);
+  } while (!(open & window_bit(n[dim_x] - i->next[dim_x],
+                               n[dim_y] - i->next[dim_y])));
 
-  next[dim_y] = n[dim_y];
-  next[dim_x] = n[dim_x];
+  i->next[dim_y] = n[dim_y];
+  i->next[dim_x] = n[dim_x];
 }
 
-void npc_next_pos_rand_pass(dungeon *d, character *c, pair_t next)
+void npc_next_pos_rand_pass(dungeon *d, npc *c, npc_intent_t *i)
 {
   pair_t n;
   union {
@@ -125,9 +162,9 @@ void npc_next_pos_rand_pass(dungeon *d, character *c, pair_t next)
   } r;
 
   do {
-    n[dim_y] = next[dim_y];
-    n[dim_x] = next[dim_x];
-    r.i = rand();
+    n[dim_y] = i->next[dim_y];
+    n[dim_x] = i->next[dim_x];
+    r.i = npc_rand(&i->rng);
     if (r.a[0] > 85 /* 255 / 3 */) {
       if (r.a[0] & 1) {
         n[dim_y]--;
@@ -144,13 +181,14 @@ void npc_next_pos_rand_pass(dungeon *d, character *c, pair_t next)
     }
   } while (mappair(n) == ter_wall_immutable);
 
-  next[dim_y] = n[dim_y];
-  next[dim_x] = n[dim_x];
+  i->next[dim_y] = n[dim_y];
+  i->next[dim_x] = n[dim_x];
 }
 
 void npc_next_pos_line_of_sight(dungeon *d, character *c, pair_t next)
 {
   pair_t dir;
+  uint32_t open;
 
   dir[dim_y] = character_get_y(d->PC) - c->position[dim_y];
   dir[dim_x] = character_get_x(d->PC) - c->position[dim_x];
@@ -165,13 +203,13 @@ void npc_next_pos_line_of_sight(dungeon *d, character *c, pair_t next)
     next[dim_x] += dir[dim_x];
     next[dim_y] += dir[dim_y];
   } else {
-    if (mapxy(next[dim_x] + dir[dim_x],
-              next[dim_y] + dir[dim_y]) >= ter_floor) {
+    open = bitboard_window(d->passable, next[dim_x], next[dim_y]);
+    if (open & window_bit(dir[dim_x], dir[dim_y])) {
       next[dim_x] += dir[dim_x];
       next[dim_y] += dir[dim_y];
-    } else if (mapxy(next[dim_x] + dir[dim_x], next[dim_y]) >= ter_floor) {
+    } else if (open & window_bit(dir[dim_x], 0)) {
       next[dim_x] += dir[dim_x];
-    } else if (mapxy(next[dim_x], next[dim_y] + dir[dim_y]) >= ter_floor) {
+    } else if (open & window_bit(0, dir[dim_y])) {
       next[dim_y] += dir[dim_y];
     }
   }
@@ -179,7 +217,7 @@ void npc_next_pos_line_of_sight(dungeon *d, character *c, pair_t next)
 
 void npc_next_pos_line_of_sight_tunnel(dungeon *d,
                                        npc *c,
-                                       pair_t next)
+                                       npc_intent_t *i)
 {
   pair_t dir;
 
@@ -192,470 +230,432 @@ void npc_next_pos_line_of_sight_tunnel(dungeon *d,
     dir[dim_x] /= abs(dir[dim_x]);
   }
 
-  dir[dim_x] += next[dim_x];
-  dir[dim_y] += next[dim_y];
+  dir[dim_x] += i->next[dim_x];
+  dir[dim_y] += i->next[dim_y];
 
-  if (hardnesspair(dir) <= 85) {
-    if (hardnesspair(dir)) {
-      hardnesspair(dir) = 0;
-      mappair(dir) = ter_floor_hall;
+  npc_tunnel_into(d, i, dir);
+}
 
-      /* Update distance maps because map has changed. */
-      dijkstra(d);
-      dijkstra_tunnel(d);
-    }
+/* The order neighbours are tried in by npc_next_pos_gradient(): the *
+ * cardinal directions first, then the diagonals.  As { dx, dy }.     */
+static const int8_t gradient_order[8][2] = {
+  {  0, -1 }, {  0,  1 }, {  1,  0 }, { -1,  0 },
+  {  1, -1 }, {  1,  1 }, { -1, -1 }, { -1,  1 }
+};
 
-    next[dim_x] = dir[dim_x];
-    next[dim_y] = dir[dim_y];
+/* Steps i->next downhill on distance, digging if tunnel is set. */
+static void npc_next_pos_downhill(dungeon *d, const grid<uint16_t> &distance,
+                                  uint32_t tunnel, npc_intent_t *i)
+{
+  pair_t min_next;
+  uint32_t j, cost, min_cost;
+  int16_t x, y;
+
+  if (tunnel) {
+    /* Cheapest neighbour, counting the turns it takes to dig through.  *
+     * Sums are done in 32 bits, and the immutable walls around the map *
+     * are unreachable, so they're never chosen.                        */
+    for (min_cost = UINT32_MAX, j = 0; j < 8; j++) {
+      x = i->next[dim_x] + gradient_order[j][0];
+      y = i->next[dim_y] + gradient_order[j][1];
+      if (distance[y][x] == DISTANCE_UNREACHABLE) {
+        continue;
+      }
+      cost = distance[y][x] + d->hardness[y][x] / 85;
+      if (cost < min_cost) {
+        min_cost = cost;
+        min_next[dim_x] = x;
+        min_next[dim_y] = y;
+      }
+    }
+    if (min_cost == UINT32_MAX) {
+      return;
+    }
+    npc_tunnel_into(d, i, min_next);
   } else {
-    hardnesspair(dir) -= 85;
+    /* First neighbour that's closer, which makes monsters prefer the    *
+     * cardinal directions.  A monster cut off from where it's going has *
+     * nothing but DISTANCE_UNREACHABLE around it, so it stays put.      */
+    for (j = 0; j < 8; j++) {
+      x = i->next[dim_x] + gradient_order[j][0];
+      y = i->next[dim_y] + gradient_order[j][1];
+      if (distance[y][x] < distance[i->next[dim_y]][i->next[dim_x]]) {
+        i->next[dim_x] = x;
+        i->next[dim_y] = y;
+        return;
+      }
+    }
   }
 }
 
-void npc_next_pos_gradient(dungeon *d, npc *c, pair_t next)
+void npc_next_pos_gradient(dungeon *d, npc *c, npc_intent_t *i)
 {
   /* Handles both tunneling and non-tunneling versions */
-  pair_t min_next;
-  uint16_t min_cost;
   if (c->characteristics & NPC_TUNNEL) {
-    min_cost = (d->pc_tunnel[next[dim_y] - 1][next[dim_x]] +
-                (d->hardness[next[dim_y] - 1][next[dim_x]] / 85));
-    min_next[dim_x] = next[dim_x];
-    min_next[dim_y] = next[dim_y] - 1;
-    if ((d->pc_tunnel[next[dim_y] + 1][next[dim_x]    ] +
-         (d->hardness[next[dim_y] + 1][next[dim_x]] / 85)) < min_cost) {
-      min_cost = (d->pc_tunnel[next[dim_y] + 1][next[dim_x]] +
-                  (d->hardness[next[dim_y] + 1][next[dim_x]] / 85));
-      min_next[dim_x] = next[dim_x];
-      min_next[dim_y] = next[dim_y] + 1;
-    }
-    if ((d->pc_tunnel[next[dim_y]    ][next[dim_x] + 1] +
-         (d->hardness[next[dim_y]    ][next[dim_x] + 1] / 85)) < min_cost) {
-      min_cost = (d->pc_tunnel[next[dim_y]][next[dim_x] + 1] +
-                  (d->hardness[next[dim_y]][next[dim_x] + 1] / 85));
-      min_next[dim_x] = next[dim_x] + 1;
-      min_next[dim_y] = next[dim_y];
-    }
-    if ((d->pc_tunnel[next[dim_y]    ][next[dim_x] - 1] +
-         (d->hardness[next[dim_y]    ][next[dim_x] - 1] / 85)) < min_cost) {
-      min_cost = (d->pc_tunnel[next[dim_y]][next[dim_x] - 1] +
-                  (d->hardness[next[dim_y]][next[dim_x] - 1] / 85));
-      min_next[dim_x] = next[dim_x] - 1;
-      min_next[dim_y] = next[dim_y];
-    }
-    if ((d->pc_tunnel[next[dim_y] - 1][next[dim_x] + 1] +
-         (d->hardness[next[dim_y] - 1][next[dim_x] + 1] / 85)) < min_cost) {
-      min_cost = (d->pc_tunnel[next[dim_y] - 1][next[dim_x] + 1] +
-                  (d->hardness[next[dim_y] - 1][next[dim_x] + 1] / 85));
-      min_next[dim_x] = next[dim_x] + 1;
-      min_next[dim_y] = next[dim_y] - 1;
-    }
-    if ((d->pc_tunnel[next[dim_y] + 1][next[dim_x] + 1] +
-         (d->hardness[next[dim_y] + 1][next[dim_x] + 1] / 85)) < min_cost) {
-      min_cost = (d->pc_tunnel[next[dim_y] + 1][next[dim_x] + 1] +
-                  (d->hardness[next[dim_y] + 1][next[dim_x] + 1] / 85));
-      min_next[dim_x] = next[dim_x] + 1;
-      min_next[dim_y] = next[dim_y] + 1;
-    }
-    if ((d->pc_tunnel[next[dim_y] - 1][next[dim_x] - 1] +
-         (d->hardness[next[dim_y] - 1][next[dim_x] - 1] / 85)) < min_cost) {
-      min_cost = (d->pc_tunnel[next[dim_y] - 1][next[dim_x] - 1] +
-                  (d->hardness[next[dim_y] - 1][next[dim_x] - 1] / 85));
-      min_next[dim_x] = next[dim_x] - 1;
-      min_next[dim_y] = next[dim_y] - 1;
-    }
-    if ((d->pc_tunnel[next[dim_y] + 1][next[dim_x] - 1] +
-         (d->hardness[next[dim_y] + 1][next[dim_x] - 1] / 85)) < min_cost) {
-      min_cost = (d->pc_tunnel[next[dim_y] + 1][next[dim_x] - 1] +
-                  (d->hardness[next[dim_y] + 1][next[dim_x] - 1] / 85));
-      min_next[dim_x] = next[dim_x] - 1;
-      min_next[dim_y] = next[dim_y] + 1;
-    }
-    if (hardnesspair(min_next) <= 85) {
-      if (hardnesspair(min_next)) {
-        hardnesspair(min_next) = 0;
-        mappair(min_next) = ter_floor_hall;
-
-        /* Update distance maps because map has changed. */
-        dijkstra(d);
-        dijkstra_tunnel(d);
-      }
+    npc_next_pos_downhill(d, d->pc_tunnel, 1, i);
+  } else {
+    npc_next_pos_downhill(d, d->pc_distance, 0, i);
+  }
+}
 
-      next[dim_x] = min_next[dim_x];
-      next[dim_y] = min_next[dim_y];
-    } else {
-      hardnesspair(min_next) -= 85;
-    }
+/* --flow: heads downhill to where the PC was last seen, on the flow   *
+ * field for however c gets around.  A map that isn't cached yet is    *
+ * built into i, for npc_commit() to hand to the cache.  Returns zero, *
+ * having moved nowhere, without --flow or if c can't get there.       */
+static uint32_t npc_next_pos_flow(dungeon *d, npc *c, npc_intent_t *i)
+{
+  const grid<uint16_t> *distance;
+
+  if (!d->flow) {
+    return 0;
+  }
+
+  if (c->characteristics & NPC_PASS_WALL) {
+    i->flow_movement = flow_pass;
+  } else if (c->characteristics & NPC_TUNNEL) {
+    i->flow_movement = flow_tunnel;
   } else {
-    /* Make monsters prefer cardinal directions */
-    if (d->pc_distance[next[dim_y] - 1][next[dim_x]    ] <
-        d->pc_distance[next[dim_y]][next[dim_x]]) {
-      next[dim_y]--;
-      return;
-    }
-    if (d->pc_distance[next[dim_y] + 1][next[dim_x]    ] <
-        d->pc_distance[next[dim_y]][next[dim_x]]) {
-      next[dim_y]++;
-      return;
-    }
-    if (d->pc_distance[next[dim_y]    ][next[dim_x] + 1] <
-        d->pc_distance[next[dim_y]][next[dim_x]]) {
-      next[dim_x]++;
-      return;
-    }
-    if (d->pc_distance[next[dim_y]    ][next[dim_x] - 1] <
-        d->pc_distance[next[dim_y]][next[dim_x]]) {
-      next[dim_x]--;
-      return;
-    }
-    if (d->pc_distance[next[dim_y] - 1][next[dim_x] + 1] <
-        d->pc_distance[next[dim_y]][next[dim_x]]) {
-      next[dim_y]--;
-      next[dim_x]++;
-      return;
-    }
-    if (d->pc_distance[next[dim_y] + 1][next[dim_x] + 1] <
-        d->pc_distance[next[dim_y]][next[dim_x]]) {
-      next[dim_y]++;
-      next[dim_x]++;
-      return;
-    }
-    if (d->pc_distance[next[dim_y] - 1][next[dim_x] - 1] <
-        d->pc_distance[next[dim_y]][next[dim_x]]) {
-      next[dim_y]--;
-      next[dim_x]--;
-      return;
-    }
-    if (d->pc_distance[next[dim_y] + 1][next[dim_x] - 1] <
-        d->pc_distance[next[dim_y]][next[dim_x]]) {
-      next[dim_y]++;
-      next[dim_x]--;
-      return;
-    }
+    i->flow_movement = flow_walk;
+  }
+  i->flow = npc_flow_cached;
+  i->flow_goal[dim_x] = i->pc_last_known_position[dim_x];
+  i->flow_goal[dim_y] = i->pc_last_known_position[dim_y];
+
+  if (!(distance = flow_find(i->flow_goal, i->flow_movement))) {
+    flow_build(d, i->flow_goal, i->flow_movement, i->flow_built);
+    i->flow = npc_flow_built;
+    distance = &i->flow_built;
   }
+  if ((*distance)[c->position[dim_y]][c->position[dim_x]] ==
+      DISTANCE_UNREACHABLE) {
+    return 0;
+  }
+  npc_next_pos_downhill(d, *distance, i->flow_movement == flow_tunnel, i);
+
+  return 1;
 }
 
-static void npc_next_pos_00(dungeon *d, npc *c, pair_t next)
+static void npc_next_pos_00(dungeon *d, npc *c, npc_intent_t *i)
 {
   /* not smart; not telepathic; not tunneling; not erratic */
   if (can_see(d, character_get_pos(c), character_get_pos(d->PC), 0, 0)) {
-    c->pc_last_known_position[dim_y] = d->PC->position[dim_y];
-    c->pc_last_known_position[dim_x] = d->PC->position[dim_x];
-    npc_next_pos_line_of_sight(d, c, next);
+    i->pc_last_known_position[dim_y] = d->PC->position[dim_y];
+    i->pc_last_known_position[dim_x] = d->PC->position[dim_x];
+    npc_next_pos_line_of_sight(d, c, i->next);
   } else {
-    npc_next_pos_rand(d, c, next);
+    npc_next_pos_rand(d, c, i);
   }
 }
 
-static void npc_next_pos_01(dungeon *d, npc *c, pair_t next)
+static void npc_next_pos_01(dungeon *d, npc *c, npc_intent_t *i)
 {
   /*     smart; not telepathic; not tunneling; not erratic */
   if (can_see(d, character_get_pos(c), character_get_pos(d->PC), 0, 0)) {
-    c->pc_last_known_position[dim_y] = d->PC->position[dim_y];
-    c->pc_last_known_position[dim_x] = d->PC->position[dim_x];
-    c->have_seen_pc = 1;
-    npc_next_pos_line_of_sight(d, c, next);
-  } else if (c->have_seen_pc) {
-    npc_next_pos_line_of_sight(d, c, next);
+    i->pc_last_known_position[dim_y] = d->PC->position[dim_y];
+    i->pc_last_known_position[dim_x] = d->PC->position[dim_x];
+    i->have_seen_pc = 1;
+    npc_next_pos_line_of_sight(d, c, i->next);
+  } else if (i->have_seen_pc && !npc_next_pos_flow(d, c, i)) {
+    npc_next_pos_line_of_sight(d, c, i->next);
   }
 
-  if ((next[dim_x] == c->pc_last_known_position[dim_x]) &&
-      (next[dim_y] == c->pc_last_known_position[dim_y])) {
-    c->have_seen_pc = 0;
+  if ((i->next[dim_x] == i->pc_last_known_position[dim_x]) &&
+      (i->next[dim_y] == i->pc_last_known_position[dim_y])) {
+    i->have_seen_pc = 0;
   }
 }
 
-static void npc_next_pos_02(dungeon *d, npc *c, pair_t next)
+static void npc_next_pos_02(dungeon *d, npc *c, npc_intent_t *i)
 {
   /* not smart;     telepathic; not tunneling; not erratic */
-  c->pc_last_known_position[dim_y] = d->PC->position[dim_y];
-  c->pc_last_known_position[dim_x] = d->PC->position[dim_x];
-  npc_next_pos_line_of_sight(d, c, next);
+  i->pc_last_known_position[dim_y] = d->PC->position[dim_y];
+  i->pc_last_known_position[dim_x] = d->PC->position[dim_x];
+  npc_next_pos_line_of_sight(d, c, i->next);
 }
 
-static void npc_next_pos_03(dungeon *d, npc *c, pair_t next)
+static void npc_next_pos_03(dungeon *d, npc *c, npc_intent_t *i)
 {
   /*     smart;     telepathic; not tunneling; not erratic */
-  npc_next_pos_gradient(d, c, next);
+  npc_next_pos_gradient(d, c, i);
 }
 
-static void npc_next_pos_04(dungeon *d, npc *c, pair_t next)
+static void npc_next_pos_04(dungeon *d, npc *c, npc_intent_t *i)
 {
   /* not smart; not telepathic;     tunneling; not erratic */
   if (can_see(d, character_get_pos(c), character_get_pos(d->PC), 0, 0)) {
-    c->pc_last_known_position[dim_y] = d->PC->position[dim_y];
-    c->pc_last_known_position[dim_x] = d->PC->position[dim_x];
-    npc_next_pos_line_of_sight(d, c, next);
+    i->pc_last_known_position[dim_y] = d->PC->position[dim_y];
+    i->pc_last_known_position[dim_x] = d->PC->position[dim_x];
+    npc_next_pos_line_of_sight(d, c, i->next);
   } else {
-    npc_next_pos_rand_tunnel(d, c, next);
+    npc_next_pos_rand_tunnel(d, c, i);
   }
 }
 
-static void npc_next_pos_05(dungeon *d, npc *c, pair_t next)
+static void npc_next_pos_05(dungeon *d, npc *c, npc_intent_t *i)
 {
   /*     smart; not telepathic;     tunneling; not erratic */
   if (can_see(d, character_get_pos(c), character_get_pos(d->PC), 0, 0)) {
-    c->pc_last_known_position[dim_y] = d->PC->position[dim_y];
-    c->pc_last_known_position[dim_x] = d->PC->position[dim_x];
-    c->have_seen_pc = 1;
-    npc_next_pos_line_of_sight(d, c, next);
-  } else if (c->have_seen_pc) {
-    npc_next_pos_line_of_sight_tunnel(d, c, next);
+    i->pc_last_known_position[dim_y] = d->PC->position[dim_y];
+    i->pc_last_known_position[dim_x] = d->PC->position[dim_x];
+    i->have_seen_pc = 1;
+    npc_next_pos_line_of_sight(d, c, i->next);
+  } else if (i->have_seen_pc && !npc_next_pos_flow(d, c, i)) {
+    npc_next_pos_line_of_sight_tunnel(d, c, i);
   }
 
-  if ((next[dim_x] == c->pc_last_known_position[dim_x]) &&
-      (next[dim_y] == c->pc_last_known_position[dim_y])) {
-    c->have_seen_pc = 0;
+  if ((i->next[dim_x] == i->pc_last_known_position[dim_x]) &&
+      (i->next[dim_y] == i->pc_last_known_position[dim_y])) {
+    i->have_seen_pc = 0;
   }
 }
 
-static void npc_next_pos_06(dungeon *d, npc *c, pair_t next)
+static void npc_next_pos_06(dungeon *d, npc *c, npc_intent_t *i)
 {
   /* not smart;     telepathic;     tunneling; not erratic */
-  c->pc_last_known_position[dim_y] = d->PC->position[dim_y];
-  c->pc_last_known_position[dim_x] = d->PC->position[dim_x];
-  npc_next_pos_line_of_sight_tunnel(d, c, next);
+  i->pc_last_known_position[dim_y] = d->PC->position[dim_y];
+  i->pc_last_known_position[dim_x] = d->PC->position[dim_x];
+  npc_next_pos_line_of_sight_tunnel(d, c, i);
 }
 
-static void npc_next_pos_07(dungeon *d, npc *c, pair_t next)
+static void npc_next_pos_07(dungeon *d, npc *c, npc_intent_t *i)
 {
   /*     smart;     telepathic;     tunneling; not erratic */
-  npc_next_pos_gradient(d, c, next);
+  npc_next_pos_gradient(d, c, i);
 }
 
-static void npc_next_pos_08(dungeon *d, npc *c, pair_t next)
+static void npc_next_pos_08(dungeon *d, npc *c, npc_intent_t *i)
 {
   /* not smart; not telepathic; not tunneling;     erratic */
-  if (rand() & 1) {
-    npc_next_pos_rand(d, c, next);
+  if (npc_rand(&i->rng) & 1) {
+    npc_next_pos_rand(d, c, i);
   } else {
-    npc_next_pos_00(d, c, next);
+    npc_next_pos_00(d, c, i);
   }
 }
 
-static void npc_next_pos_09(dungeon *d, npc *c, pair_t next)
+static void npc_next_pos_09(dungeon *d, npc *c, npc_intent_t *i)
 {
   /*     smart; not telepathic; not tunneling;     erratic */
-  if (rand() & 1) {
-    npc_next_pos_rand(d, c, next);
+  if (npc_rand(&i->rng) & 1) {
+    npc_next_pos_rand(d, c, i);
   } else {
-    npc_next_pos_01(d, c, next);
+    npc_next_pos_01(d, c, i);
   }
 }
 
-static void npc_next_pos_0a(dungeon *d, npc *c, pair_t next)
+static void npc_next_pos_0a(dungeon *d, npc *c, npc_intent_t *i)
 {
   /* not smart;     telepathic; not tunneling;     erratic */
-  if (rand() & 1) {
-    npc_next_pos_rand(d, c, next);
+  if (npc_rand(&i->rng) & 1) {
+    npc_next_pos_rand(d, c, i);
   } else {
-    npc_next_pos_02(d, c, next);
+    npc_next_pos_02(d, c, i);
   }
 }
 
-static void npc_next_pos_0b(dungeon *d, npc *c, pair_t next)
+static void npc_next_pos_0b(dungeon *d, npc *c, npc_intent_t *i)
 {
   /*     smart;     telepathic; not tunneling;     erratic */
-  if (rand() & 1) {
-    npc_next_pos_rand(d, c, next);
+  if (npc_rand(&i->rng) & 1) {
+    npc_next_pos_rand(d, c, i);
   } else {
-    npc_next_pos_03(d, c, next);
+    npc_next_pos_03(d, c, i);
   }
 }
 
-static void npc_next_pos_0c(dungeon *d, npc *c, pair_t next)
+static void npc_next_pos_0c(dungeon *d, npc *c, npc_intent_t *i)
 {
   /* not smart; not telepathic;     tunneling;     erratic */
-  if (rand() & 1) {
-    npc_next_pos_rand_tunnel(d, c, next);
+  if (npc_rand(&i->rng) & 1) {
+    npc_next_pos_rand_tunnel(d, c, i);
   } else {
-    npc_next_pos_04(d, c, next);
+    npc_next_pos_04(d, c, i);
   }
 }
 
-static void npc_next_pos_0d(dungeon *d, npc *c, pair_t next)
+static void npc_next_pos_0d(dungeon *d, npc *c, npc_intent_t *i)
 {
   /*     smart; not telepathic;     tunneling;     erratic */
-  if (rand() & 1) {
-    npc_next_pos_rand_tunnel(d, c, next);
+  if (npc_rand(&i->rng) & 1) {
+    npc_next_pos_rand_tunnel(d, c, i);
   } else {
-    npc_next_pos_05(d, c, next);
+    npc_next_pos_05(d, c, i);
   }
 }
 
-static void npc_next_pos_0e(dungeon *d, npc *c, pair_t next)
+static void npc_next_pos_0e(dungeon *d, npc *c, npc_intent_t *i)
 {
   /* not smart;     telepathic;     tunneling;     erratic */
-  if (rand() & 1) {
-    npc_next_pos_rand_tunnel(d, c, next);
+  if (npc_rand(&i->rng) & 1) {
+    npc_next_pos_rand_tunnel(d, c, i);
   } else {
-    npc_next_pos_06(d, c, next);
+    npc_next_pos_06(d, c, i);
   }
 }
 
-static void npc_next_pos_0f(dungeon *d, npc *c, pair_t next)
+static void npc_next_pos_0f(dungeon *d, npc *c, npc_intent_t *i)
 {
   /*     smart;     telepathic;     tunneling;     erratic */
-  if (rand() & 1) {
-    npc_next_pos_rand_tunnel(d, c, next);
+  if (npc_rand(&i->rng) & 1) {
+    npc_next_pos_rand_tunnel(d, c, i);
   } else {
-    npc_next_pos_07(d, c, next);
+    npc_next_pos_07(d, c, i);
   }
 }
 
-static void npc_next_pos_10(dungeon *d, npc *c, pair_t next)
+static void npc_next_pos_10(dungeon *d, npc *c, npc_intent_t *i)
 {
-  npc_next_pos_00(d, c, next);
+  npc_next_pos_00(d, c, i);
 }
 
-static void npc_next_pos_11(dungeon *d, npc *c, pair_t next)
+static void npc_next_pos_11(dungeon *d, npc *c, npc_intent_t *i)
 {
   /* pass wall;     smart; not telepathic; not tunneling; not erratic */
   if (can_see(d, character_get_pos(c), character_get_pos(d->PC), 0, 0)) {
-    c->pc_last_known_position[dim_y] = character_get_y(d->PC);
-    c->pc_last_known_position[dim_x] = character_get_x(d->PC);
-    c->have_seen_pc = 1;
-    npc_next_pos_line_of_sight(d, c, next);
-  } else if (c->have_seen_pc) {
-    npc_next_pos_line_of_sight(d, c, next);
+    i->pc_last_known_position[dim_y] = character_get_y(d->PC);
+    i->pc_last_known_position[dim_x] = character_get_x(d->PC);
+    i->have_seen_pc = 1;
+    npc_next_pos_line_of_sight(d, c, i->next);
+  } else if (i->have_seen_pc && !npc_next_pos_flow(d, c, i)) {
+    npc_next_pos_line_of_sight(d, c, i->next);
   }
 
-  if ((next[dim_x] == c->pc_last_known_position[dim_x]) &&
-      (next[dim_y] == c->pc_last_known_position[dim_y])) {
-    c->have_seen_pc = 0;
+  if ((i->next[dim_x] == i->pc_last_known_position[dim_x]) &&
+      (i->next[dim_y] == i->pc_last_known_position[dim_y])) {
+    i->have_seen_pc = 0;
   }
 }
 
-static void npc_next_pos_12(dungeon *d, npc *c, pair_t next)
+static void npc_next_pos_12(dungeon *d, npc *c, npc_intent_t *i)
 {
   /* pass wall; not smart;     telepathic; not tunneling; not erratic */
-  c->pc_last_known_position[dim_y] = character_get_y(d->PC);
-  c->pc_last_known_position[dim_x] = character_get_x(d->PC);
-  npc_next_pos_line_of_sight(d, c, next);
+  i->pc_last_known_position[dim_y] = character_get_y(d->PC);
+  i->pc_last_known_position[dim_x] = character_get_x(d->PC);
+  npc_next_pos_line_of_sight(d, c, i->next);
 }
 
-static void npc_next_pos_13(dungeon *d, npc *c, pair_t next)
+static void npc_next_pos_13(dungeon *d, npc *c, npc_intent_t *i)
 {
   /* pass wall;     smart;     telepathic; not tunneling; not erratic */
-  c->pc_last_known_position[dim_y] = character_get_y(d->PC);
-  c->pc_last_known_position[dim_x] = character_get_x(d->PC);
-  npc_next_pos_line_of_sight(d, c, next);
+  i->pc_last_known_position[dim_y] = character_get_y(d->PC);
+  i->pc_last_known_position[dim_x] = character_get_x(d->PC);
+  npc_next_pos_line_of_sight(d, c, i->next);
 }
 
-static void npc_next_pos_14(dungeon *d, npc *c, pair_t next)
+static void npc_next_pos_14(dungeon *d, npc *c, npc_intent_t *i)
 {
   /* pass wall; not smart; not telepathic;     tunneling; not erratic */
   if (can_see(d, character_get_pos(c), character_get_pos(d->PC), 0, 0)) {
-    c->pc_last_known_position[dim_y] = character_get_y(d->PC);
-    c->pc_last_known_position[dim_x] = character_get_x(d->PC);
-    npc_next_pos_line_of_sight(d, c, next);
+    i->pc_last_known_position[dim_y] = character_get_y(d->PC);
+    i->pc_last_known_position[dim_x] = character_get_x(d->PC);
+    npc_next_pos_line_of_sight(d, c, i->next);
   } else {
-    npc_next_pos_rand_pass(d, c, next);
+    npc_next_pos_rand_pass(d, c, i);
   }
 }
 
-static void npc_next_pos_15(dungeon *d, npc *c, pair_t next)
+static void npc_next_pos_15(dungeon *d, npc *c, npc_intent_t *i)
 {
-  npc_next_pos_11(d, c, next);
+  npc_next_pos_11(d, c, i);
 }
 
-static void npc_next_pos_16(dungeon *d, npc *c, pair_t next)
+static void npc_next_pos_16(dungeon *d, npc *c, npc_intent_t *i)
 {
   /* pass wall; not smart;     telepathic;     tunneling; not erratic */
-  c->pc_last_known_position[dim_y] = character_get_y(d->PC);
-  c->pc_last_known_position[dim_x] = character_get_x(d->PC);
-  npc_next_pos_line_of_sight(d, c, next);
+  i->pc_last_known_position[dim_y] = character_get_y(d->PC);
+  i->pc_last_known_position[dim_x] = character_get_x(d->PC);
+  npc_next_pos_line_of_sight(d, c, i->next);
 }
 
-static void npc_next_pos_17(dungeon *d, npc *c, pair_t next)
+static void npc_next_pos_17(dungeon *d, npc *c, npc_intent_t *i)
 {
   /* pass wall;     smart;     telepathic;     tunneling; not erratic */
-  c->pc_last_known_position[dim_y] = character_get_y(d->PC);
-  c->pc_last_known_position[dim_x] = character_get_x(d->PC);
-  npc_next_pos_line_of_sight(d, c, next);
+  i->pc_last_known_position[dim_y] = character_get_y(d->PC);
+  i->pc_last_known_position[dim_x] = character_get_x(d->PC);
+  npc_next_pos_line_of_sight(d, c, i->next);
 }
 
-static void npc_next_pos_18(dungeon *d, npc *c, pair_t next)
+static void npc_next_pos_18(dungeon *d, npc *c, npc_intent_t *i)
 {
   /* pass wall; not smart; not telepathic; not tunneling;     erratic */
-  if (rand() & 1) {
-    npc_next_pos_rand_pass(d, c, next);
+  if (npc_rand(&i->rng) & 1) {
+    npc_next_pos_rand_pass(d, c, i);
   } else {
-    npc_next_pos_10(d, c, next);
+    npc_next_pos_10(d, c, i);
   }
 }
 
-static void npc_next_pos_19(dungeon *d, npc *c, pair_t next)
+static void npc_next_pos_19(dungeon *d, npc *c, npc_intent_t *i)
 {
   /* pass wall;     smart; not telepathic; not tunneling;     erratic */
-  if (rand() & 1) {
-    npc_next_pos_rand_pass(d, c, next);
+  if (npc_rand(&i->rng) & 1) {
+    npc_next_pos_rand_pass(d, c, i);
   } else {
-    npc_next_pos_11(d, c, next);
+    npc_next_pos_11(d, c, i);
   }
 }
 
-static void npc_next_pos_1a(dungeon *d, npc *c, pair_t next)
+static void npc_next_pos_1a(dungeon *d, npc *c, npc_intent_t *i)
 {
   /* pass wall; not smart;     telepathic; not tunneling;     erratic */
-  if (rand() & 1) {
-    npc_next_pos_rand_pass(d, c, next);
+  if (npc_rand(&i->rng) & 1) {
+    npc_next_pos_rand_pass(d, c, i);
   } else {
-    npc_next_pos_12(d, c, next);
+    npc_next_pos_12(d, c, i);
   }
 }
 
-static void npc_next_pos_1b(dungeon *d, npc *c, pair_t next)
+static void npc_next_pos_1b(dungeon *d, npc *c, npc_intent_t *i)
 {
   /* pass wall;     smart;     telepathic; not tunneling;     erratic */
-  if (rand() & 1) {
-    npc_next_pos_rand_pass(d, c, next);
+  if (npc_rand(&i->rng) & 1) {
+    npc_next_pos_rand_pass(d, c, i);
   } else {
-    npc_next_pos_13(d, c, next);
+    npc_next_pos_13(d, c, i);
   }
 }
 
-static void npc_next_pos_1c(dungeon *d, npc *c, pair_t next)
+static void npc_next_pos_1c(dungeon *d, npc *c, npc_intent_t *i)
 {
   /* pass wall; not smart; not telepathic;     tunneling;     erratic */
-  if (rand() & 1) {
-    npc_next_pos_rand_pass(d, c, next);
+  if (npc_rand(&i->rng) & 1) {
+    npc_next_pos_rand_pass(d, c, i);
   } else {
-    npc_next_pos_14(d, c, next);
+    npc_next_pos_14(d, c, i);
   }
 }
 
-static void npc_next_pos_1d(dungeon *d, npc *c, pair_t next)
+static void npc_next_pos_1d(dungeon *d, npc *c, npc_intent_t *i)
 {
   /* pass wall;     smart; not telepathic;     tunneling;     erratic */
-  if (rand() & 1) {
-    npc_next_pos_rand_pass(d, c, next);
+  if (npc_rand(&i->rng) & 1) {
+    npc_next_pos_rand_pass(d, c, i);
   } else {
-    npc_next_pos_15(d, c, next);
+    npc_next_pos_15(d, c, i);
   }
 }
 
-static void npc_next_pos_1e(dungeon *d, npc *c, pair_t next)
+static void npc_next_pos_1e(dungeon *d, npc *c, npc_intent_t *i)
 {
   /* pass wall; not smart;     telepathic;     tunneling;     erratic */
-  if (rand() & 1) {
-    npc_next_pos_rand_pass(d, c, next);
+  if (npc_rand(&i->rng) & 1) {
+    npc_next_pos_rand_pass(d, c, i);
   } else {
-    npc_next_pos_16(d, c, next);
+    npc_next_pos_16(d, c, i);
   }
 }
 
-static void npc_next_pos_1f(dungeon *d, npc *c, pair_t next)
+static void npc_next_pos_1f(dungeon *d, npc *c, npc_intent_t *i)
 {
   /* pass wall;     smart;     telepathic;     tunneling;     erratic */
-  if (rand() & 1) {
-    npc_next_pos_rand_pass(d, c, next);
+  if (npc_rand(&i->rng) & 1) {
+    npc_next_pos_rand_pass(d, c, i);
   } else {
-    npc_next_pos_17(d, c, next);
+    npc_next_pos_17(d, c, i);
   }
 }
 
-void (*npc_move_func[])(dungeon *d, npc *c, pair_t next) = {
+void (*npc_move_func[])(dungeon *d, npc *c, npc_intent_t *i) = {
   /* We'll have one function for each combination of bits, so the *
    * order is based on binary counting through the NPC_* bits.    *
    * It could be very easy to mess this up, so be careful.  We'll *
@@ -694,12 +694,58 @@ void (*npc_move_func[])(dungeon *d, npc *c, pair_t next) = {
   npc_next_pos_1f
 };
 
-void npc_next_pos(dungeon *d, npc *c, pair_t next)
+void npc_next_pos(dungeon *d, npc *c, npc_intent_t *i)
 {
-  next[dim_y] = c->position[dim_y];
-  next[dim_x] = c->position[dim_x];
+  PROFILE_SCOPE("npc_next_pos");
+  i->next[dim_y] = c->position[dim_y];
+  i->next[dim_x] = c->position[dim_x];
+  i->have_seen_pc = c->have_seen_pc;
+  i->pc_last_known_position[dim_y] = c->pc_last_known_position[dim_y];
+  i->pc_last_known_position[dim_x] = c->pc_last_known_position[dim_x];
+  i->rng = c->rng;
+  i->dig = npc_dig_none;
+  i->flow = npc_flow_none;
 
-  npc_move_func[c->characteristics & 0x0000001f](d, c, next);
+  npc_move_func[c->characteristics & 0x0000001f](d, c, i);
+}
+
+void npc_commit(dungeon *d, npc *c, npc_intent_t *i)
+{
+  c->have_seen_pc = i->have_seen_pc;
+  c->pc_last_known_position[dim_y] = i->pc_last_known_position[dim_y];
+  c->pc_last_known_position[dim_x] = i->pc_last_known_position[dim_x];
+  c->rng = i->rng;
+  if (i->flow != npc_flow_none) {
+    /* Before the dig, which repairs it along with everything else */
+    flow_use(d, i->flow_goal, i->flow_movement,
+             i->flow == npc_flow_built ? &i->flow_built : NULL);
+  }
+
+  if (i->dig == npc_dig_none) {
+    return;
+  }
+
+  npc_dig_count++;
+  zobrist_toggle_cell(d, i->dig_at);
+  if (i->dig == npc_dig_through) {
+    hardnesspair(i->dig_at) = 0;
+    mappair(i->dig_at) = ter_floor_hall;
+    zobrist_toggle_cell(d, i->dig_at);
+    bitboard_update(d, i->dig_at);
+
+    /* Update distance maps because map has changed. */
+    dijkstra(d);
+    dijkstra_tunnel(d);
+  } else {
+    hardnesspair(i->dig_at) -= 85;
+    zobrist_toggle_cell(d, i->dig_at);
+  }
+  flow_dig(d, i->dig_at, i->dig == npc_dig_through);
+}
+
+uint32_t npc_digs(void)
+{
+  return npc_dig_count;
 }
 
 uint32_t dungeon_has_npcs(dungeon *d)
@@ -707,6 +753,178 @@ uint32_t dungeon_has_npcs(dungeon *d)
   return d->num_monsters;
 }
 
+static uint32_t npc_lod_far(dungeon *d, npc *n)
+{
+  return (abs(n->position[dim_x] - d->PC->position[dim_x]) > NPC_LOD_RADIUS ||
+          abs(n->position[dim_y] - d->PC->position[dim_y]) > NPC_LOD_RADIUS);
+}
+
+/* One coarse step.  A monster that knows where the PC is goes downhill *
+ * on the walking distance map, and anything else rolls once for a      *
+ * direction and goes that way if it's open.  Nobody tunnels, passes    *
+ * through walls or fights; it's only there to keep far away monsters   *
+ * moving about the way they would have.                                */
+static void npc_lod_step(dungeon *d, npc *n)
+{
+  const int8_t *dir;
+  pair_t next;
+  uint32_t i;
+
+  if ((n->characteristics & NPC_TELEPATH) || n->have_seen_pc) {
+    for (i = 0; i < 8; i++) {
+      next[dim_x] = n->position[dim_x] + gradient_order[i][0];
+      next[dim_y] = n->position[dim_y] + gradient_order[i][1];
+      if (d->pc_distance[next[dim_y]][next[dim_x]] <
+          d->pc_distance[n->position[dim_y]][n->position[dim_x]]) {
+        if (!charpair(next)) {
+          move_character(d, n, next);
+        }
+        return;
+      }
+    }
+    return;
+  }
+
+  dir = gradient_order[npc_rand(&n->rng) & 7];
+  next[dim_x] = n->position[dim_x] + dir[0];
+  next[dim_y] = n->position[dim_y] + dir[1];
+  if ((bitboard_window(d->passable, n->position[dim_x], n->position[dim_y]) &
+       window_bit(dir[0], dir[1])) && !charpair(next)) {
+    move_character(d, n, next);
+  }
+}
+
+/* Takes every turn n is owed from before time, and returns when the *
+ * next one is due.  What a monster does only depends on how many     *
+ * turns it's owed, not on when it was asked, so it comes out the same *
+ * whether it's caught up at its own turn or promoted early.          */
+static uint32_t npc_lod_catch_up(dungeon *d, npc *n, uint32_t time)
+{
+  uint32_t delay = 1000 / n->speed;
+
+  while (n->lod_time < time) {
+    npc_lod_step(d, n);
+    n->lod_time += delay;
+  }
+
+  return n->lod_time;
+}
+
+uint32_t npc_lod_turn(dungeon *d, npc *n, event *e)
+{
+  uint32_t delay = 1000 / n->speed;
+
+  if (n->lod_event) {
+    npc_lod_catch_up(d, n, d->time);
+    n->lod_event = NULL;
+  }
+
+  if (!npc_lod_far(d, n)) {
+    return 0;
+  }
+
+  /* This turn, then the next stride's worth later */
+  npc_lod_step(d, n);
+  n->lod_time = d->time + delay;
+  n->lod_event = update_event(d, e, NPC_LOD_STRIDE * delay);
+  n->lod_node = heap_insert(&d->events, n->lod_event);
+
+  return 1;
+}
+
+void npc_lod_promote(dungeon *d)
+{
+  static character *nearby[(2 * NPC_LOD_RADIUS + 1) * (2 * NPC_LOD_RADIUS + 1)];
+  uint32_t count, i, time;
+  npc *n;
+
+  PROFILE_SCOPE("npc_lod_promote");
+  count = spatial_query(d, d->PC->position, NPC_LOD_RADIUS,
+                        nearby, sizeof (nearby) / sizeof (nearby[0]));
+  for (i = 0; i < count; i++) {
+    n = (npc *) nearby[i];
+    if (!n->lod_event) {
+      continue;
+    }
+    /* Owed turns up to now, and its event moves up to the next one, *
+     * which can't be later than where it was.                        */
+    time = npc_lod_catch_up(d, n, d->time);
+    if (time < n->lod_event->time) {
+      update_event(d, n->lod_event, time - d->time);
+      heap_decrease_key_no_replace(&d->events, n->lod_node);
+    }
+    n->lod_event = NULL;
+  }
+}
+
+uint32_t npc_dormant_turn(dungeon *d, npc *n, event *e)
+{
+  if ((n->characteristics & NPC_TELEPATH) || n->have_seen_pc ||
+      (abs(n->position[dim_x] - d->PC->position[dim_x]) <=
+       NPC_DORMANT_RADIUS &&
+       abs(n->position[dim_y] - d->PC->position[dim_y]) <=
+       NPC_DORMANT_RADIUS)) {
+    return 0;
+  }
+
+  /* It's off the queue, so --lod has nothing left to keep track of */
+  n->lod_event = NULL;
+  n->dormant_event = e;
+  n->dormant_index = d->sleeping.size();
+  d->sleeping.push_back(e);
+
+  return 1;
+}
+
+static void npc_dormant_wake_one(dungeon *d, npc *n)
+{
+  event *last;
+
+  /* Whoever's last in line takes its place */
+  last = d->sleeping.back();
+  d->sleeping[n->dormant_index] = last;
+  ((npc *) last->c)->dormant_index = n->dormant_index;
+  d->sleeping.pop_back();
+
+  /* Its next turn is a whole turn from now, as if it had just had one */
+  update_event(d, n->dormant_event, 1000 / n->speed);
+  n->lod_node = heap_insert(&d->events, n->dormant_event);
+  n->dormant_event = NULL;
+}
+
+void npc_dormant_wake(dungeon *d)
+{
+  static character *nearby[(2 * NPC_DORMANT_RADIUS + 1) *
+                           (2 * NPC_DORMANT_RADIUS + 1)];
+  uint32_t count, i;
+
+  PROFILE_SCOPE("npc_dormant_wake");
+  count = spatial_query(d, d->PC->position, NPC_DORMANT_RADIUS,
+                        nearby, sizeof (nearby) / sizeof (nearby[0]));
+  for (i = 0; i < count; i++) {
+    if (((npc *) nearby[i])->dormant_event) {
+      npc_dormant_wake_one(d, (npc *) nearby[i]);
+    }
+  }
+}
+
+void npc_dormant_wake_all(dungeon *d)
+{
+  while (!d->sleeping.empty()) {
+    npc_dormant_wake_one(d, (npc *) d->sleeping.back()->c);
+  }
+}
+
+void npc_dormant_delete(dungeon *d)
+{
+  uint32_t i;
+
+  for (i = 0; i < d->sleeping.size(); i++) {
+    event_delete(d->sleeping[i]);
+  }
+  d->sleeping.clear();
+}
+
 npc::npc(dungeon *d, monster_description &m) : md(m)
 {
   pair_t p;
@@ -731,6 +949,7 @@ npc::npc(dungeon *d, monster_description &m) : md(m)
   position[dim_y] = p[dim_y];
   position[dim_x] = p[dim_x];
   d->character_map[p[dim_y]][p[dim_x]] = this;
+  spatial_insert(d, this);
   speed = m.speed.roll();
   hp = m.hitpoints.roll();
   damage = &m.damage;
@@ -738,6 +957,12 @@ npc::npc(dungeon *d, monster_description &m) : md(m)
   sequence_number = ++d->character_sequence_number;
   characteristics = m.abilities;
   have_seen_pc = 0;
+  rng = rand();
+  lod_event = NULL;
+  lod_node = NULL;
+  lod_time = 0;
+  dormant_event = NULL;
+  dormant_index = 0;
   name = m.name.c_str();
   description = (const char *) m.description.c_str();
   for (i = 0; i < num_kill_types; i++) {
@@ -5,6 +5,8 @@
 
 # include "dims.h"
 # include "character.h"
+# include "heap.h"
+# include "flow.h"
 
 # define NPC_SMART         0x00000001
 # define NPC_TELEPATH      0x00000002
@@ -39,11 +41,25 @@
 # define NPC_BIT30         0x40000000
 # define NPC_BIT31         0x80000000
 
+/* With --lod, a monster more than NPC_LOD_RADIUS from the PC is      *
+ * simulated coarsely: it only gets a turn every NPC_LOD_STRIDE of its *
+ * own, and then takes the cheap steps it's owed all at once.  The     *
+ * radius leaves room for a whole stride of steps before the PC could  *
+ * be in sight.                                                        */
+# define NPC_LOD_RADIUS    (2 * NPC_VISUAL_RANGE)
+# define NPC_LOD_STRIDE    8
+/* With --dormant, a monster that isn't telepathic and hasn't seen the *
+ * PC sleeps, off the event queue, while the PC is out of earshot: more *
+ * than NPC_DORMANT_RADIUS away.  That's just past where it could see   *
+ * the PC, so a sleeping monster never misses the chance.               */
+# define NPC_DORMANT_RADIUS (NPC_VISUAL_RANGE + 1)
+
 # define has_characteristic(character, bit)              \
   (((npc *) character)->characteristics & NPC_##bit)
 # define is_unique(character) has_characteristic(character, UNIQ)
 
 class monster_description;
+struct event;
 
 typedef uint32_t npc_characteristics_t;
 
@@ -56,11 +72,76 @@ class npc : public character {
   pair_t pc_last_known_position;
   const char *description;
   monster_description &md;
+  /* While simulated coarsely, lod_event is this monster's event in the *
+   * queue, at lod_node, and lod_time is when its next owed turn is.    *
+   * lod_event is NULL the rest of the time.                            */
+  event *lod_event;
+  heap_node_t *lod_node;
+  uint32_t lod_time;
+  /* While asleep, the event this monster will get back when it wakes, *
+   * and where it is in d->sleeping; NULL while awake.                 */
+  event *dormant_event;
+  uint32_t dormant_index;
+  /* Where this monster's random numbers come from; see npc_rand() */
+  uint32_t rng;
 };
 
+typedef enum npc_dig {
+  npc_dig_none,
+  npc_dig_some,   /* Takes 85 off the cell's hardness */
+  npc_dig_through /* Digs the cell out, and moves in  */
+} npc_dig_t;
+
+typedef enum npc_flow {
+  npc_flow_none,
+  npc_flow_cached, /* Went by a map from the cache    */
+  npc_flow_built   /* Had to build it, in flow_built */
+} npc_flow_t;
+
+/* What a monster is going to do with its turn: where it's going, what *
+ * it'll know about the PC and where its random numbers will be once   *
+ * it's done, what it digs at on the way, and which --flow map it went *
+ * by, if any.                                                         */
+typedef struct npc_intent {
+  pair_t next;
+  uint32_t have_seen_pc;
+  pair_t pc_last_known_position;
+  uint32_t rng;
+  npc_dig_t dig;
+  pair_t dig_at;
+  npc_flow_t flow;
+  pair_t flow_goal;
+  flow_movement_t flow_movement;
+  grid<uint16_t> flow_built;
+} npc_intent_t;
+
 void gen_monsters(dungeon *d);
 void npc_delete(npc *n);
-void npc_next_pos(dungeon *d, npc *c, pair_t next);
+/* A monster's turn in two halves.  npc_next_pos() decides what c will *
+ * do and writes it into i, changing nothing, so it can be called from *
+ * any thread as long as nobody's changing the game meanwhile (see     *
+ * intent.h).  npc_commit() then carries out all of it but the move,   *
+ * which is still move_character()'s.                                  */
+void npc_next_pos(dungeon *d, npc *c, npc_intent_t *i);
+void npc_commit(dungeon *d, npc *c, npc_intent_t *i);
+/* How many digs npc_commit() has carried out, ever */
+uint32_t npc_digs(void);
 uint32_t dungeon_has_npcs(dungeon *d);
+/* For --lod.  npc_lod_turn() is called in place of a full turn, and if *
+ * it returns nonzero, it took the turn and rescheduled e itself.        *
+ * npc_lod_promote() brings every monster near the PC back up to full   *
+ * speed; call it at the start of each PC turn.                         */
+uint32_t npc_lod_turn(dungeon *d, npc *n, event *e);
+void npc_lod_promote(dungeon *d);
+/* For --dormant.  npc_dormant_turn() is called in place of a full turn, *
+ * and if it returns nonzero, the monster fell asleep and took e with   *
+ * it.  npc_dormant_wake() wakes every monster in earshot of the PC;    *
+ * call it at the start of each PC turn.  npc_dormant_wake_all() wakes  *
+ * everybody, for anything that needs every monster in the queue, and   *
+ * npc_dormant_delete() deletes them all where they sleep.              */
+uint32_t npc_dormant_turn(dungeon *d, npc *n, event *e);
+void npc_dormant_wake(dungeon *d);
+void npc_dormant_wake_all(dungeon *d);
+void npc_dormant_delete(dungeon *d);
 
 #endif
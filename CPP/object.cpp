@@ -68,7 +68,7 @@ void gen_objects(dungeon_t *d)
 {
   uint32_t i;
 
-  memset(d->objmap, 0, sizeof (d->objmap));
+  d->objmap.fill(NULL);
 
   for (i = 0; i < d->max_objects; i++) {
     gen_object(d);
@@ -132,7 +132,7 @@ int32_t object::roll_dice()
 
 void destroy_objects(dungeon_t *d)
 {
-  uint32_t y, x;
+  int32_t y, x;
 
   for (y = 0; y < DUNGEON_Y; y++) {
     for (x = 0; x < DUNGEON_X; x++) {
@@ -54,6 +54,7 @@ class object {
   void set_next(object *n);
 };
 
+void gen_object(dungeon_t *d);
 void gen_objects(dungeon_t *d);
 char object_get_symbol(object *o);
 void destroy_objects(dungeon_t *d);
@@ -1,11 +1,69 @@
 #ifndef PATH_H
 # define PATH_H
 
-# define HARDNESS_PER_TURN 85
+# include <algorithm>
+
+# include "dungeon.h"
+# include "bitboard.h"
+# include "dijkstra.h"
 
-class dungeon;
+# define HARDNESS_PER_TURN 85
 
 void dijkstra(dungeon *d);
 void dijkstra_tunnel(dungeon *d);
 
+/* Policies for dijkstra_search(), shared by the PC's tunneling map and *
+ * the monsters' flow fields.                                           */
+
+/* Anything but the walls around the edge */
+struct path_diggable {
+  dungeon *d;
+  path_diggable(dungeon *dungeon) : d(dungeon) {}
+  template <typename Visit>
+  DIJKSTRA_INLINE void each(const pair_t lo, const pair_t hi, Visit &v) const
+  {
+    int32_t x, y;
+
+    for (y = lo[dim_y]; y <= hi[dim_y]; y++) {
+      for (x = lo[dim_x]; x <= hi[dim_x]; x++) {
+        if (mapxy(x, y) != ter_wall_immutable) {
+          v(x, y);
+        }
+      }
+    }
+  }
+};
+
+/* One a step.  Too far to count sticks at DISTANCE_MAX rather than *
+ * reaching the sentinel, or wrapping.                              */
+struct path_walk_cost {
+  DIJKSTRA_INLINE uint16_t operator()(int32_t x, int32_t y,
+                                      uint16_t distance) const
+  {
+    return std::min(distance + 1, DISTANCE_MAX);
+  }
+  DIJKSTRA_INLINE uint16_t unreached() const
+  {
+    return DISTANCE_UNREACHABLE;
+  }
+};
+
+/* One a step, and a turn for every HARDNESS_PER_TURN of the cell being *
+ * left.  Ignores the case of hardness == 255, because if that gets     *
+ * here, there's already been an error.                                 */
+struct path_tunnel_cost {
+  dungeon *d;
+  path_tunnel_cost(dungeon *dungeon) : d(dungeon) {}
+  DIJKSTRA_INLINE uint16_t operator()(int32_t x, int32_t y,
+                                      uint16_t distance) const
+  {
+    return std::min(distance + hardnessxy(x, y) / HARDNESS_PER_TURN + 1,
+                    DISTANCE_MAX);
+  }
+  DIJKSTRA_INLINE uint16_t unreached() const
+  {
+    return DISTANCE_UNREACHABLE;
+  }
+};
+
 #endif
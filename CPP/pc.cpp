@@ -1,6 +1,7 @@
 #include <cstdlib>
 #include <ncurses.h>
 #include <cstring>
+#include <algorithm>
 
 #include "dungeon.h"
 #include "pc.h"
@@ -9,6 +10,8 @@
 #include "path.h"
 #include "io.h"
 #include "object.h"
+#include "profile.h"
+#include "region.h"
 
 equip_position_t get_epos(int32_t type) {
   switch(type)
@@ -95,16 +98,56 @@ void config_pc(dungeon *d)
   d->PC->inventory = std::vector<object *>(10);
   d->PC->inventory.clear();
   d->PC->equipment = std::array<object *, 12>();
+  d->PC->run = 0;
+  d->PC->objects_seen = 0;
+  d->PC->have_seen_corner = d->PC->corner_count = 0;
   d->character_map[character_get_y(d->PC)][character_get_x(d->PC)] = d->PC;
 
   dijkstra(d);
   dijkstra_tunnel(d);
 }
 
+/* Sets dir toward the middle of the room nearest the middle of the map, *
+ * on foot, or to nowhere once we're there.  Returns 0 if there's no way *
+ * there.                                                                */
+static uint32_t pc_dir_to_center(dungeon *d, pair_t dir)
+{
+  pair_t center, next;
+  uint32_t i, distance, nearest;
+  int32_t x, y;
+
+  for (nearest = UINT32_MAX, i = 0; i < d->num_rooms; i++) {
+    x = d->rooms[i].position[dim_x] + d->rooms[i].size[dim_x] / 2;
+    y = d->rooms[i].position[dim_y] + d->rooms[i].size[dim_y] / 2;
+    distance = std::max(abs(x - DUNGEON_X / 2), abs(y - DUNGEON_Y / 2));
+    if (distance < nearest) {
+      nearest = distance;
+      center[dim_x] = x;
+      center[dim_y] = y;
+    }
+  }
+
+  if (nearest == UINT32_MAX) {
+    return 0;
+  }
+  if (center[dim_x] == d->PC->position[dim_x] &&
+      center[dim_y] == d->PC->position[dim_y]) {
+    return 1;
+  }
+  if (!region_next_step(d, d->PC->position, center, next)) {
+    return 0;
+  }
+
+  dir[dim_x] = next[dim_x] - d->PC->position[dim_x];
+  dir[dim_y] = next[dim_y] - d->PC->position[dim_y];
+
+  return 1;
+}
+
 uint32_t pc_next_pos(dungeon *d, pair_t dir)
 {
-  static uint32_t have_seen_corner = 0;
-  static uint32_t count = 0;
+  uint32_t &have_seen_corner = d->PC->have_seen_corner;
+  uint32_t &count = d->PC->corner_count;
 
   dir[dim_y] = dir[dim_x] = 0;
 
@@ -152,7 +195,7 @@ uint32_t pc_next_pos(dungeon *d, pair_t dir)
     if (!against_wall(d, d->PC) && ((rand() & 0x111) == 0x111)) {
       dir[dim_x] = (rand() % 3) - 1;
       dir[dim_y] = (rand() % 3) - 1;
-    } else {
+    } else if (!pc_dir_to_center(d, dir)) {
       dir[dim_x] = ((d->PC->position[dim_x] > DUNGEON_X / 2) ? -1 : 1);
       dir[dim_y] = ((d->PC->position[dim_y] > DUNGEON_Y / 2) ? -1 : 1);
     }
@@ -222,13 +265,7 @@ void pc_learn_terrain(pc *p, pair_t pos, terrain_type ter)
 
 void pc_reset_visibility(pc *p)
 {
-  uint32_t y, x;
-
-  for (y = 0; y < DUNGEON_Y; y++) {
-    for (x = 0; x < DUNGEON_X; x++) {
-      p->visible[y][x] = 0;
-    }
-  }
+  p->visible.fill(0);
 }
 
 terrain_type pc_learned_terrain(pc *p, int16_t y, int16_t x)
@@ -242,18 +279,15 @@ terrain_type pc_learned_terrain(pc *p, int16_t y, int16_t x)
 
 void pc_init_known_terrain(pc *p)
 {
-  uint32_t y, x;
-
-  for (y = 0; y < DUNGEON_Y; y++) {
-    for (x = 0; x < DUNGEON_X; x++) {
-      p->known_terrain[y][x] = ter_unknown;
-      p->visible[y][x] = 0;
-    }
-  }
+  p->known_terrain.resize(DUNGEON_X, DUNGEON_Y);
+  p->visible.resize(DUNGEON_X, DUNGEON_Y);
+  p->known_terrain.fill(ter_unknown);
+  p->visible.fill(0);
 }
 
 void pc_observe_terrain(pc *p, dungeon *d)
 {
+  PROFILE_SCOPE("pc_observe_terrain");
   pair_t where;
   int16_t y_min, y_max, x_min, x_max;
 
@@ -296,7 +330,8 @@ int32_t is_illuminated(pc *p, int16_t y, int16_t x)
 
 void pc_see_object(character *the_pc, object *o)
 {
-  if (o) {
+  if (o && !o->have_seen()) {
     o->has_been_seen();
+    ((pc *) the_pc)->objects_seen++;
   }
 }
@@ -31,10 +31,24 @@ typedef enum object_type object_type_t;
 class pc : public character {
  public:
   ~pc() {}
-  terrain_type known_terrain[DUNGEON_Y][DUNGEON_X];
-  uint8_t visible[DUNGEON_Y][DUNGEON_X];
+  /* Sized by pc_init_known_terrain(). */
+  grid<terrain_type> known_terrain;
+  grid<uint8_t> visible;
   std::vector<object *> inventory;
   std::array<object *, 12> equipment;
+  /* While running, the direction (as a key on the number pad, or 5 for *
+   * resting) we're going; otherwise zero.  See move_pc_run().          */
+  uint32_t run;
+  uint32_t run_turns;
+  int32_t run_hp;
+  uint32_t run_objects;
+  /* How many objects the PC has laid eyes on, so running can tell when *
+   * a new one turns up.                                                */
+  uint32_t objects_seen;
+  /* Where pc_next_pos() is in its plan: whether it has made it to a *
+   * corner yet, and how long it has been hanging around since.      */
+  uint32_t have_seen_corner;
+  uint32_t corner_count;
 };
 
 equip_position_t get_epos(int32_t type);
@@ -0,0 +1,261 @@
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <malloc.h>
+
+#include "profile.h"
+
+#ifdef RLG_PROFILE
+
+/* Nodes live in a fixed pool, linked into a tree by index.  Node zero *
+ * is the root, which stands for the whole run.  If the pool fills up, *
+ * new call paths simply go untimed.                                   */
+#define PROFILE_MAX_NODES 1024
+
+typedef struct profile_node {
+  const char *name;
+  uint32_t parent, first_child, next_sibling;
+  uint64_t calls;
+  uint64_t ns;
+} profile_node_t;
+
+uint32_t profile_on;
+FILE *profile_trace_file;
+thread_local uint32_t profile_helper;
+
+static profile_node_t profile_node[PROFILE_MAX_NODES];
+static uint32_t profile_nodes;
+static uint32_t profile_current;
+static uint64_t profile_begin;
+static uint32_t profile_reporting;
+
+uint64_t profile_now(void)
+{
+  struct timespec t;
+
+  clock_gettime(CLOCK_MONOTONIC, &t);
+
+  return t.tv_sec * 1000000000ULL + t.tv_nsec;
+}
+
+uint32_t profile_enter(const char *name)
+{
+  uint32_t n;
+
+  for (n = profile_node[profile_current].first_child;
+       n;
+       n = profile_node[n].next_sibling) {
+    if (profile_node[n].name == name || !strcmp(profile_node[n].name, name)) {
+      break;
+    }
+  }
+
+  if (!n) {
+    if (profile_nodes == PROFILE_MAX_NODES) {
+      return 0;
+    }
+    n = profile_nodes++;
+    profile_node[n].name = name;
+    profile_node[n].parent = profile_current;
+    profile_node[n].first_child = 0;
+    profile_node[n].next_sibling = profile_node[profile_current].first_child;
+    profile_node[n].calls = profile_node[n].ns = 0;
+    profile_node[profile_current].first_child = n;
+  }
+
+  profile_current = n;
+
+  return n;
+}
+
+/* Trace events are each written with a single stdio call, which holds *
+ * the FILE lock, so the render thread can write them too.  The file    *
+ * opens with a metadata event, so every other event can start with a  *
+ * comma and nobody has to keep track of which one came first.  It's   *
+ * the array form of the format, which viewers will load without the    *
+ * closing bracket, so a run that had to be killed can still be read.  */
+static void profile_trace_event(const char *name, uint32_t thread,
+                                uint64_t start, uint64_t end,
+                                const char *detail)
+{
+  char escaped[64];
+  uint32_t i;
+
+  if (!detail) {
+    fprintf(profile_trace_file,
+            ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,"
+            "\"ts\":%.3f,\"dur\":%.3f}",
+            name, thread, (start - profile_begin) / 1000.0,
+            (end - start) / 1000.0);
+    return;
+  }
+
+  /* Names come from the description files, so could hold anything. */
+  for (i = 0; *detail && i < sizeof (escaped) - 2; detail++) {
+    if (*detail == '"' || *detail == '\\') {
+      escaped[i++] = '\\';
+    }
+    escaped[i++] = (*detail < ' ') ? ' ' : *detail;
+  }
+  escaped[i] = '\0';
+
+  fprintf(profile_trace_file,
+          ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,"
+          "\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"detail\":\"%s\"}}",
+          name, thread, (start - profile_begin) / 1000.0,
+          (end - start) / 1000.0, escaped);
+}
+
+void profile_leave(uint32_t node, uint64_t start,
+                   const char *detail, uint32_t traced)
+{
+  uint64_t end;
+
+  end = profile_now();
+  profile_node[node].calls++;
+  profile_node[node].ns += end - start;
+  profile_current = profile_node[node].parent;
+
+  if (traced && profile_trace_file) {
+    profile_trace_event(profile_node[node].name, PROFILE_THREAD_GAME,
+                        start, end, detail);
+  }
+}
+
+void profile_trace_span(const char *name, uint32_t thread, uint64_t start)
+{
+  profile_trace_event(name, thread, start, profile_now(), NULL);
+}
+
+void profile_trace_counter(const char *name, int64_t value)
+{
+  fprintf(profile_trace_file,
+          ",\n{\"name\":\"%s\",\"ph\":\"C\",\"pid\":1,\"ts\":%.3f,"
+          "\"args\":{\"value\":%lld}}",
+          name, (profile_now() - profile_begin) / 1000.0, (long long) value);
+}
+
+/* Everything handed out by malloc() (and so new) and not yet freed. */
+int64_t profile_heap_bytes(void)
+{
+  return mallinfo2().uordblks;
+}
+
+static void profile_init(void)
+{
+  if (profile_on) {
+    return;
+  }
+
+  profile_node[0].name = "total";
+  profile_node[0].calls = 1;
+  profile_nodes = 1;
+  profile_current = 0;
+  profile_begin = profile_now();
+  profile_on = 1;
+}
+
+uint32_t profile_start(void)
+{
+  profile_init();
+  profile_reporting = 1;
+
+  return 1;
+}
+
+uint32_t profile_trace(const char *file)
+{
+  if (!(profile_trace_file = fopen(file, "w"))) {
+    return 0;
+  }
+
+  profile_init();
+  fprintf(profile_trace_file,
+          "[\n{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,"
+          "\"args\":{\"name\":\"rlg327\"}},\n"
+          "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,"
+          "\"args\":{\"name\":\"game\"}},\n"
+          "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,"
+          "\"args\":{\"name\":\"render\"}},\n"
+          "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,"
+          "\"args\":{\"name\":\"intents\"}}",
+          PROFILE_THREAD_GAME, PROFILE_THREAD_RENDER, PROFILE_THREAD_INTENT);
+
+  return 1;
+}
+
+static int compare_profile_nodes(const void *v1, const void *v2)
+{
+  uint64_t n1 = profile_node[*(const uint32_t *) v1].ns;
+  uint64_t n2 = profile_node[*(const uint32_t *) v2].ns;
+
+  return (n1 < n2) - (n1 > n2);
+}
+
+static void profile_print(FILE *f, uint32_t n, uint32_t depth)
+{
+  uint32_t children[PROFILE_MAX_NODES];
+  uint32_t count, c, i;
+  uint64_t self;
+
+  self = profile_node[n].ns;
+  for (count = 0, c = profile_node[n].first_child;
+       c;
+       c = profile_node[c].next_sibling) {
+    children[count++] = c;
+    self -= profile_node[c].ns;
+  }
+
+  fprintf(f, "%10llu %12.3f %12.3f %6.1f%%  %*s%s\n",
+          (unsigned long long) profile_node[n].calls,
+          profile_node[n].ns / 1000000.0, self / 1000000.0,
+          (n ? 100.0 * profile_node[n].ns /
+           (profile_node[profile_node[n].parent].ns ?
+            profile_node[profile_node[n].parent].ns : 1) : 100.0),
+          depth * 2, "", profile_node[n].name);
+
+  qsort(children, count, sizeof (children[0]), compare_profile_nodes);
+  for (i = 0; i < count; i++) {
+    profile_print(f, children[i], depth + 1);
+  }
+}
+
+void profile_report(FILE *f)
+{
+  if (!profile_on) {
+    return;
+  }
+
+  profile_on = 0;
+  profile_node[0].ns = profile_now() - profile_begin;
+
+  if (profile_trace_file) {
+    fprintf(profile_trace_file, "\n]\n");
+    fclose(profile_trace_file);
+    profile_trace_file = NULL;
+  }
+
+  if (profile_reporting) {
+    fprintf(f, "\n%10s %12s %12s %7s  %s\n",
+            "calls", "total ms", "self ms", "parent", "scope");
+    profile_print(f, 0, 0);
+  }
+}
+
+#else
+
+uint32_t profile_start(void)
+{
+  return 0;
+}
+
+uint32_t profile_trace(const char *file)
+{
+  return 0;
+}
+
+void profile_report(FILE *f)
+{
+}
+
+#endif
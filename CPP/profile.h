@@ -0,0 +1,128 @@
+#ifndef PROFILE_H
+# define PROFILE_H
+
+# include <stdint.h>
+# include <stdio.h>
+
+/* A small hierarchical profiler.  PROFILE_SCOPE("name") at the top of a *
+ * function (or any block) times everything until the block is left,    *
+ * and charges it to a node in a call tree under whatever scope was      *
+ * open at the time, so the same function called from two places shows  *
+ * up twice.  The timers only exist in builds made with 'make PROFILE=1' *
+ * (which defines RLG_PROFILE); otherwise PROFILE_SCOPE() is nothing at  *
+ * all.  Even when built in, they do nothing but test a flag unless      *
+ * profile_start() has been called, which --profile does.                *
+ *                                                                       *
+ * The same scopes feed --trace, which writes every one of them out as a *
+ * span in Chrome's trace-event JSON (load it in chrome://tracing or     *
+ * ui.perfetto.dev), along with the PROFILE_COUNTER() values.  Scopes    *
+ * hit thousands of times a turn use PROFILE_HOT_SCOPE(), which is timed *
+ * but left out of the trace so it stays a reasonable size.              */
+
+# ifdef RLG_PROFILE
+
+extern uint32_t profile_on;
+extern FILE *profile_trace_file;
+/* Set on helper threads, whose scopes would tangle the call tree; they *
+ * only show up in the trace, through PROFILE_THREAD_SCOPE().           */
+extern thread_local uint32_t profile_helper;
+
+uint32_t profile_enter(const char *name);
+void profile_leave(uint32_t node, uint64_t start,
+                   const char *detail, uint32_t traced);
+uint64_t profile_now(void);
+void profile_trace_span(const char *name, uint32_t thread, uint64_t start);
+void profile_trace_counter(const char *name, int64_t value);
+int64_t profile_heap_bytes(void);
+
+class profile_scope {
+ private:
+  uint32_t node;
+  uint32_t traced;
+  uint64_t start;
+  const char *detail;
+ public:
+  inline profile_scope(const char *name, const char *detail, uint32_t traced)
+    : node(0), traced(traced), start(0), detail(detail)
+  {
+    if (profile_on && !profile_helper && (node = profile_enter(name))) {
+      start = profile_now();
+    }
+  }
+  inline ~profile_scope()
+  {
+    if (node) {
+      profile_leave(node, start, detail, traced);
+    }
+  }
+};
+
+/* For threads other than the game's own.  These don't touch the call *
+ * tree, so they only show up in the trace, on a track of their own.  */
+class profile_thread_scope {
+ private:
+  const char *name;
+  uint32_t thread;
+  uint64_t start;
+ public:
+  inline profile_thread_scope(const char *name, uint32_t thread)
+    : name(name), thread(thread), start(0)
+  {
+    if (profile_trace_file) {
+      start = profile_now();
+    }
+  }
+  inline ~profile_thread_scope()
+  {
+    if (start) {
+      profile_trace_span(name, thread, start);
+    }
+  }
+};
+
+#  define PROFILE_CONCAT_(a, b) a##b
+#  define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+#  define PROFILE_SCOPE(name)                                           \
+  profile_scope PROFILE_CONCAT(profile_scope_, __LINE__)(name, NULL, 1)
+/* detail shows up in the trace as the span's argument. */
+#  define PROFILE_SCOPE_DETAIL(name, detail)                            \
+  profile_scope PROFILE_CONCAT(profile_scope_, __LINE__)(name, detail, 1)
+#  define PROFILE_HOT_SCOPE(name)                                       \
+  profile_scope PROFILE_CONCAT(profile_scope_, __LINE__)(name, NULL, 0)
+#  define PROFILE_THREAD_SCOPE(name, thread)                            \
+  profile_thread_scope PROFILE_CONCAT(profile_scope_, __LINE__)(name, thread)
+#  define PROFILE_HELPER_THREAD() (profile_helper = 1)
+/* value isn't evaluated unless we're tracing. */
+#  define PROFILE_COUNTER(name, value)                                  \
+  do {                                                                  \
+    if (profile_trace_file) {                                           \
+      profile_trace_counter(name, value);                               \
+    }                                                                   \
+  } while (0)
+
+# else
+
+#  define PROFILE_SCOPE(name)
+#  define PROFILE_SCOPE_DETAIL(name, detail)
+#  define PROFILE_HOT_SCOPE(name)
+#  define PROFILE_THREAD_SCOPE(name, thread)
+#  define PROFILE_HELPER_THREAD()
+#  define PROFILE_COUNTER(name, value)
+
+# endif
+
+/* Trace tracks, one per thread */
+# define PROFILE_THREAD_GAME   1
+# define PROFILE_THREAD_RENDER 2
+# define PROFILE_THREAD_INTENT 3
+
+/* Returns zero if the profiler wasn't built in. */
+uint32_t profile_start(void);
+/* Returns zero if the profiler wasn't built in or file can't be written. */
+uint32_t profile_trace(const char *file);
+/* Prints the call tree, if profile_start() was called, and finishes the *
+ * trace file, if profile_trace() was.  Call it after the render thread  *
+ * is gone.                                                              */
+void profile_report(FILE *f);
+
+#endif
@@ -0,0 +1,591 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <algorithm>
+#include <vector>
+
+#include "region.h"
+#include "dungeon.h"
+#include "bitboard.h"
+#include "heap.h"
+#include "profile.h"
+
+/* What each cell is to the graph, in region_tag: a room's floor or a *
+ * node, and which one.                                               */
+#define REGION_ROOM         0x80000000U
+#define REGION_NODE         0x40000000U
+#define REGION_INDEX(tag)   ((tag) & 0x3fffffffU)
+#define REGION_UNREACHED    UINT32_MAX
+#define REGION_WINDOW       (2 * REGION_LOCAL + 1)
+/* Nodes that every other node knows its distance from, for A* to *
+ * bound the rest of a trip with; see region_estimate().          */
+#define REGION_LANDMARKS    8
+
+typedef struct region_node {
+  pair_t pos;
+  /* The rooms this is a door of, or -1 */
+  int32_t room[2];
+  /* Its corridor edges are num_edges from region_edge[first_edge] */
+  uint32_t first_edge, num_edges;
+  uint32_t component;
+  /* Search state, only good while stamp is region_search */
+  uint32_t stamp;
+  heap_node_t *hn;
+  uint32_t g, f;
+  int32_t parent;
+  /* Steps from here to the end of the trip, if it's that close */
+  uint32_t exit;
+} region_node_t;
+
+typedef struct region_edge {
+  uint32_t to, cost;
+} region_edge_t;
+
+/* The map within REGION_LOCAL of center, searched out from it.  prev is *
+ * the index in the window of the cell each one was reached from.        */
+typedef struct region_window {
+  pair_t center;
+  uint32_t distance[REGION_WINDOW * REGION_WINDOW];
+  uint16_t prev[REGION_WINDOW * REGION_WINDOW];
+} region_window_t;
+
+static grid<uint32_t> region_tag;
+static std::vector<region_node_t> region_node;
+static std::vector<region_edge_t> region_edge;
+/* The doors of room r are region_door[region_room_first[r]] up to *
+ * region_door[region_room_first[r + 1]].                          */
+static std::vector<uint32_t> region_room_first, region_door;
+/* bitboard_rebuilds() when the graph was built */
+static uint32_t region_built;
+static uint32_t region_search;
+static region_window_t region_start, region_end;
+/* Steps between landmark l and node i, region_landmark[i * *
+ * REGION_LANDMARKS + l], or REGION_UNREACHED.              */
+static std::vector<uint32_t> region_landmark;
+/* What a trip's end looks like from each landmark, by way of the nodes *
+ * with an exit: the least of landmark to node plus exit, and the most  *
+ * of landmark to node less exit.  Only good for this search.           */
+static int32_t region_exit_near[REGION_LANDMARKS];
+static int32_t region_exit_far[REGION_LANDMARKS];
+static uint32_t region_estimating;
+
+static uint32_t region_distance(pair_t a, pair_t b)
+{
+  return std::max(abs(a[dim_x] - b[dim_x]), abs(a[dim_y] - b[dim_y]));
+}
+
+static uint32_t region_find(std::vector<uint32_t> &parent, uint32_t i)
+{
+  while (parent[i] != i) {
+    i = parent[i] = parent[parent[i]];
+  }
+
+  return i;
+}
+
+/* Walks the corridors out from node i, up to the first nodes on every *
+ * way out, and gives i an edge to each.                               */
+static void region_walk_corridors(dungeon *d, uint32_t i,
+                                  grid<uint32_t> &seen,
+                                  std::vector<uint32_t> &queue)
+{
+  uint32_t head, layer_end, steps, tag;
+  int32_t x, y, dx, dy;
+  region_edge_t e;
+
+  region_node[i].first_edge = region_edge.size();
+  queue.clear();
+  queue.push_back(region_node[i].pos[dim_y] * DUNGEON_X +
+                  region_node[i].pos[dim_x]);
+  seen[region_node[i].pos[dim_y]][region_node[i].pos[dim_x]] = i + 1;
+  for (head = 0, steps = 0; head < queue.size(); steps++) {
+    for (layer_end = queue.size(); head < layer_end; head++) {
+      y = queue[head] / DUNGEON_X;
+      x = queue[head] % DUNGEON_X;
+      /* Other nodes are as far as this one goes */
+      if (head && (region_tag[y][x] & REGION_NODE)) {
+        continue;
+      }
+      for (dy = -1; dy <= 1; dy++) {
+        for (dx = -1; dx <= 1; dx++) {
+          if (seen[y + dy][x + dx] == i + 1 ||
+              !passablexy(x + dx, y + dy) ||
+              ((tag = region_tag[y + dy][x + dx]) & REGION_ROOM)) {
+            continue;
+          }
+          seen[y + dy][x + dx] = i + 1;
+          queue.push_back((y + dy) * DUNGEON_X + x + dx);
+          if (tag & REGION_NODE) {
+            e.to = REGION_INDEX(tag);
+            e.cost = steps + 1;
+            region_edge.push_back(e);
+          }
+        }
+      }
+    }
+  }
+  region_node[i].num_edges = region_edge.size() - region_node[i].first_edge;
+}
+
+static void region_build(dungeon *d)
+{
+  PROFILE_SCOPE("region_build");
+  static grid<uint32_t> seen;
+  std::vector<uint32_t> queue, component;
+  region_node_t n;
+  uint32_t i, j, r, tag, rooms;
+  int32_t x, y, w, dx, dy;
+  uint64_t open;
+
+  region_tag.resize(DUNGEON_X, DUNGEON_Y);
+  region_tag.fill(0);
+  region_node.clear();
+  region_edge.clear();
+
+  for (r = 0; r < d->num_rooms; r++) {
+    for (y = d->rooms[r].position[dim_y];
+         y < d->rooms[r].position[dim_y] + d->rooms[r].size[dim_y];
+         y++) {
+      for (x = d->rooms[r].position[dim_x];
+           x < d->rooms[r].position[dim_x] + d->rooms[r].size[dim_x];
+           x++) {
+        region_tag[y][x] = REGION_ROOM | r;
+      }
+    }
+  }
+
+  /* Nodes are corridor cells, anything open that isn't in a room */
+  region_room_first.assign(d->num_rooms + 1, 0);
+  for (y = 1; y < DUNGEON_Y - 1; y++) {
+    for (w = 0; w < BITBOARD_WORDS; w++) {
+      /* Most of the map is rock, so go by the open cells only */
+      for (open = d->passable[y][w]; open; open &= open - 1) {
+        x = (w << 6) + __builtin_ctzll(open);
+        if (!x || x == DUNGEON_X - 1 || region_tag[y][x]) {
+          continue;
+        }
+        n.room[0] = n.room[1] = -1;
+        for (rooms = 0, dy = -1; dy <= 1; dy++) {
+          for (dx = -1; dx <= 1; dx++) {
+            tag = region_tag[y + dy][x + dx];
+            if ((tag & REGION_ROOM) && rooms < 2 &&
+                (!rooms || n.room[0] != (int32_t) REGION_INDEX(tag))) {
+              n.room[rooms++] = REGION_INDEX(tag);
+              region_room_first[REGION_INDEX(tag)]++;
+            }
+          }
+        }
+        if (rooms || !(x % REGION_CLUSTER) || !(y % REGION_CLUSTER)) {
+          n.pos[dim_x] = x;
+          n.pos[dim_y] = y;
+          n.stamp = 0;
+          region_tag[y][x] = REGION_NODE | region_node.size();
+          region_node.push_back(n);
+        }
+      }
+    }
+  }
+
+  /* Counts to starts, then fill each room's doors in from the back */
+  for (r = 0, j = 0; r <= d->num_rooms; r++) {
+    j += region_room_first[r];
+    region_room_first[r] = j;
+  }
+  region_door.resize(j);
+  for (i = 0; i < region_node.size(); i++) {
+    for (r = 0; r < 2 && region_node[i].room[r] >= 0; r++) {
+      region_door[--region_room_first[region_node[i].room[r]]] = i;
+    }
+  }
+
+  seen.resize(DUNGEON_X, DUNGEON_Y);
+  seen.fill(0);
+  for (i = 0; i < region_node.size(); i++) {
+    region_walk_corridors(d, i, seen, queue);
+  }
+
+  /* Nodes joined by an edge or a room are in the same component */
+  component.resize(region_node.size());
+  for (i = 0; i < region_node.size(); i++) {
+    component[i] = i;
+  }
+  for (i = 0; i < region_node.size(); i++) {
+    for (j = 0; j < region_node[i].num_edges; j++) {
+      component[region_find(component, i)] =
+        region_find(component, region_edge[region_node[i].first_edge + j].to);
+    }
+  }
+  for (r = 0; r < d->num_rooms; r++) {
+    for (j = region_room_first[r] + 1; j < region_room_first[r + 1]; j++) {
+      component[region_find(component, region_door[j])] =
+        region_find(component, region_door[region_room_first[r]]);
+    }
+  }
+  for (i = 0; i < region_node.size(); i++) {
+    region_node[i].component = region_find(component, i);
+  }
+
+  region_built = bitboard_rebuilds();
+}
+
+/* Searches the map out from center, as far as REGION_LOCAL. */
+static void region_window_search(dungeon *d, region_window_t *w,
+                                 pair_t center)
+{
+  uint16_t queue[REGION_WINDOW * REGION_WINDOW];
+  uint32_t head, tail, i, j;
+  int32_t x, y, dx, dy, mx, my;
+
+  w->center[dim_x] = center[dim_x];
+  w->center[dim_y] = center[dim_y];
+  std::fill(w->distance, w->distance + REGION_WINDOW * REGION_WINDOW,
+            REGION_UNREACHED);
+
+  i = REGION_LOCAL * REGION_WINDOW + REGION_LOCAL;
+  w->distance[i] = 0;
+  w->prev[i] = i;
+  queue[0] = i;
+  for (head = 0, tail = 1; head < tail; head++) {
+    i = queue[head];
+    y = i / REGION_WINDOW;
+    x = i % REGION_WINDOW;
+    for (dy = -1; dy <= 1; dy++) {
+      for (dx = -1; dx <= 1; dx++) {
+        if (x + dx < 0 || x + dx >= REGION_WINDOW ||
+            y + dy < 0 || y + dy >= REGION_WINDOW) {
+          continue;
+        }
+        j = (y + dy) * REGION_WINDOW + x + dx;
+        mx = center[dim_x] - REGION_LOCAL + x + dx;
+        my = center[dim_y] - REGION_LOCAL + y + dy;
+        /* The edge of the map is always rock, so never gets past it */
+        if (w->distance[j] != REGION_UNREACHED ||
+            mx < 0 || mx >= DUNGEON_X || my < 0 || my >= DUNGEON_Y ||
+            !passablexy(mx, my)) {
+          continue;
+        }
+        w->distance[j] = w->distance[i] + 1;
+        w->prev[j] = i;
+        queue[tail++] = j;
+      }
+    }
+  }
+}
+
+/* Index in w of p, or -1 if it isn't in it or wasn't reached */
+static int32_t region_window_index(region_window_t *w, pair_t p)
+{
+  int32_t x, y, i;
+
+  x = p[dim_x] - w->center[dim_x] + REGION_LOCAL;
+  y = p[dim_y] - w->center[dim_y] + REGION_LOCAL;
+  if (x < 0 || x >= REGION_WINDOW || y < 0 || y >= REGION_WINDOW) {
+    return -1;
+  }
+  i = y * REGION_WINDOW + x;
+
+  return w->distance[i] == REGION_UNREACHED ? -1 : i;
+}
+
+static void region_window_cell(region_window_t *w, int32_t i, pair_t p)
+{
+  p[dim_x] = w->center[dim_x] - REGION_LOCAL + i % REGION_WINDOW;
+  p[dim_y] = w->center[dim_y] - REGION_LOCAL + i / REGION_WINDOW;
+}
+
+/* The first step from w's center toward index i, which isn't it */
+static void region_window_step(region_window_t *w, int32_t i, pair_t next)
+{
+  while (w->distance[i] > 1) {
+    i = w->prev[i];
+  }
+
+  region_window_cell(w, i, next);
+}
+
+static region_node_t *region_touch(uint32_t i)
+{
+  region_node_t *n = &region_node[i];
+
+  if (n->stamp != region_search) {
+    n->stamp = region_search;
+    n->hn = NULL;
+    n->g = REGION_UNREACHED;
+    n->exit = REGION_UNREACHED;
+  }
+
+  return n;
+}
+
+static int32_t region_cmp(const void *key, const void *with)
+{
+  return ((int32_t) ((region_node_t *) key)->f -
+          (int32_t) ((region_node_t *) with)->f);
+}
+
+/* Steps from n to the end of the trip at to are at least as the crow *
+ * flies, and, since going by way of a landmark can't be shorter than *
+ * going straight there, at least the difference between how far the  *
+ * landmark is from n and from the end, whichever way round.  Nothing *
+ * at all while region_estimating is off.                             */
+static uint32_t region_estimate(region_node_t *n, pair_t to)
+{
+  const uint32_t *l;
+  int32_t best, i;
+
+  if (!region_estimating) {
+    return 0;
+  }
+
+  best = region_distance(n->pos, to);
+  l = &region_landmark[(n - &region_node[0]) * REGION_LANDMARKS];
+  for (i = 0; i < REGION_LANDMARKS; i++) {
+    if (l[i] != REGION_UNREACHED && region_exit_near[i] != INT32_MAX) {
+      best = std::max(best, std::max(region_exit_near[i] - (int32_t) l[i],
+                                     (int32_t) l[i] - region_exit_far[i]));
+    }
+  }
+
+  return best;
+}
+
+static void region_relax(heap_t *h, region_node_t *from, uint32_t i,
+                         uint32_t cost, pair_t to)
+{
+  region_node_t *n = region_touch(i);
+
+  if (from->g + cost >= n->g) {
+    return;
+  }
+
+  n->g = from->g + cost;
+  n->f = n->g + region_estimate(n, to);
+  n->parent = from - &region_node[0];
+  if (n->hn) {
+    heap_decrease_key_no_replace(h, n->hn);
+  } else {
+    n->hn = heap_insert(h, n);
+  }
+}
+
+/* Relaxes everything joined to n, by a corridor or a room */
+static void region_expand(heap_t *h, region_node_t *n, pair_t to)
+{
+  uint32_t i, j, k;
+
+  for (i = 0; i < n->num_edges; i++) {
+    region_relax(h, n, region_edge[n->first_edge + i].to,
+                 region_edge[n->first_edge + i].cost, to);
+  }
+  /* Across a room is as the crow flies, but it's at least two steps *
+   * in and out again.                                               */
+  for (i = 0; i < 2 && n->room[i] >= 0; i++) {
+    for (j = region_room_first[n->room[i]];
+         j < region_room_first[n->room[i] + 1];
+         j++) {
+      if ((k = region_door[j]) != (uint32_t) (n - &region_node[0])) {
+        region_relax(h, n, k,
+                     std::max(region_distance(n->pos, region_node[k].pos),
+                              2U),
+                     to);
+      }
+    }
+  }
+}
+
+/* Dijkstra over the whole graph from node source.  Every node it gets *
+ * to is left with its distance in g, until the next search.           */
+static void region_flood(uint32_t source)
+{
+  heap_t h;
+  region_node_t *n;
+  pair_t nowhere;
+
+  region_search++;
+  region_estimating = 0;
+  nowhere[dim_x] = nowhere[dim_y] = 0;
+  heap_init(&h, region_cmp, NULL);
+  n = region_touch(source);
+  n->g = n->f = 0;
+  n->parent = -1;
+  n->hn = heap_insert(&h, n);
+  while ((n = (region_node_t *) heap_remove_min(&h))) {
+    n->hn = NULL;
+    region_expand(&h, n, nowhere);
+  }
+  heap_delete(&h);
+}
+
+/* Spreads the landmarks over the biggest component, each as far as it *
+ * can get from the nearest of the ones before it, and records how far *
+ * every node is from each.  Nodes anywhere else just don't get any.   */
+static void region_place_landmarks(void)
+{
+  std::vector<uint32_t> size, nearest;
+  uint32_t i, l, biggest, farthest;
+
+  region_landmark.assign(region_node.size() * REGION_LANDMARKS,
+                         REGION_UNREACHED);
+  if (region_node.empty()) {
+    return;
+  }
+
+  size.assign(region_node.size(), 0);
+  for (biggest = i = 0; i < region_node.size(); i++) {
+    if (++size[region_node[i].component] > size[biggest]) {
+      biggest = region_node[i].component;
+    }
+  }
+
+  /* The first one is as far as it gets from anywhere in the component */
+  nearest.assign(region_node.size(), REGION_UNREACHED);
+  region_flood(biggest);
+  for (i = 0; i < region_node.size(); i++) {
+    if (region_node[i].stamp == region_search) {
+      nearest[i] = region_node[i].g;
+    }
+  }
+
+  for (l = 0; l < REGION_LANDMARKS; l++) {
+    for (farthest = biggest, i = 0; i < region_node.size(); i++) {
+      if (nearest[i] != REGION_UNREACHED && nearest[i] > nearest[farthest]) {
+        farthest = i;
+      }
+    }
+    region_flood(farthest);
+    for (i = 0; i < region_node.size(); i++) {
+      if (region_node[i].stamp == region_search) {
+        region_landmark[i * REGION_LANDMARKS + l] = region_node[i].g;
+        nearest[i] = l ? std::min(nearest[i], region_node[i].g) :
+                         region_node[i].g;
+      }
+    }
+  }
+}
+
+static void region_prepare(dungeon *d)
+{
+  if (region_built != bitboard_rebuilds()) {
+    region_build(d);
+    region_place_landmarks();
+  }
+}
+
+uint32_t region_next_step(dungeon *d, pair_t from, pair_t to, pair_t next)
+{
+  PROFILE_SCOPE("region_next_step");
+  heap_t h;
+  region_node_t *n;
+  uint32_t best, i, k, l, tag;
+  int32_t best_node, w, e;
+
+  region_prepare(d);
+
+  if (from[dim_x] == to[dim_x] && from[dim_y] == to[dim_y]) {
+    return 0;
+  }
+
+  /* Close enough for either window to find the way is a trip in       *
+   * itself, and as good as any if it's straight there, but otherwise  *
+   * the way round might still be shorter on the graph, if the windows *
+   * cut it off.                                                       */
+  region_window_search(d, &region_start, from);
+  if ((w = region_window_index(&region_start, to)) >= 0 &&
+      region_start.distance[w] == region_distance(from, to)) {
+    region_window_step(&region_start, w, next);
+    return 1;
+  }
+  region_window_search(d, &region_end, to);
+  if ((e = region_window_index(&region_end, from)) >= 0 &&
+      (w < 0 || region_end.distance[e] < region_start.distance[w])) {
+    w = -1;
+  } else {
+    e = -1;
+  }
+
+  region_search++;
+  heap_init(&h, region_cmp, NULL);
+
+  /* Every node near the end knows how far it is from it, and every node *
+   * near the start is somewhere to set out from.                        */
+  for (l = 0; l < REGION_LANDMARKS; l++) {
+    region_exit_near[l] = INT32_MAX;
+    region_exit_far[l] = INT32_MIN;
+  }
+  for (i = 0; i < REGION_WINDOW * REGION_WINDOW; i++) {
+    if (region_end.distance[i] != REGION_UNREACHED &&
+        ((tag = region_tag[region_end.center[dim_y] - REGION_LOCAL +
+                           i / REGION_WINDOW]
+                          [region_end.center[dim_x] - REGION_LOCAL +
+                           i % REGION_WINDOW]) & REGION_NODE)) {
+      region_touch(REGION_INDEX(tag))->exit = region_end.distance[i];
+      for (l = 0; l < REGION_LANDMARKS; l++) {
+        if ((k = region_landmark[REGION_INDEX(tag) * REGION_LANDMARKS + l]) !=
+            REGION_UNREACHED) {
+          region_exit_near[l] = std::min(region_exit_near[l],
+                                         (int32_t) (k +
+                                                    region_end.distance[i]));
+          region_exit_far[l] = std::max(region_exit_far[l],
+                                        (int32_t) (k -
+                                                   region_end.distance[i]));
+        }
+      }
+    }
+  }
+  region_estimating = 1;
+  for (i = 0; i < REGION_WINDOW * REGION_WINDOW; i++) {
+    if (region_start.distance[i] != REGION_UNREACHED &&
+        ((tag = region_tag[region_start.center[dim_y] - REGION_LOCAL +
+                           i / REGION_WINDOW]
+                          [region_start.center[dim_x] - REGION_LOCAL +
+                           i % REGION_WINDOW]) & REGION_NODE)) {
+      n = region_touch(REGION_INDEX(tag));
+      n->g = region_start.distance[i];
+      n->f = n->g + region_estimate(n, to);
+      n->parent = -1;
+      n->hn = heap_insert(&h, n);
+    }
+  }
+
+  /* A*, with the end of the trip as one more node, reached from every *
+   * node that has an exit.                                            */
+  for (best = (w >= 0 ? region_start.distance[w] :
+               e >= 0 ? region_end.distance[e] : REGION_UNREACHED),
+       best_node = -1;
+       (n = (region_node_t *) heap_remove_min(&h)) && n->f < best; ) {
+    n->hn = NULL;
+    if (n->exit != REGION_UNREACHED && n->g + n->exit < best) {
+      best = n->g + n->exit;
+      best_node = n - &region_node[0];
+    }
+    region_expand(&h, n, to);
+  }
+  heap_delete(&h);
+
+  if (best_node < 0) {
+    if (w >= 0) {
+      region_window_step(&region_start, w, next);
+    } else if (e >= 0) {
+      region_window_cell(&region_end, region_end.prev[e], next);
+    } else {
+      return 0;
+    }
+    return 1;
+  }
+
+  /* Head for the first node on the way that we aren't standing on */
+  for (i = best_node; region_node[i].parent >= 0; i = region_node[i].parent) {
+    if (region_node[region_node[i].parent].pos[dim_x] == from[dim_x] &&
+        region_node[region_node[i].parent].pos[dim_y] == from[dim_y]) {
+      break;
+    }
+  }
+  if ((w = region_window_index(&region_start, region_node[i].pos)) < 0 ||
+      !region_start.distance[w]) {
+    /* Too far along a corridor to see from here, or we're on it, and *
+     * the trip ends within a step of it.                             */
+    return 0;
+  }
+  region_window_step(&region_start, w, next);
+
+  return 1;
+}
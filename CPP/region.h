@@ -0,0 +1,33 @@
+#ifndef REGION_H
+# define REGION_H
+
+# include <stdint.h>
+
+# include "dims.h"
+
+class dungeon;
+
+/* A coarse map of the dungeon, for going a long way on foot.  Its nodes *
+ * are doors, the corridor cells just outside each room, and gates,      *
+ * the corridor cells on lines every REGION_CLUSTER cells across and     *
+ * down.  Doors of a room are joined through it, and nodes along the     *
+ * corridors between them, by how many steps apart they are, so a trip   *
+ * across the whole map is a search of a few hundred nodes.  The map     *
+ * itself is only searched within REGION_LOCAL of either end, to get     *
+ * onto the graph and off it again, and for the first step.              *
+ *                                                                       *
+ * The graph, with how far every node is from each of a few landmarks,  *
+ * which A* uses to tell how far a trip has left at the least, is built  *
+ * the first time it's needed after the map is replaced (see             *
+ * bitboard_rebuilds()).  Cells dug out since then aren't in it, but     *
+ * nothing is ever filled back in, so routes stay good; they might just  *
+ * miss a shortcut.                                                      */
+
+# define REGION_CLUSTER 16
+# define REGION_LOCAL   (2 * REGION_CLUSTER)
+
+/* Sets next to the first step on foot from from toward to and returns *
+ * nonzero, or returns zero if there's no way there, or from is to.    */
+uint32_t region_next_step(dungeon *d, pair_t from, pair_t to, pair_t next);
+
+#endif
@@ -0,0 +1,276 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <time.h>
+
+#include "replay.h"
+#include "dungeon.h"
+#include "zobrist.h"
+
+#define REPLAY_SEMANTIC "RLG327-REPLAY"
+#define REPLAY_VERSION  5U
+
+typedef enum replay_mode {
+  replay_off,
+  replay_recording,
+  replay_replaying
+} replay_mode_t;
+
+static replay_mode_t replay_mode = replay_off;
+static FILE *replay_file;
+static uint64_t replay_hash;
+static uint32_t replay_turns;
+static struct timespec replay_started;
+/* When replaying, the entry the game hasn't asked for yet.  Type is 0 *
+ * at the end of the file.                                             */
+static char replay_type;
+static uint64_t replay_value;
+
+/* 64-bit FNV-1a, a word at a time */
+static uint64_t fnv(uint64_t h, uint64_t v)
+{
+  return (h ^ v) * 1099511628211ULL;
+}
+
+static void replay_advance(void)
+{
+  int c;
+
+  replay_value = 0;
+  do {
+    c = fgetc(replay_file);
+  } while (c == '\n');
+
+  switch (c) {
+  case 't':
+  case 'e':
+    if (fscanf(replay_file, " %" SCNx64, &replay_value) != 1) {
+      c = EOF;
+    }
+    break;
+  case 'k':
+    if (fscanf(replay_file, " %" SCNu64, &replay_value) != 1) {
+      c = EOF;
+    }
+    break;
+  case 'i':
+    break;
+  default:
+    c = EOF;
+  }
+
+  replay_type = (c == EOF) ? 0 : c;
+}
+
+static const char *replay_describe(char type)
+{
+  switch (type) {
+  case 't':
+    return "a turn";
+  case 'k':
+    return "a key";
+  case 'i':
+    return "a run interrupted";
+  case 'e':
+    return "the end of the game";
+  default:
+    return "the end of the recording";
+  }
+}
+
+static double replay_elapsed(void)
+{
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  return ((now.tv_sec - replay_started.tv_sec) +
+          (now.tv_nsec - replay_started.tv_nsec) / 1e9);
+}
+
+static void replay_report(void)
+{
+  double s = replay_elapsed();
+
+  fprintf(stderr, "Replayed %u turns in %.3f seconds (%.0f turns/s).\n",
+          replay_turns, s, s > 0 ? replay_turns / s : 0.0);
+}
+
+/* There's no sensible way to carry on once the game has stopped doing *
+ * what the recording did, and the backend has no terminal to restore. */
+static void replay_diverged(const char *wanted)
+{
+  fprintf(stderr, "Replay diverged at turn %u: the game wanted %s, "
+          "but the recording has %s.\n",
+          replay_turns, wanted, replay_describe(replay_type));
+  exit(1);
+}
+
+uint32_t replay_record(const char *file, uint32_t seed,
+                       uint16_t nummon, uint16_t objcount, uint32_t modes)
+{
+  if (!(replay_file = fopen(file, "w"))) {
+    return 1;
+  }
+  /* Line buffered, so a game that crashes leaves everything up to the *
+   * crash behind.                                                     */
+  setvbuf(replay_file, NULL, _IOLBF, 0);
+
+  fprintf(replay_file, "%s %u\nseed %u nummon %hu objcount %hu size %dx%d "
+          "flags %x\n", REPLAY_SEMANTIC, REPLAY_VERSION, seed, nummon,
+          objcount, DUNGEON_X, DUNGEON_Y, modes);
+  replay_mode = replay_recording;
+
+  return 0;
+}
+
+uint32_t replay_open(const char *file, uint32_t *seed,
+                     uint16_t *nummon, uint16_t *objcount, uint32_t *modes)
+{
+  uint32_t version;
+  int32_t x, y;
+
+  if (!(replay_file = fopen(file, "r"))) {
+    return 1;
+  }
+
+  if (fscanf(replay_file, REPLAY_SEMANTIC " %u seed %u nummon %hu "
+             "objcount %hu size %dx%d flags %x",
+             &version, seed, nummon, objcount, &x, &y, modes) != 7 ||
+      version != REPLAY_VERSION || (*modes & ~REPLAY_MODES) ||
+      set_dungeon_size(x, y)) {
+    fclose(replay_file);
+    return 1;
+  }
+
+  replay_mode = replay_replaying;
+  replay_advance();
+
+  return 0;
+}
+
+void replay_turn(dungeon *d)
+{
+  if (replay_mode == replay_off) {
+    return;
+  }
+
+  /* Time the game, not building the dungeon. */
+  if (!replay_turns++) {
+    clock_gettime(CLOCK_MONOTONIC, &replay_started);
+  }
+  replay_hash = fnv(replay_hash, zobrist_hash(d));
+
+  if (replay_mode == replay_recording) {
+    fprintf(replay_file, "t %016" PRIx64 "\n", replay_hash);
+    return;
+  }
+
+  if (replay_type != 't') {
+    replay_diverged(replay_describe('t'));
+  }
+  /* Catches an optimization that forgets to update d->hash, which is *
+   * otherwise only seen as a divergence further down the line.       */
+  if (zobrist_hash(d) != zobrist_compute(d)) {
+    fprintf(stderr, "Hash is stale at turn %u: something changed the "
+            "game without updating d->hash.\n", replay_turns);
+    exit(1);
+  }
+  if (replay_value != replay_hash) {
+    fprintf(stderr, "Replay diverged at turn %u: state hash is %016" PRIx64
+            ", recorded %016" PRIx64 ".\n",
+            replay_turns, replay_hash, replay_value);
+    exit(1);
+  }
+  replay_advance();
+}
+
+void replay_key(int key)
+{
+  if (replay_mode == replay_recording) {
+    fprintf(replay_file, "k %d\n", key);
+  }
+}
+
+uint32_t replay_interrupt(uint32_t pending)
+{
+  switch (replay_mode) {
+  case replay_recording:
+    if (pending) {
+      fputs("i\n", replay_file);
+    }
+    return pending;
+  case replay_replaying:
+    if (replay_type == 'i') {
+      replay_advance();
+      return 1;
+    }
+    return 0;
+  default:
+    return pending;
+  }
+}
+
+int replay_finish(dungeon *d)
+{
+  uint64_t h;
+
+  if (replay_mode == replay_off) {
+    return 0;
+  }
+
+  h = fnv(replay_hash, zobrist_hash(d));
+
+  if (replay_mode == replay_recording) {
+    fprintf(replay_file, "e %016" PRIx64 "\n", h);
+    fclose(replay_file);
+    replay_mode = replay_off;
+    return 0;
+  }
+
+  fclose(replay_file);
+  replay_mode = replay_off;
+
+  if (replay_type != 'e') {
+    fprintf(stderr, "Replay diverged at turn %u: the game ended, "
+            "but the recording has %s.\n",
+            replay_turns, replay_describe(replay_type));
+    return 1;
+  }
+  if (replay_value != h) {
+    fprintf(stderr, "Replay diverged at the end: state hash is %016" PRIx64
+            ", recorded %016" PRIx64 ".\n", h, replay_value);
+    return 1;
+  }
+
+  replay_report();
+
+  return 0;
+}
+
+int replay_getch(int ms)
+{
+  int key;
+
+  if (!replay_type) {
+    /* A recording of a game that never finished, most likely killed *
+     * or crashed.  It matched for as long as it went.               */
+    fprintf(stderr, "Recording ends at turn %u, before the game did.\n",
+            replay_turns);
+    replay_report();
+    exit(0);
+  }
+  if (replay_type != 'k') {
+    replay_diverged(replay_describe('k'));
+  }
+
+  key = replay_value;
+  replay_advance();
+
+  return key;
+}
+
+int replay_key_pending(void)
+{
+  return 0;
+}
@@ -0,0 +1,58 @@
+#ifndef REPLAY_H
+# define REPLAY_H
+
+# include <stdint.h>
+
+class dungeon;
+
+/* --record and --replay.  A recording is a text file holding the seed,  *
+ * the monster and object counts, the dungeon size, and the modes the    *
+ * game was played in, which are all it takes to build the same starting *
+ * dungeon and play it the same way, followed by one line for each thing *
+ * the player did, in the order the game asked for it:                   *
+ *                                                                       *
+ *   t <hash>  the start of a PC turn, and zobrist_hash() at that point  *
+ *   k <key>   a key, as io_handle_input() and the menus saw it          *
+ *   i         a key typed while the PC was running, which stopped it    *
+ *   e <hash>  the end of the game                                       *
+ *                                                                       *
+ * The hash rolls: each turn's is folded into the last, so a match says  *
+ * that every turn up to this one played out the same.  A replay feeds   *
+ * the keys back through a backend that draws nothing and never waits,   *
+ * and stops at the first turn whose hash differs.                       */
+
+/* Modes that change how a game plays out, so a recording has to say *
+ * which it was played in.  A new one only needs a bit here, and in  *
+ * REPLAY_MODES; recordings from before it just don't have it set.   */
+# define REPLAY_WORLD   0x00000001 /* --world   */
+# define REPLAY_LOD     0x00000002 /* --lod     */
+# define REPLAY_DORMANT 0x00000004 /* --dormant */
+# define REPLAY_FLOW    0x00000008 /* --flow    */
+# define REPLAY_MODES   (REPLAY_WORLD | REPLAY_LOD | REPLAY_DORMANT | \
+                         REPLAY_FLOW)
+
+/* Both return nonzero if the file can't be used. */
+uint32_t replay_record(const char *file, uint32_t seed,
+                       uint16_t nummon, uint16_t objcount, uint32_t modes);
+/* Fills in what the recorded game was started with, and sets the    *
+ * dungeon size to what it was played at.  Recordings in modes this  *
+ * build doesn't know about can't be used.                           */
+uint32_t replay_open(const char *file, uint32_t *seed,
+                     uint16_t *nummon, uint16_t *objcount, uint32_t *modes);
+
+/* Called at the start of every PC turn. */
+void replay_turn(dungeon *d);
+/* Records key, if we're recording. */
+void replay_key(int key);
+/* Given whether a key is waiting to stop the PC running, returns *
+ * whether one was (or, when replaying, whether one was then).    */
+uint32_t replay_interrupt(uint32_t pending);
+/* Checks or records the final state and closes the file.  Returns the *
+ * exit status for main(): nonzero if a replay didn't match.           */
+int replay_finish(dungeon *d);
+
+/* The input half of the headless backend in io.cpp */
+int replay_getch(int ms);
+int replay_key_pending(void);
+
+#endif
@@ -11,6 +11,11 @@
 #include "move.h"
 #include "io.h"
 #include "object.h"
+#include "profile.h"
+#include "replay.h"
+#include "zobrist.h"
+#include "world.h"
+#include "intent.h"
 
 const char *victory =
   "\n                                       o\n"
@@ -82,7 +87,11 @@ void usage(char *name)
   fprintf(stderr,
           "Usage: %s [-r|--rand <seed>] [-l|--load [<file>]]\n"
           "          [-s|--save [<file>]] [-i|--image <pgm file>]\n"
-          "          [-n|--nummon <count>] [-o|--objcount <oject count>]\n",
+          "          [-n|--nummon <count>] [-o|--objcount <oject count>]\n"
+          "          [-a|--ansi] [-p|--profile] [-t|--trace <file>]\n"
+          "          [--record <file>] [--replay <file>]\n"
+          "          [--size <width>x<height>] [--world] [--lod]\n"
+          "          [--dormant] [--threads <count>] [--flow]\n",
           name);
 
   exit(-1);
@@ -95,19 +104,30 @@ int main(int argc, char *argv[])
   struct timeval tv;
   int32_t i;
   uint32_t do_load, do_save, do_seed, do_image, do_save_seed, do_save_image;
+  uint32_t do_size, do_world;
+  uint32_t threads;
+  long cpus;
   uint32_t long_arg;
+  uint32_t replay_seed, modes;
+  int32_t size_x, size_y;
+  int status;
   char *save_file;
   char *load_file;
   char *pgm_file;
+  char *record_file;
+  char *replay_file;
   const char *ending_message;
+  io_backend_type_t backend;
 
   /* Default behavior: Seed with the time, generate a new dungeon, *
    * and don't write to disk.                                      */
   do_load = do_save = do_image = do_save_seed = do_save_image = 0;
+  do_size = do_world = threads = 0;
   do_seed = 1;
-  save_file = load_file = NULL;
+  save_file = load_file = record_file = replay_file = NULL;
   d.max_monsters = MAX_MONSTERS;
   d.max_objects = MAX_OBJECTS;
+  backend = io_backend_curses;
 
   /* The project spec requires '--load' and '--save'.  It's common  *
    * to have short and long forms of most switches (assuming you    *
@@ -140,6 +160,21 @@ int main(int argc, char *argv[])
           }
           break;
         case 'r':
+          /* No short forms for these two; '-r' was already taken. */
+          if (long_arg && !strcmp(argv[i], "-record")) {
+            if (argc < ++i + 1) {
+              usage(argv[0]);
+            }
+            record_file = argv[i];
+            break;
+          }
+          if (long_arg && !strcmp(argv[i], "-replay")) {
+            if (argc < ++i + 1) {
+              usage(argv[0]);
+            }
+            replay_file = argv[i];
+            break;
+          }
           if ((!long_arg && argv[i][2]) ||
               (long_arg && strcmp(argv[i], "-rand")) ||
               argc < ++i + 1 /* No more arguments */ ||
@@ -148,7 +183,26 @@ int main(int argc, char *argv[])
           }
           do_seed = 0;
           break;
+        case 'd':
+          /* Long form only, like --lod */
+          if (!long_arg || strcmp(argv[i], "-dormant")) {
+            usage(argv[0]);
+          }
+          d.dormant = 1;
+          break;
+        case 'f':
+          /* Long form only, like --lod */
+          if (!long_arg || strcmp(argv[i], "-flow")) {
+            usage(argv[0]);
+          }
+          d.flow = 1;
+          break;
         case 'l':
+          /* Long form only; '-l' is load. */
+          if (long_arg && !strcmp(argv[i], "-lod")) {
+            d.lod = 1;
+            break;
+          }
           if ((!long_arg && argv[i][2]) ||
               (long_arg && strcmp(argv[i], "-load"))) {
             usage(argv[0]);
@@ -161,6 +215,21 @@ int main(int argc, char *argv[])
           }
           break;
         case 's':
+          /* Long form only, since '-s' is save. */
+          if (long_arg && !strcmp(argv[i], "-size")) {
+            if (argc < ++i + 1 ||
+                sscanf(argv[i], "%dx%d", &size_x, &size_y) != 2) {
+              usage(argv[0]);
+            }
+            if (set_dungeon_size(size_x, size_y)) {
+              fprintf(stderr, "Dungeon size must be from %dx%d to %dx%d.\n",
+                      DEFAULT_DUNGEON_X, DEFAULT_DUNGEON_Y,
+                      MAX_DUNGEON_X, MAX_DUNGEON_Y);
+              return -1;
+            }
+            do_size = 1;
+            break;
+          }
           if ((!long_arg && argv[i][2]) ||
               (long_arg && strcmp(argv[i], "-save"))) {
             usage(argv[0]);
@@ -202,6 +271,51 @@ int main(int argc, char *argv[])
             usage(argv[0]);
           }
           break;
+        case 'a':
+          if ((!long_arg && argv[i][2]) ||
+              (long_arg && strcmp(argv[i], "-ansi"))) {
+            usage(argv[0]);
+          }
+          /* Skip curses and write escape sequences ourselves. */
+          backend = io_backend_ansi;
+          break;
+        case 'p':
+          if ((!long_arg && argv[i][2]) ||
+              (long_arg && strcmp(argv[i], "-profile"))) {
+            usage(argv[0]);
+          }
+          if (!profile_start()) {
+            fprintf(stderr, "Profiling is not built in.  "
+                    "Rebuild with 'make clean; make PROFILE=1'.\n");
+          }
+          break;
+        case 't':
+          /* Long form only; '-t' is trace. */
+          if (long_arg && !strcmp(argv[i], "-threads")) {
+            if (argc < ++i + 1 || !sscanf(argv[i], "%u", &threads) ||
+                !threads) {
+              usage(argv[0]);
+            }
+            break;
+          }
+          if ((!long_arg && argv[i][2]) ||
+              (long_arg && strcmp(argv[i], "-trace")) ||
+              argc < ++i + 1 /* No more arguments */) {
+            usage(argv[0]);
+          }
+          /* Chrome trace-event JSON, for chrome://tracing or Perfetto */
+          if (!profile_trace(argv[i])) {
+            fprintf(stderr, "Can't trace to %s.  Tracing needs the profiler; "
+                    "rebuild with 'make clean; make PROFILE=1'.\n", argv[i]);
+          }
+          break;
+        case 'w':
+          /* Long form only, to match --size */
+          if (!long_arg || strcmp(argv[i], "-world")) {
+            usage(argv[0]);
+          }
+          do_world = 1;
+          break;
         default:
           usage(argv[0]);
         }
@@ -211,6 +325,34 @@ int main(int argc, char *argv[])
     }
   }
 
+  if (replay_file) {
+    /* The recording says how the game was started, and the keys *
+     * come from it, not the terminal.                           */
+    if (do_load || do_image || record_file) {
+      usage(argv[0]);
+    }
+    if (replay_open(replay_file, &replay_seed,
+                    &d.max_monsters, &d.max_objects, &modes)) {
+      fprintf(stderr, "Can't replay %s.\n", replay_file);
+      return -1;
+    }
+    do_world = !!(modes & REPLAY_WORLD);
+    d.lod = !!(modes & REPLAY_LOD);
+    d.dormant = !!(modes & REPLAY_DORMANT);
+    d.flow = !!(modes & REPLAY_FLOW);
+    seed = replay_seed;
+    do_seed = 0;
+    backend = io_backend_replay;
+  }
+
+  if (do_world) {
+    /* The world is made of chunks, and doesn't come from a file. */
+    if (do_load || do_image || do_size) {
+      usage(argv[0]);
+    }
+    set_dungeon_size(WORLD_X, WORLD_Y);
+  }
+
   if (do_seed) {
     /* Allows me to generate more than one dungeon *
      * per second, as opposed to time().           */
@@ -220,14 +362,41 @@ int main(int argc, char *argv[])
 
   srand(seed);
 
+  if (record_file) {
+    /* A recording only holds what it takes to generate the dungeon. */
+    if (do_load || do_image) {
+      usage(argv[0]);
+    }
+    modes = ((do_world ? REPLAY_WORLD : 0) |
+             (d.lod ? REPLAY_LOD : 0) |
+             (d.dormant ? REPLAY_DORMANT : 0) |
+             (d.flow ? REPLAY_FLOW : 0));
+    if (replay_record(record_file, seed, d.max_monsters, d.max_objects,
+                      modes)) {
+      fprintf(stderr, "Can't record to %s.\n", record_file);
+      return -1;
+    }
+  }
+
+  if (threads) {
+    /* Any more than there are CPUs would only get in each other's way. *
+     * Games come out the same either way, so recordings don't care.    */
+    if ((cpus = sysconf(_SC_NPROCESSORS_ONLN)) > 0 && threads > cpus) {
+      threads = cpus;
+    }
+    intent_start(threads);
+  }
+
   parse_descriptions(&d);
-  io_init_terminal();
+  io_init_terminal(backend);
   init_dungeon(&d);
 
   if (do_load) {
     read_dungeon(&d, load_file);
   } else if (do_image) {
     read_pgm(&d, pgm_file);
+  } else if (do_world) {
+    world_init(&d, seed);
   } else {
     gen_dungeon(&d);
   }
@@ -236,6 +405,7 @@ int main(int argc, char *argv[])
   config_pc(&d);
   gen_monsters(&d);
   gen_objects(&d);
+  zobrist_rebuild(&d);
   pc_observe_terrain(d.PC, &d);
   
   io_display(&d);
@@ -246,8 +416,10 @@ int main(int argc, char *argv[])
     do_moves(&d);
   }
   io_display(&d);
+  status = replay_finish(&d);
 
   io_reset_terminal();
+  intent_stop();
 
   if (do_save) {
     if (do_save_seed) {
@@ -285,6 +457,8 @@ int main(int argc, char *argv[])
   printf("You defended your life in the face of %u deadly beasts.\n",
 	 d.PC->kills[kill_direct]);
 
+  profile_report(stderr);
+
   delete_pc_inventory(&d);
   delete_pc_equipment(&d);
   if (pc_is_alive(&d)) {
@@ -295,7 +469,8 @@ int main(int argc, char *argv[])
   }
 
   delete_dungeon(&d);
+  world_delete();
   destroy_descriptions(&d);
 
-  return 0;
+  return status;
 }
@@ -0,0 +1,126 @@
+#include <stdlib.h>
+
+#include "spatial.h"
+#include "dungeon.h"
+#include "character.h"
+
+#define bucketpair(pair) (d->spatial[pair[dim_y] >> SPATIAL_SHIFT] \
+                                    [pair[dim_x] >> SPATIAL_SHIFT])
+
+void spatial_insert(dungeon *d, character *c)
+{
+  bucketpair(c->position).push_back(c);
+}
+
+static void bucket_remove(std::vector<character *> &b, character *c)
+{
+  uint32_t i;
+
+  for (i = 0; i < b.size(); i++) {
+    if (b[i] == c) {
+      b[i] = b.back();
+      b.pop_back();
+      return;
+    }
+  }
+}
+
+void spatial_remove(dungeon *d, character *c)
+{
+  bucket_remove(bucketpair(c->position), c);
+}
+
+void spatial_move(dungeon *d, character *c, pair_t from)
+{
+  if (((from[dim_x] ^ c->position[dim_x]) >> SPATIAL_SHIFT) ||
+      ((from[dim_y] ^ c->position[dim_y]) >> SPATIAL_SHIFT)) {
+    bucket_remove(bucketpair(from), c);
+    spatial_insert(d, c);
+  }
+}
+
+void spatial_clear(dungeon *d)
+{
+  int32_t x, y;
+
+  /* clear() keeps the capacity, so after the first level, *
+   * the index never allocates again.                      */
+  for (y = 0; y < SPATIAL_Y; y++) {
+    for (x = 0; x < SPATIAL_X; x++) {
+      d->spatial[y][x].clear();
+    }
+  }
+}
+
+/* Orders by Chebyshev distance from center, then row-major. */
+static inline int32_t spatial_before(pair_t center,
+                                     character *a, character *b)
+{
+  int32_t da, db;
+
+  da = abs(a->position[dim_x] - center[dim_x]);
+  if (abs(a->position[dim_y] - center[dim_y]) > da) {
+    da = abs(a->position[dim_y] - center[dim_y]);
+  }
+  db = abs(b->position[dim_x] - center[dim_x]);
+  if (abs(b->position[dim_y] - center[dim_y]) > db) {
+    db = abs(b->position[dim_y] - center[dim_y]);
+  }
+
+  if (da != db) {
+    return da < db;
+  }
+  if (a->position[dim_y] != b->position[dim_y]) {
+    return a->position[dim_y] < b->position[dim_y];
+  }
+  return a->position[dim_x] < b->position[dim_x];
+}
+
+uint32_t spatial_query(dungeon *d, pair_t center, int16_t radius,
+                       character **out, uint32_t max)
+{
+  int32_t bx, by, bx0, bx1, by0, by1;
+  uint32_t i, j, count;
+  character *c;
+
+  if (!max) {
+    return 0;
+  }
+
+  bx0 = center[dim_x] - radius < 0 ? 0 : center[dim_x] - radius;
+  bx1 = (center[dim_x] + radius >= DUNGEON_X ?
+         DUNGEON_X - 1 : center[dim_x] + radius);
+  by0 = center[dim_y] - radius < 0 ? 0 : center[dim_y] - radius;
+  by1 = (center[dim_y] + radius >= DUNGEON_Y ?
+         DUNGEON_Y - 1 : center[dim_y] + radius);
+  bx0 >>= SPATIAL_SHIFT;
+  bx1 >>= SPATIAL_SHIFT;
+  by0 >>= SPATIAL_SHIFT;
+  by1 >>= SPATIAL_SHIFT;
+
+  for (count = 0, by = by0; by <= by1; by++) {
+    for (bx = bx0; bx <= bx1; bx++) {
+      for (i = 0; i < d->spatial[by][bx].size(); i++) {
+        c = d->spatial[by][bx][i];
+        if (abs(c->position[dim_x] - center[dim_x]) > radius ||
+            abs(c->position[dim_y] - center[dim_y]) > radius) {
+          continue;
+        }
+        /* Insertion sort, keeping only the nearest max. */
+        for (j = count; j && spatial_before(center, c, out[j - 1]); j--) {
+          if (j < max) {
+            out[j] = out[j - 1];
+          }
+        }
+        if (j < max) {
+          out[j] = c;
+          if (count < max) {
+            count++;
+          }
+        }
+      }
+    }
+  }
+
+  return count;
+}
@@ -0,0 +1,29 @@
+#ifndef SPATIAL_H
+# define SPATIAL_H
+
+# include <stdint.h>
+
+# include "dims.h"
+
+class dungeon;
+class character;
+
+/* The spatial index buckets monsters (never the PC) by position into *
+ * squares of (1 << SPATIAL_SHIFT) cells on a side, so that "who is    *
+ * near here" only has to look at the few buckets overlapping the      *
+ * query instead of walking the whole character map.  Anything that    *
+ * puts a monster on the map, moves it, or takes it off must keep the  *
+ * index up to date with the calls below.                              */
+
+void spatial_insert(dungeon *d, character *c);
+void spatial_remove(dungeon *d, character *c);
+/* Call after c->position has been updated; from is where it used to be. */
+void spatial_move(dungeon *d, character *c, pair_t from);
+void spatial_clear(dungeon *d);
+/* Fills out with at most max monsters within radius (Chebyshev) of     *
+ * center, nearest first, ties broken in row-major order.  Returns the  *
+ * number found.  Never allocates.                                      */
+uint32_t spatial_query(dungeon *d, pair_t center, int16_t radius,
+                       character **out, uint32_t max);
+
+#endif
@@ -0,0 +1,521 @@
+#include <stdlib.h>
+#include <string.h>
+#include <map>
+#include <vector>
+
+#include "world.h"
+#include "dungeon.h"
+#include "pc.h"
+#include "npc.h"
+#include "object.h"
+#include "event.h"
+#include "path.h"
+#include "io.h"
+#include "bitboard.h"
+#include "spatial.h"
+#include "zobrist.h"
+#include "profile.h"
+
+typedef std::pair<int32_t, int32_t> chunk_key_t;
+
+typedef enum world_salt {
+  world_terrain,
+  world_east_gate,
+  world_south_gate
+} world_salt_t;
+
+static uint32_t world_on;
+static uint64_t world_seed;
+/* Chunk coordinates of the chunk at the top left of the window */
+static int32_t world_origin[num_dims];
+/* Chunks that have left the window, and where they are in the store */
+static FILE *world_store;
+static std::map<chunk_key_t, long> world_index;
+/* One chunk, being generated, read, or written.  Everything in dungeon.cpp *
+ * works on a dungeon DUNGEON_X by DUNGEON_Y, so anything done to this is   *
+ * bracketed by world_chunk_begin() and world_chunk_end().                  */
+static dungeon world_chunk;
+static int16_t world_saved_x, world_saved_y;
+
+static void world_chunk_begin(void)
+{
+  world_saved_x = dungeon_x;
+  world_saved_y = dungeon_y;
+  dungeon_x = WORLD_CHUNK_X;
+  dungeon_y = WORLD_CHUNK_Y;
+}
+
+static void world_chunk_end(void)
+{
+  dungeon_x = world_saved_x;
+  dungeon_y = world_saved_y;
+}
+
+/* The splitmix64 finalizer, as in zobrist.cpp */
+static inline uint64_t world_mix(uint64_t z)
+{
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+
+  return z ^ (z >> 31);
+}
+
+static uint64_t world_key(int32_t cx, int32_t cy, world_salt_t salt)
+{
+  return world_mix(world_mix(world_seed + salt) ^
+                   ((uint64_t) (uint32_t) cx << 32 | (uint32_t) cy));
+}
+
+/* The gate between chunk (cx, cy) and the one east of it is in this row */
+static int16_t world_east_gate_row(int32_t cx, int32_t cy)
+{
+  return 1 + world_key(cx, cy, world_east_gate) % (WORLD_CHUNK_Y - 2);
+}
+
+/* and the one between it and the one south of it, in this column. */
+static int16_t world_south_gate_column(int32_t cx, int32_t cy)
+{
+  return 1 + world_key(cx, cy, world_south_gate) % (WORLD_CHUNK_X - 2);
+}
+
+/* Opens the wall at (x, y) on the edge of a chunk whose top left is at *
+ * o in d, and if dig is set goes on in the direction (dx, dy) until    *
+ * it's through to open floor.                                          */
+static void world_gate(dungeon *d, pair_t o, int16_t x, int16_t y,
+                       int16_t dx, int16_t dy, uint32_t dig)
+{
+  do {
+    mapxy(o[dim_x] + x, o[dim_y] + y) = ter_floor_hall;
+    hardnessxy(o[dim_x] + x, o[dim_y] + y) = 0;
+    x += dx;
+    y += dy;
+  } while (dig && x > 0 && x < WORLD_CHUNK_X - 1 &&
+           y > 0 && y < WORLD_CHUNK_Y - 1 &&
+           mapxy(o[dim_x] + x, o[dim_y] + y) < ter_floor);
+}
+
+static void world_gates(dungeon *d, int32_t cx, int32_t cy, pair_t o,
+                        uint32_t dig)
+{
+  world_gate(d, o, WORLD_CHUNK_X - 1, world_east_gate_row(cx, cy),
+             -1, 0, dig);
+  world_gate(d, o, 0, world_east_gate_row(cx - 1, cy), 1, 0, dig);
+  world_gate(d, o, world_south_gate_column(cx, cy), WORLD_CHUNK_Y - 1,
+             0, -1, dig);
+  world_gate(d, o, world_south_gate_column(cx, cy - 1), 0, 0, 1, dig);
+}
+
+/* Into world_chunk.  The game's own random numbers carry on afterward *
+ * as if nothing had happened, apart from the one used to pick them up *
+ * again.                                                              */
+static void world_generate(int32_t cx, int32_t cy)
+{
+  dungeon *d = &world_chunk;
+  uint32_t r, i;
+  room_t *room;
+  pair_t p, o = { 0, 0 };
+
+  r = rand();
+  srand(world_key(cx, cy, world_terrain));
+  gen_dungeon(d);
+  srand(r);
+
+  /* There's nowhere for stairs to go; a room keeps its floor. */
+  for (p[dim_y] = 0; p[dim_y] < WORLD_CHUNK_Y; p[dim_y]++) {
+    for (p[dim_x] = 0; p[dim_x] < WORLD_CHUNK_X; p[dim_x]++) {
+      if (mappair(p) >= ter_stairs) {
+        mappair(p) = ter_floor_hall;
+        for (i = 0, room = d->rooms; i < d->num_rooms; i++, room++) {
+          if (p[dim_x] >= room->position[dim_x]                   &&
+              p[dim_x] < room->position[dim_x] + room->size[dim_x] &&
+              p[dim_y] >= room->position[dim_y]                   &&
+              p[dim_y] < room->position[dim_y] + room->size[dim_y]) {
+            mappair(p) = ter_floor_room;
+          }
+        }
+      }
+    }
+  }
+
+  world_gates(d, cx, cy, o, 1);
+}
+
+/* Puts chunk (origin + (sx, sy)) in the window, from the store if it's *
+ * been there before, and adds its rooms to rooms.                      */
+static void world_load(dungeon *d, int32_t sx, int32_t sy,
+                       std::vector<room_t> &rooms)
+{
+  std::map<chunk_key_t, long>::iterator it;
+  int32_t cx, cy, y;
+  uint32_t i;
+  room_t r;
+
+  cx = world_origin[dim_x] + sx;
+  cy = world_origin[dim_y] + sy;
+
+  world_chunk_begin();
+  if ((it = world_index.find(chunk_key_t(cx, cy))) != world_index.end()) {
+    fseek(world_store, it->second, SEEK_SET);
+    read_dungeon_from(&world_chunk, world_store, 0);
+  } else {
+    world_generate(cx, cy);
+  }
+  world_chunk_end();
+
+  for (y = 0; y < WORLD_CHUNK_Y; y++) {
+    memcpy(d->map[sy * WORLD_CHUNK_Y + y] + sx * WORLD_CHUNK_X,
+           world_chunk.map[y], WORLD_CHUNK_X * sizeof (terrain_type));
+    memcpy(d->hardness[sy * WORLD_CHUNK_Y + y] + sx * WORLD_CHUNK_X,
+           world_chunk.hardness[y], WORLD_CHUNK_X);
+  }
+  for (i = 0; i < world_chunk.num_rooms; i++) {
+    r = world_chunk.rooms[i];
+    r.position[dim_x] += sx * WORLD_CHUNK_X;
+    r.position[dim_y] += sy * WORLD_CHUNK_Y;
+    rooms.push_back(r);
+  }
+
+  free(world_chunk.rooms);
+  world_chunk.rooms = NULL;
+  world_chunk.num_rooms = 0;
+}
+
+static inline uint32_t world_in_slot(const int16_t *p, int32_t sx, int32_t sy)
+{
+  return (p[dim_x] / WORLD_CHUNK_X == sx && p[dim_y] / WORLD_CHUNK_Y == sy);
+}
+
+/* Writes chunk (origin + (sx, sy)) from the window to the store.  It  *
+ * goes back where it was last time, if there was one, since a chunk's *
+ * rooms never change and so neither does its size.                    */
+static void world_evict(dungeon *d, int32_t sx, int32_t sy)
+{
+  chunk_key_t key(world_origin[dim_x] + sx, world_origin[dim_y] + sy);
+  std::map<chunk_key_t, long>::iterator it;
+  int32_t y;
+  uint32_t i;
+  pair_t o = { 0, 0 };
+
+  for (y = 0; y < WORLD_CHUNK_Y; y++) {
+    memcpy(world_chunk.hardness[y],
+           d->hardness[sy * WORLD_CHUNK_Y + y] + sx * WORLD_CHUNK_X,
+           WORLD_CHUNK_X);
+  }
+  /* The edge of the window walls over any gates on it. */
+  world_gates(&world_chunk, key.first, key.second, o, 0);
+
+  world_chunk.rooms = (room_t *) malloc(sizeof (*world_chunk.rooms) *
+                                        d->num_rooms);
+  for (world_chunk.num_rooms = i = 0; i < d->num_rooms; i++) {
+    if (world_in_slot(d->rooms[i].position, sx, sy)) {
+      world_chunk.rooms[world_chunk.num_rooms] = d->rooms[i];
+      world_chunk.rooms[world_chunk.num_rooms].position[dim_x] -=
+        sx * WORLD_CHUNK_X;
+      world_chunk.rooms[world_chunk.num_rooms].position[dim_y] -=
+        sy * WORLD_CHUNK_Y;
+      world_chunk.num_rooms++;
+    }
+  }
+
+  if ((it = world_index.find(key)) != world_index.end()) {
+    fseek(world_store, it->second, SEEK_SET);
+  } else {
+    fseek(world_store, 0, SEEK_END);
+    world_index[key] = ftell(world_store);
+  }
+  world_chunk_begin();
+  write_dungeon_to(&world_chunk, world_store);
+  world_chunk_end();
+
+  free(world_chunk.rooms);
+  world_chunk.rooms = NULL;
+  world_chunk.num_rooms = 0;
+}
+
+/* Nothing may walk off the window, so its edge is solid, gates and all. *
+ * A chunk that was on the edge before the window moved may not be now, *
+ * so first every gate is opened again.                                 */
+static void world_edge(dungeon *d)
+{
+  int32_t x, y, sx, sy;
+  pair_t o;
+
+  for (sy = 0; sy < WORLD_SPAN; sy++) {
+    for (sx = 0; sx < WORLD_SPAN; sx++) {
+      o[dim_x] = sx * WORLD_CHUNK_X;
+      o[dim_y] = sy * WORLD_CHUNK_Y;
+      world_gates(d, world_origin[dim_x] + sx, world_origin[dim_y] + sy,
+                  o, 0);
+    }
+  }
+
+  for (x = 0; x < DUNGEON_X; x++) {
+    mapxy(x, 0) = mapxy(x, DUNGEON_Y - 1) = ter_wall_immutable;
+    hardnessxy(x, 0) = hardnessxy(x, DUNGEON_Y - 1) = 255;
+  }
+  for (y = 0; y < DUNGEON_Y; y++) {
+    mapxy(0, y) = mapxy(DUNGEON_X - 1, y) = ter_wall_immutable;
+    hardnessxy(0, y) = hardnessxy(DUNGEON_X - 1, y) = 255;
+  }
+}
+
+static void world_set_rooms(dungeon *d, std::vector<room_t> &rooms)
+{
+  free(d->rooms);
+  d->num_rooms = rooms.size();
+  d->rooms = (room_t *) malloc(sizeof (*d->rooms) * d->num_rooms);
+  memcpy(d->rooms, rooms.data(), sizeof (*d->rooms) * d->num_rooms);
+}
+
+/* Moves every cell of g by (-ox, -oy); what's uncovered is blank. */
+template <typename T>
+static void world_shift(grid<T> &g, int32_t ox, int32_t oy, const T &blank)
+{
+  int32_t i, j, x, y;
+
+  /* Going the same way as the cells, so none is overwritten before *
+   * it has been moved.                                             */
+  for (i = 0; i < g.height(); i++) {
+    y = oy >= 0 ? i : g.height() - 1 - i;
+    for (j = 0; j < g.width(); j++) {
+      x = ox >= 0 ? j : g.width() - 1 - j;
+      if (y + oy >= 0 && y + oy < g.height() &&
+          x + ox >= 0 && x + ox < g.width()) {
+        g[y][x] = g[y + oy][x + ox];
+      } else {
+        g[y][x] = blank;
+      }
+    }
+  }
+}
+
+static inline uint32_t world_slot_kept(int32_t sx, int32_t sy,
+                                       int32_t dx, int32_t dy)
+{
+  return (sx - dx >= 0 && sx - dx < WORLD_SPAN &&
+          sy - dy >= 0 && sy - dy < WORLD_SPAN);
+}
+
+/* Takes every monster off chunks that are leaving and moves the rest *
+ * with the window.  The PC is never in the queue during its turn.    */
+static void world_shift_monsters(dungeon *d, int32_t dx, int32_t dy)
+{
+  std::vector<event *> kept;
+  event *e;
+  npc *n;
+  uint32_t i;
+  int32_t x, y;
+
+  /* --dormant: sleeping monsters move with the rest */
+  npc_dormant_wake_all(d);
+  d->character_map.fill(NULL);
+  spatial_clear(d);
+
+  while ((e = (event *) heap_remove_min(&d->events))) {
+    n = (npc *) e->c;
+    x = n->position[dim_x] - dx * WORLD_CHUNK_X;
+    y = n->position[dim_y] - dy * WORLD_CHUNK_Y;
+    if (!n->alive) {
+      event_delete(e);
+    } else if (!world_slot_kept(n->position[dim_x] / WORLD_CHUNK_X,
+                                n->position[dim_y] / WORLD_CHUNK_Y, dx, dy) ||
+               /* Something that walks through walls could be in one   *
+                * that's about to be the edge, with nothing beyond it. */
+               x == 0 || x == DUNGEON_X - 1 || y == 0 || y == DUNGEON_Y - 1) {
+      /* Still alive, so a unique one can turn up again. */
+      d->num_monsters--;
+      event_delete(e);
+    } else {
+      n->position[dim_x] = x;
+      n->position[dim_y] = y;
+      n->pc_last_known_position[dim_x] -= dx * WORLD_CHUNK_X;
+      n->pc_last_known_position[dim_y] -= dy * WORLD_CHUNK_Y;
+      if (n->pc_last_known_position[dim_x] < 0                  ||
+          n->pc_last_known_position[dim_x] >= DUNGEON_X          ||
+          n->pc_last_known_position[dim_y] < 0                  ||
+          n->pc_last_known_position[dim_y] >= DUNGEON_Y) {
+        n->pc_last_known_position[dim_x] = n->position[dim_x];
+        n->pc_last_known_position[dim_y] = n->position[dim_y];
+      }
+      charpair(n->position) = n;
+      spatial_insert(d, n);
+      kept.push_back(e);
+    }
+  }
+
+  for (i = 0; i < kept.size(); i++) {
+    /* --lod needs to know where a coarse monster's event went */
+    n = (npc *) kept[i]->c;
+    n->lod_node = heap_insert(&d->events, kept[i]);
+  }
+}
+
+/* Likewise for objects; returns how many are left. */
+static uint32_t world_shift_objects(dungeon *d, int32_t dx, int32_t dy)
+{
+  int32_t x, y;
+  uint32_t count;
+  object *o;
+
+  for (count = 0, y = 0; y < DUNGEON_Y; y++) {
+    for (x = 0; x < DUNGEON_X; x++) {
+      if (!objxy(x, y)) {
+        continue;
+      }
+      if (!world_slot_kept(x / WORLD_CHUNK_X, y / WORLD_CHUNK_Y, dx, dy)) {
+        delete objxy(x, y);
+        objxy(x, y) = NULL;
+        continue;
+      }
+      for (o = objxy(x, y); o; o = o->get_next()) {
+        o->get_position()[dim_x] -= dx * WORLD_CHUNK_X;
+        o->get_position()[dim_y] -= dy * WORLD_CHUNK_Y;
+        count++;
+      }
+    }
+  }
+  world_shift(d->objmap, dx * WORLD_CHUNK_X, dy * WORLD_CHUNK_Y,
+              (object *) NULL);
+
+  return count;
+}
+
+void world_init(dungeon *d, uint32_t seed)
+{
+  std::vector<room_t> rooms;
+  int32_t sx, sy;
+
+  world_on = 1;
+  world_seed = seed;
+  world_origin[dim_x] = world_origin[dim_y] = -(WORLD_SPAN / 2);
+
+  if (!(world_store = tmpfile())) {
+    perror("tmpfile");
+    exit(-1);
+  }
+
+  world_chunk_begin();
+  init_dungeon(&world_chunk);
+  world_chunk_end();
+
+  /* The middle chunk's rooms come first, so that's where the PC starts. */
+  world_load(d, WORLD_SPAN / 2, WORLD_SPAN / 2, rooms);
+  for (sy = 0; sy < WORLD_SPAN; sy++) {
+    for (sx = 0; sx < WORLD_SPAN; sx++) {
+      if (sx != WORLD_SPAN / 2 || sy != WORLD_SPAN / 2) {
+        world_load(d, sx, sy, rooms);
+      }
+    }
+  }
+
+  world_edge(d);
+  world_set_rooms(d, rooms);
+  bitboard_rebuild(d);
+}
+
+void world_follow_pc(dungeon *d)
+{
+  std::vector<room_t> rooms;
+  int32_t dx, dy, sx, sy;
+  uint32_t i, first_new, cells;
+  room_t *all_rooms;
+  room_t r;
+
+  if (!world_on) {
+    return;
+  }
+
+  dx = d->PC->position[dim_x] / WORLD_CHUNK_X - WORLD_SPAN / 2;
+  dy = d->PC->position[dim_y] / WORLD_CHUNK_Y - WORLD_SPAN / 2;
+  if (!dx && !dy) {
+    return;
+  }
+
+  PROFILE_SCOPE("world_follow_pc");
+
+  for (sy = 0; sy < WORLD_SPAN; sy++) {
+    for (sx = 0; sx < WORLD_SPAN; sx++) {
+      if (!world_slot_kept(sx, sy, dx, dy)) {
+        world_evict(d, sx, sy);
+      }
+    }
+  }
+
+  for (i = 0; i < d->num_rooms; i++) {
+    r = d->rooms[i];
+    if (world_slot_kept(r.position[dim_x] / WORLD_CHUNK_X,
+                        r.position[dim_y] / WORLD_CHUNK_Y, dx, dy)) {
+      r.position[dim_x] -= dx * WORLD_CHUNK_X;
+      r.position[dim_y] -= dy * WORLD_CHUNK_Y;
+      rooms.push_back(r);
+    }
+  }
+  first_new = rooms.size();
+
+  world_shift_monsters(d, dx, dy);
+  d->num_objects = world_shift_objects(d, dx, dy);
+  world_shift(d->map, dx * WORLD_CHUNK_X, dy * WORLD_CHUNK_Y, ter_wall);
+  world_shift(d->hardness, dx * WORLD_CHUNK_X, dy * WORLD_CHUNK_Y,
+              (uint8_t) 255);
+  world_shift(d->PC->known_terrain, dx * WORLD_CHUNK_X, dy * WORLD_CHUNK_Y,
+              ter_unknown);
+
+  world_origin[dim_x] += dx;
+  world_origin[dim_y] += dy;
+  for (sy = 0; sy < WORLD_SPAN; sy++) {
+    for (sx = 0; sx < WORLD_SPAN; sx++) {
+      /* Uncovered by the shift */
+      if (!world_slot_kept(sx, sy, -dx, -dy)) {
+        world_load(d, sx, sy, rooms);
+      }
+    }
+  }
+  world_edge(d);
+  world_set_rooms(d, rooms);
+  bitboard_rebuild(d);
+
+  d->PC->position[dim_x] -= dx * WORLD_CHUNK_X;
+  d->PC->position[dim_y] -= dy * WORLD_CHUNK_Y;
+  charpair(d->PC->position) = d->PC;
+  io_shift_view(dx * WORLD_CHUNK_X, dy * WORLD_CHUNK_Y);
+  pc_reset_visibility(d->PC);
+  pc_observe_terrain(d->PC, d);
+
+  /* Restock from the new chunks only, so nothing turns up next to the *
+   * PC.  Monsters never go in the first room they're given, since     *
+   * that's where the PC starts out on a new level, and never more     *
+   * than there's room for.                                            */
+  all_rooms = d->rooms;
+  d->rooms += first_new;
+  d->num_rooms -= first_new;
+  for (cells = 0, i = 1; i < d->num_rooms; i++) {
+    cells += d->rooms[i].size[dim_x] * d->rooms[i].size[dim_y];
+  }
+  for (; d->num_monsters < d->max_monsters && cells; cells--) {
+    monster_description::generate_monster(d);
+    d->num_monsters++;
+  }
+  for (; d->num_objects < d->max_objects; d->num_objects++) {
+    gen_object(d);
+  }
+  d->rooms = all_rooms;
+  d->num_rooms += first_new;
+
+  dijkstra(d);
+  dijkstra_tunnel(d);
+  zobrist_rebuild(d);
+}
+
+void world_delete(void)
+{
+  if (!world_on) {
+    return;
+  }
+
+  fclose(world_store);
+  world_index.clear();
+  heap_delete(&world_chunk.events);
+  free(world_chunk.rooms);
+  world_chunk.rooms = NULL;
+  world_on = 0;
+}
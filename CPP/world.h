@@ -0,0 +1,37 @@
+#ifndef WORLD_H
+# define WORLD_H
+
+# include <stdint.h>
+
+# include "dungeon.h"
+
+/* --world: instead of one dungeon, an overworld without end, made of    *
+ * chunks the size of a default dungeon.  Each chunk is generated the    *
+ * first time it's needed from the seed and its chunk coordinates alone, *
+ * so it comes out the same whenever and however the PC gets there, and  *
+ * neighbouring chunks agree on where the gates through the wall between *
+ * them are.                                                             *
+ *                                                                       *
+ * Only WORLD_SPAN by WORLD_SPAN chunks, with the PC's in the middle,    *
+ * are ever in memory, and that window is the dungeon as far as the rest *
+ * of the game can tell: pathfinding, sight and monsters never see past  *
+ * it.  When the PC crosses into another chunk, the window moves: the    *
+ * chunks left behind are written to a scratch file in the save format   *
+ * and dropped, along with the monsters and objects on them, and the     *
+ * ones coming into view are read back or generated, and restocked.      */
+
+# define WORLD_CHUNK_X DEFAULT_DUNGEON_X
+# define WORLD_CHUNK_Y DEFAULT_DUNGEON_Y
+# define WORLD_SPAN    3
+# define WORLD_X       (WORLD_SPAN * WORLD_CHUNK_X)
+# define WORLD_Y       (WORLD_SPAN * WORLD_CHUNK_Y)
+
+/* Fills d, already sized WORLD_X by WORLD_Y, with the chunks around the *
+ * origin, in place of gen_dungeon().  The PC starts in the first room.  */
+void world_init(dungeon *d, uint32_t seed);
+/* Called at the start of every PC turn; moves the window if the PC has *
+ * left the middle chunk.  Does nothing unless world_init() was called. */
+void world_follow_pc(dungeon *d);
+void world_delete(void);
+
+#endif
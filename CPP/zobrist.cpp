@@ -0,0 +1,115 @@
+#include "zobrist.h"
+#include "dungeon.h"
+#include "character.h"
+#include "object.h"
+
+typedef enum zobrist_kind {
+  zobrist_cell,
+  zobrist_character,
+  zobrist_objects,
+  zobrist_time
+} zobrist_kind_t;
+
+/* The splitmix64 finalizer; every input bit affects every output bit. */
+static inline uint64_t zobrist_mix(uint64_t z)
+{
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+
+  return z ^ (z >> 31);
+}
+
+static inline uint64_t zobrist_key(zobrist_kind_t kind, int16_t y, int16_t x,
+                                   uint64_t value)
+{
+  return zobrist_mix(zobrist_mix(((uint64_t) kind << 32) |
+                                 ((uint32_t) (uint16_t) y << 16) |
+                                 (uint16_t) x) + value);
+}
+
+static uint64_t zobrist_cell_key(dungeon *d, int16_t y, int16_t x)
+{
+  return zobrist_key(zobrist_cell, y, x,
+                     (mapxy(x, y) << 8) | hardnessxy(x, y));
+}
+
+static uint64_t zobrist_character_key(character *c)
+{
+  return zobrist_key(zobrist_character,
+                     c->position[dim_y], c->position[dim_x],
+                     ((uint64_t) c->sequence_number << 32) |
+                     (uint32_t) c->hp);
+}
+
+/* Objects have nothing like a sequence number, so they're told apart by *
+ * what was rolled for them.  Order in the stack counts.                 */
+static uint64_t zobrist_objects_key(dungeon *d, int16_t y, int16_t x)
+{
+  object *o;
+  uint64_t v;
+
+  if (!(o = objxy(x, y))) {
+    return 0;
+  }
+
+  for (v = 0; o; o = o->get_next()) {
+    v = zobrist_mix(v + ((uint64_t) o->get_raw_symbol() << 56 |
+                         (uint64_t) (o->get_type() & 0xff) << 48 |
+                         (uint64_t) (o->get_hit() & 0xffff) << 32 |
+                         (uint64_t) (o->get_dodge() & 0xffff) << 16 |
+                         (uint64_t) (o->get_defence() & 0xffff)));
+    v = zobrist_mix(v + ((uint64_t) (o->get_speed() & 0xffff) << 32 |
+                         (uint64_t) (o->get_weight() & 0xffff) << 16 |
+                         (uint64_t) (o->get_damage_base() & 0xffff)));
+  }
+
+  return zobrist_key(zobrist_objects, y, x, v);
+}
+
+void zobrist_toggle_cell(dungeon *d, pair_t p)
+{
+  d->hash ^= zobrist_cell_key(d, p[dim_y], p[dim_x]);
+}
+
+void zobrist_toggle_character(dungeon *d, character *c)
+{
+  d->hash ^= zobrist_character_key(c);
+}
+
+void zobrist_toggle_objects(dungeon *d, pair_t p)
+{
+  d->hash ^= zobrist_objects_key(d, p[dim_y], p[dim_x]);
+}
+
+static uint64_t zobrist_compute_board(dungeon *d)
+{
+  uint64_t h;
+  int16_t y, x;
+
+  for (h = 0, y = 0; y < DUNGEON_Y; y++) {
+    for (x = 0; x < DUNGEON_X; x++) {
+      h ^= zobrist_cell_key(d, y, x);
+      if (charxy(x, y)) {
+        h ^= zobrist_character_key(charxy(x, y));
+      }
+      h ^= zobrist_objects_key(d, y, x);
+    }
+  }
+
+  return h;
+}
+
+void zobrist_rebuild(dungeon *d)
+{
+  d->hash = zobrist_compute_board(d);
+}
+
+uint64_t zobrist_hash(dungeon *d)
+{
+  return d->hash ^ zobrist_key(zobrist_time, 0, 0, d->time);
+}
+
+uint64_t zobrist_compute(dungeon *d)
+{
+  return zobrist_compute_board(d) ^ zobrist_key(zobrist_time, 0, 0, d->time);
+}
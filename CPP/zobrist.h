@@ -0,0 +1,37 @@
+#ifndef ZOBRIST_H
+# define ZOBRIST_H
+
+# include <stdint.h>
+
+# include "dims.h"
+
+class dungeon;
+class character;
+
+/* d->hash is a Zobrist hash of the game state: every map cell (terrain *
+ * and hardness), every character on the map (where it is, who it is,   *
+ * and its hit points), and every stack of objects on the floor each     *
+ * have a pseudo-random 64-bit key, and the hash is all of them XORed    *
+ * together.  XOR undoes itself, so a change costs two keys: take the    *
+ * thing out, change it, put it back.  The keys are computed from what   *
+ * they stand for rather than looked up, since hardness alone would need *
+ * 256 of them per cell.                                                 *
+ *                                                                       *
+ * Like d->passable and the spatial index, it's up to whatever changes   *
+ * the state to keep the hash up to date.  Each of the toggles below     *
+ * goes once before the change and once after (or only before, when the *
+ * thing is leaving the map for good).                                   */
+
+void zobrist_toggle_cell(dungeon *d, pair_t p);
+void zobrist_toggle_character(dungeon *d, character *c);
+/* The whole stack of objects at p, as one key */
+void zobrist_toggle_objects(dungeon *d, pair_t p);
+/* For after a new level has been put together. */
+void zobrist_rebuild(dungeon *d);
+/* d->hash with d->time folded in; this is what to compare turn by turn. */
+uint64_t zobrist_hash(dungeon *d);
+/* What zobrist_hash() should be, worked out from scratch, to catch a  *
+ * change that forgot to update d->hash.                               */
+uint64_t zobrist_compute(dungeon *d);
+
+#endif